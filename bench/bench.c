@@ -0,0 +1,173 @@
+#include "bench.h"
+#include "platform.h"
+#include "arena.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_RESULTS 128
+#define BENCH_MAX_SAMPLES 101
+#define BENCH_WARMUP_SAMPLES 3
+
+typedef struct {
+    char name[64];
+    double median_ns;
+    double mad_ns;
+    double rate; // 0 if the case reports no throughput
+    const char * rate_unit;
+    unsigned long iterations;
+    unsigned samples;
+} BenchResult;
+
+volatile float bench_sink;
+
+static struct {
+    const char * filter;
+    const char * json;
+    unsigned samples;
+    double min_sample_ns;
+    BenchResult results[BENCH_MAX_RESULTS];
+    unsigned result_count;
+    unsigned failures;
+} bench = {NULL, NULL, 15, 5e6, {{{0}, 0, 0, 0, NULL, 0, 0}}, 0, 0};
+
+static double bench_nsec() {
+    return util_nsec();
+}
+
+static double bench_sample(const BenchCase * c, unsigned long iterations) {
+    if (c->reset)
+        c->reset(c->user);
+    double start = bench_nsec();
+    c->run(c->user, iterations);
+    double elapsed = bench_nsec() - start;
+    // Each sample ends a frame, as far as scratch memory is concerned.
+    arena_frame();
+    return elapsed;
+}
+
+static int bench_compare(const void * a, const void * b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double bench_median(double * values, unsigned n) {
+    qsort(values, n, sizeof(double), bench_compare);
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+void bench_run_rate(const BenchCase * c, double work, double rate_ns, const char * unit) {
+    if (bench.filter && !strstr(c->name, bench.filter))
+        return;
+    if (bench.result_count == BENCH_MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmark cases.\n");
+        return;
+    }
+    // Double the iterations until a sample is long enough to time reliably.
+    // These samples double as the first part of the warm-up.
+    unsigned long iterations = 1;
+    while (bench_sample(c, iterations) < bench.min_sample_ns && iterations < (1UL << 30))
+        iterations *= 2;
+    for (unsigned i = 0; i < BENCH_WARMUP_SAMPLES; i++)
+        bench_sample(c, iterations);
+    double per_op[BENCH_MAX_SAMPLES];
+    double deviation[BENCH_MAX_SAMPLES];
+    for (unsigned i = 0; i < bench.samples; i++)
+        per_op[i] = bench_sample(c, iterations) / iterations;
+    double median = bench_median(per_op, bench.samples);
+    for (unsigned i = 0; i < bench.samples; i++)
+        deviation[i] = per_op[i] > median ? per_op[i] - median : median - per_op[i];
+    double mad = bench_median(deviation, bench.samples);
+
+    BenchResult * r = bench.results + bench.result_count++;
+    snprintf(r->name, sizeof(r->name), "%s", c->name);
+    r->median_ns = median;
+    r->mad_ns = mad;
+    r->iterations = iterations;
+    r->samples = bench.samples;
+    r->rate = work > 0 && median > 0 ? work * rate_ns / median : 0;
+    r->rate_unit = unit;
+    printf("%-32s %14.1f ns  +- %5.2f%%  (%lu x %u)",
+            c->name, median, median > 0 ? 100 * mad / median : 0, iterations, bench.samples);
+    if (r->rate > 0)
+        printf("  %.4g %s", r->rate, r->rate_unit);
+    printf("\n");
+    fflush(stdout);
+}
+
+void bench_run(const BenchCase * c) {
+    bench_run_rate(c, 0, 0, NULL);
+}
+
+void bench_check(const char * name, int ok) {
+    printf("%-32s %s\n", name, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    if (!ok)
+        bench.failures++;
+}
+
+static void bench_write_json(const char * path) {
+    FILE * f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return;
+    }
+    fprintf(f, "{\n  \"version\": 1,\n  \"unit\": \"ns\",\n  \"results\": [\n");
+    for (unsigned i = 0; i < bench.result_count; i++) {
+        const BenchResult * r = bench.results + i;
+        fprintf(f, "    {\"name\": \"%s\", \"median\": %.3f, \"mad\": %.3f, \"iterations\": %lu, \"samples\": %u",
+                r->name, r->median_ns, r->mad_ns, r->iterations, r->samples);
+        if (r->rate > 0)
+            fprintf(f, ", \"rate\": %.3f, \"rate_unit\": \"%s\"", r->rate, r->rate_unit);
+        fprintf(f, "}%s\n", i + 1 < bench.result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+static void bench_usage(const char * program) {
+    fprintf(stderr,
+            "usage: %s [--filter SUBSTRING] [--samples N] [--min-sample-ms MS] [--json PATH]\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char ** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc)
+            bench_usage(argv[0]);
+        const char * value = argv[++i];
+        if (!strcmp(argv[i - 1], "--filter"))
+            bench.filter = value;
+        else if (!strcmp(argv[i - 1], "--json"))
+            bench.json = value;
+        else if (!strcmp(argv[i - 1], "--samples"))
+            bench.samples = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i - 1], "--min-sample-ms"))
+            bench.min_sample_ns = strtod(value, NULL) * 1e6;
+        else
+            bench_usage(argv[0]);
+    }
+    if (bench.samples < 1 || bench.samples > BENCH_MAX_SAMPLES)
+        bench_usage(argv[0]);
+
+    // Text, meshes and shaders need a GL context and the resource paths.
+    PlatformOptions options;
+    char * args[] = {argv[0], "--headless", "--size", "64x64", NULL};
+    platform_parse_options(&options, 4, args);
+    platform_init(&options);
+
+    bench_math();
+    bench_scene();
+    bench_text();
+    bench_assets();
+    bench_audio();
+
+    if (bench.json)
+        bench_write_json(bench.json);
+    platform_deinit();
+    if (bench.failures)
+        fprintf(stderr, "%u checks failed.\n", bench.failures);
+    return bench.failures ? 1 : 0;
+}
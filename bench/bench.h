@@ -0,0 +1,42 @@
+#ifndef BENCH_H_J6QX2MRA
+#define BENCH_H_J6QX2MRA
+
+// Microbenchmark harness. Each case runs in samples of a calibrated number of
+// iterations. The first samples warm up; the rest give the median time per
+// iteration and its median absolute deviation. Case names are stable, so the
+// JSON output of two commits can be compared directly.
+
+// Runs the body of a case the given number of times.
+typedef void (*BenchFunction)(void * user, unsigned long iterations);
+
+// Called before every sample, outside the timed region.
+typedef void (*BenchReset)(void * user);
+
+typedef struct {
+    const char * name;
+    BenchFunction run;
+    BenchReset reset; // May be NULL
+    void * user;
+} BenchCase;
+
+void bench_run(const BenchCase * c);
+
+// Like bench_run, and also reports throughput: work items are done per
+// iteration, counted per rate_ns nanoseconds in unit, e.g. 1e9 and "chars/s".
+void bench_run_rate(const BenchCase * c, double work, double rate_ns, const char * unit);
+
+// Prints the outcome of a correctness check. ldoom_bench exits with an error
+// if any check failed.
+void bench_check(const char * name, int ok);
+
+// Results written here can't be optimized away.
+extern volatile float bench_sink;
+
+// Cases, one function per file.
+void bench_math();
+void bench_scene();
+void bench_text();
+void bench_assets();
+void bench_audio();
+
+#endif /* end of include guard: BENCH_H_J6QX2MRA */
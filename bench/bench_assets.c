@@ -0,0 +1,153 @@
+#include "bench.h"
+#include "model.h"
+#include "iqm.h"
+#include "blockfactory.h"
+#include "platform.h"
+#include "util.h"
+#include "stb_vorbis.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define BENCH_IQM_GRID 64
+#define BENCH_PATHLEN 1024
+
+// Writes a GRID x GRID vertex plane with positions, uvs and normals, about
+// 220 KB. There is no IQM model among the resources, so the file is generated.
+static int bench_write_iqm(const char * path) {
+    static const char text[] = "\0grid\0";
+    unsigned nv = BENCH_IQM_GRID * BENCH_IQM_GRID;
+    unsigned nt = 2 * (BENCH_IQM_GRID - 1) * (BENCH_IQM_GRID - 1);
+
+    struct iqmheader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IQM_MAGIC, sizeof(IQM_MAGIC));
+    h.version = IQM_VERSION;
+    h.num_text = 2;
+    h.ofs_text = sizeof(h);
+    h.num_vertexarrays = 3;
+    h.num_vertexes = nv;
+    h.ofs_vertexarrays = h.ofs_text + sizeof(text);
+    unsigned ofs_position = h.ofs_vertexarrays + 3 * sizeof(struct iqmvertexarray);
+    unsigned ofs_texcoord = ofs_position + nv * 3 * sizeof(float);
+    unsigned ofs_normal = ofs_texcoord + nv * 2 * sizeof(float);
+    h.num_triangles = nt;
+    h.ofs_triangles = ofs_normal + nv * 3 * sizeof(float);
+    h.num_meshes = 1;
+    h.ofs_meshes = h.ofs_triangles + nt * sizeof(struct iqmtriangle);
+    h.filesize = h.ofs_meshes + sizeof(struct iqmmesh);
+
+    char * data = calloc(1, h.filesize);
+    memcpy(data, &h, sizeof(h));
+    memcpy(data + h.ofs_text, text, sizeof(text));
+    struct iqmvertexarray * va = (struct iqmvertexarray *) (data + h.ofs_vertexarrays);
+    va[0] = (struct iqmvertexarray) {IQM_POSITION, 0, IQM_FLOAT, 3, ofs_position};
+    va[1] = (struct iqmvertexarray) {IQM_TEXCOORD, 0, IQM_FLOAT, 2, ofs_texcoord};
+    va[2] = (struct iqmvertexarray) {IQM_NORMAL, 0, IQM_FLOAT, 3, ofs_normal};
+
+    float * position = (float *) (data + ofs_position);
+    float * texcoord = (float *) (data + ofs_texcoord);
+    float * normal = (float *) (data + ofs_normal);
+    for (unsigned i = 0; i < nv; i++) {
+        float u = (float) (i % BENCH_IQM_GRID) / (BENCH_IQM_GRID - 1);
+        float v = (float) (i / BENCH_IQM_GRID) / (BENCH_IQM_GRID - 1);
+        position[3 * i] = u;
+        position[3 * i + 1] = 0.1f * sinf(8 * u) * cosf(8 * v);
+        position[3 * i + 2] = v;
+        texcoord[2 * i] = u;
+        texcoord[2 * i + 1] = v;
+        normal[3 * i] = normal[3 * i + 2] = 0;
+        normal[3 * i + 1] = 1;
+    }
+
+    struct iqmtriangle * tri = (struct iqmtriangle *) (data + h.ofs_triangles);
+    for (unsigned y = 0; y < BENCH_IQM_GRID - 1; y++) {
+        for (unsigned x = 0; x < BENCH_IQM_GRID - 1; x++) {
+            unsigned a = y * BENCH_IQM_GRID + x;
+            unsigned b = a + BENCH_IQM_GRID;
+            *tri++ = (struct iqmtriangle) {{a, b, a + 1}};
+            *tri++ = (struct iqmtriangle) {{a + 1, b, b + 1}};
+        }
+    }
+
+    struct iqmmesh * mesh = (struct iqmmesh *) (data + h.ofs_meshes);
+    *mesh = (struct iqmmesh) {1, 0, 0, nv, 0, nt};
+
+    FILE * f = fopen(path, "wb");
+    int ok = f && fwrite(data, 1, h.filesize, f) == h.filesize;
+    if (f && fclose(f))
+        ok = 0;
+    free(data);
+    return ok;
+}
+
+static void bench_model_loadfile(void * user, unsigned long iterations) {
+    Model model;
+    for (unsigned long n = 0; n < iterations; n++) {
+        if (model_loadfile(&model, user))
+            uerr("Could not load the benchmark model.");
+        model_deinit(&model);
+    }
+    bench_sink = model.vertexCount;
+}
+
+static void bench_btpl_tomesh(void * user, unsigned long iterations) {
+    Mesh mesh;
+    for (unsigned long n = 0; n < iterations; n++) {
+        btpl_tomesh(user, &mesh, 0);
+        mesh_deinit(&mesh);
+    }
+    bench_sink = mesh.vcount;
+}
+
+static void bench_vorbis_decode(void * user, unsigned long iterations) {
+    int channels, sample_rate, samples = 0;
+    short * pcm;
+    for (unsigned long n = 0; n < iterations; n++) {
+        samples = stb_vorbis_decode_filename(user, &channels, &sample_rate, &pcm);
+        if (samples < 0)
+            uerr("Could not decode the benchmark sound.");
+        free(pcm);
+    }
+    bench_sink = samples;
+}
+
+static void bench_slurp(void * user, unsigned long iterations) {
+    long length = 0;
+    for (unsigned long n = 0; n < iterations; n++)
+        free(util_slurp(user, &length));
+    bench_sink = length;
+}
+
+void bench_assets() {
+    char iqm[BENCH_PATHLEN];
+    if (util_cache_dir("bench", iqm, sizeof(iqm) - 16)) {
+        strcat(iqm, "/grid.iqm");
+        if (bench_write_iqm(iqm)) {
+            BenchCase bc = {"model_loadfile 4k verts", bench_model_loadfile, NULL, iqm};
+            bench_run(&bc);
+            remove(iqm);
+        }
+    }
+
+    // A 32-gon column, like the level blocks.
+    float base[64];
+    for (int i = 0; i < 32; i++) {
+        base[2 * i] = cosf(i * 2 * LD_PI / 32);
+        base[2 * i + 1] = sinf(i * 2 * LD_PI / 32);
+    }
+    BlockMeshTemplate tpl;
+    btpl_init(&tpl, 2, 32, base);
+    BenchCase mesh_case = {"btpl_tomesh 32 sides", bench_btpl_tomesh, NULL, &tpl};
+    bench_run(&mesh_case);
+    btpl_deinit(&tpl);
+
+    // The path lives in the scratch arena, which bench_run resets, so keep a copy.
+    char snd[BENCH_PATHLEN];
+    snprintf(snd, sizeof(snd), "%s", platform_res2file_ez("snd.ogg"));
+    BenchCase vorbis_case = {"stb_vorbis decode snd.ogg", bench_vorbis_decode, NULL, snd};
+    bench_run(&vorbis_case);
+    BenchCase slurp_case = {"util_slurp snd.ogg", bench_slurp, NULL, snd};
+    bench_run(&slurp_case);
+}
@@ -0,0 +1,173 @@
+#include "bench.h"
+#include "mixer.h"
+#include "audio.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks of the voice pool and of streaming. These run on a loopback device,
+// which mixes only when asked to, so what played is known to the sample no
+// matter how fast the machine is or whether it has a sound card.
+
+#define BENCH_LOOPBACK_RATE 44100
+#define BENCH_LOOPBACK_BLOCK 256
+#define BENCH_LOOPBACK_SECONDS ((double) BENCH_LOOPBACK_BLOCK / BENCH_LOOPBACK_RATE)
+
+// Mixes seconds of sound a block at a time. With update set, the audio system
+// is updated after every block like it would be every frame. Returns the
+// seconds mixed, which stop early once a sound given as until stops playing.
+static double bench_loopback_mix(double seconds, int update, const Sound * until) {
+    static short block[2 * BENCH_LOOPBACK_BLOCK];
+    double mixed = 0;
+    while (mixed < seconds && (!until || (until->flags & AUDIO_PLAYING))) {
+        audio_render(block, BENCH_LOOPBACK_BLOCK);
+        mixed += BENCH_LOOPBACK_SECONDS;
+        if (update)
+            audio_update(BENCH_LOOPBACK_SECONDS);
+    }
+    return mixed;
+}
+
+static void bench_voice_checks() {
+    static const vec3 zero = {0, 0, 0};
+    static const vec3 forward = {0, 0, -1};
+    static const vec3 up = {0, 1, 0};
+    static Sound sounds[AUDIO_MAX_VOICES + 8];
+    audio_set_listener(zero, forward, up);
+    AudioVoiceStats stats;
+    audio_voice_stats(&stats);
+    unsigned n = stats.voices + 8;
+    // Each sound matters 1.25 times more than the one before, more than the
+    // bonus a real voice gets, so exactly the last stats.voices should be real.
+    // The quiet ones start first and take the free sources.
+    for (unsigned i = 0; i < n; i++) {
+        audio_sound_init_resource(sounds + i, "snd.ogg");
+        sounds[i].priority = powf(1.25f, i);
+        audio_sound_loop(sounds + i);
+    }
+    audio_update(0);
+    int top = 1;
+    for (unsigned i = 0; i < n; i++)
+        top &= (sounds[i].voice >= 0) == (i >= n - stats.voices);
+    bench_check("audio voices keep the top N", top);
+
+    // Let the quietest sound run while virtual, then make it the loudest. The
+    // source it gets must pick up from its cursor, so after one more block it
+    // should be a block past it.
+    Sound * quiet = sounds;
+    float duration = (float) quiet->data->samples / quiet->data->sample_rate;
+    audio_update(duration * 0.4f);
+    float cursor = quiet->cursor;
+    quiet->priority = powf(1.25f, n);
+    audio_update(0);
+    ALfloat offset = -1;
+    if (quiet->voice >= 0) {
+        bench_loopback_mix(BENCH_LOOPBACK_SECONDS, 0, NULL);
+        alGetSourcef(quiet->source, AL_SEC_OFFSET, &offset);
+    }
+    bench_check("audio promoted voice resumes", cursor > BENCH_LOOPBACK_SECONDS * 2 &&
+            fabsf(offset - cursor - (float) BENCH_LOOPBACK_SECONDS) < BENCH_LOOPBACK_SECONDS);
+
+    for (unsigned i = 0; i < n; i++)
+        audio_sound_deinit(sounds + i);
+}
+
+static void bench_stream_checks() {
+    // A stream stops one update after its last buffer, and resampling adds a
+    // few samples, so allow for a couple of blocks.
+    const double slack = 3 * BENCH_LOOPBACK_SECONDS;
+    Sound s;
+    audio_sound_init_stream(&s, "snd.ogg");
+    double duration = (double) s.stream->samples / s.stream->sample_rate;
+
+    audio_sound_play(&s);
+    double played = bench_loopback_mix(duration + 1, 1, &s);
+    bench_check("audio stream plays to the end", fabs(played - duration) < slack);
+
+    unsigned half = s.stream->samples / 2;
+    audio_sound_play(&s);
+    audio_sound_seek(&s, half);
+    played = bench_loopback_mix(duration + 1, 1, &s);
+    bench_check("audio stream seeks", fabs(played - (duration - (double) half / s.stream->sample_rate)) < slack);
+
+    audio_sound_loop(&s);
+    played = bench_loopback_mix(3 * duration + 1, 1, &s);
+    bench_check("audio stream loops", (s.flags & AUDIO_PLAYING) && played >= 3 * duration + 1);
+
+    // Starve the looping stream past everything it has queued, so the source
+    // stops, then let one update refill and restart it.
+    bench_loopback_mix((double) AUDIO_STREAM_BUFFERS * AUDIO_STREAM_BUFFER_SAMPLES / s.stream->sample_rate + 0.1,
+            0, NULL);
+    ALint state;
+    alGetSourcei(s.source, AL_SOURCE_STATE, &state);
+    int starved = state == AL_STOPPED;
+    audio_update(0);
+    alGetSourcei(s.source, AL_SOURCE_STATE, &state);
+    bench_check("audio stream recovers from underrun", starved && state == AL_PLAYING &&
+            (s.flags & AUDIO_PLAYING));
+
+    audio_sound_deinit(&s);
+}
+
+// Swaps the device platform_init opened for a loopback one while the checks run.
+static void bench_audio_checks() {
+    audio_deinit();
+    if (audio_init_loopback(BENCH_LOOPBACK_RATE)) {
+        bench_voice_checks();
+        bench_stream_checks();
+        audio_deinit();
+    } else {
+        printf("%-32s %s\n", "audio checks", "skipped, no ALC_SOFT_loopback");
+    }
+    audio_init();
+}
+
+// Mixes blocks of MIXER_BLOCK_FRAMES with a fixed number of voices playing.
+// The mixer runs unthreaded, so the block is rendered on this thread and
+// nothing reaches AL. Voices use different pitches and pans so every one is
+// resampled and panned. The rate counts one voice through one block as one
+// voice; a block is about 11.6 ms of sound at 44.1 kHz.
+
+#define BENCH_MIXER_RATE 44100
+
+typedef struct {
+    MixerClip * clip;
+    unsigned voices;
+    short out[2 * MIXER_BLOCK_FRAMES];
+} MixerBench;
+
+static void bench_mixer_render(void * user, unsigned long iterations) {
+    MixerBench * b = user;
+    for (unsigned long n = 0; n < iterations; n++) {
+        // Replace the voices that reached the end of the clip.
+        for (unsigned v = mixer_voice_count(); v < b->voices; v++)
+            mixer_play(b->clip, 0.1f, 0.75f + 0.0625f * (v % 8), (v % 5) * 0.5f - 1);
+        mixer_render(b->out, MIXER_BLOCK_FRAMES);
+    }
+    bench_sink = b->out[0];
+}
+
+void bench_audio() {
+    // Swap the threaded mixer platform_init started for one this thread drives.
+    // platform_deinit stops it like any other. The mixer's source goes first,
+    // as the checks replace the audio device.
+    mixer_deinit();
+    bench_audio_checks();
+    mixer_init(BENCH_MIXER_RATE, 0);
+    MixerBench b;
+    b.clip = mixer_clip_load("snd.ogg");
+    static const struct {
+        const char * name;
+        unsigned voices;
+    } cases[] = {
+        {"mixer_render 16 voices", 16},
+        {"mixer_render 64 voices", 64},
+        {"mixer_render 256 voices", 256}
+    };
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        b.voices = cases[i].voices;
+        BenchCase bc = {cases[i].name, bench_mixer_render, NULL, &b};
+        bench_run_rate(&bc, b.voices, 1e6, "voices/ms");
+    }
+    mixer_clip_release(b.clip);
+}
@@ -0,0 +1,78 @@
+#include "bench.h"
+#include "ldmath.h"
+
+#define BENCH_MATH_COUNT 1024
+
+static struct {
+    mat4 mats[BENCH_MATH_COUNT];
+    vec3 vecs[BENCH_MATH_COUNT];
+    quat quats[BENCH_MATH_COUNT];
+} data;
+
+static void bench_math_init() {
+    for (int i = 0; i < BENCH_MATH_COUNT; i++) {
+        float f = i * 0.01f;
+        vec3 axis = {f, 1, -f};
+        vec3_norm(axis, axis);
+        quat_rot(data.quats[i], axis, f);
+        quat_2mat4(data.quats[i], data.mats[i]);
+        data.mats[i][12] = f;
+        data.vecs[i][0] = f;
+        data.vecs[i][1] = 1 - f;
+        data.vecs[i][2] = 2 * f;
+    }
+}
+
+static void bench_mat4_mul(void * user, unsigned long iterations) {
+    mat4 out;
+    for (unsigned long n = 0; n < iterations; n++)
+        for (int i = 1; i < BENCH_MATH_COUNT; i++)
+            mat4_mul(out, data.mats[i - 1], data.mats[i]);
+    bench_sink = out[0];
+}
+
+static void bench_vec3_ops(void * user, unsigned long iterations) {
+    vec3 acc = {0, 0, 0}, tmp;
+    for (unsigned long n = 0; n < iterations; n++) {
+        for (int i = 1; i < BENCH_MATH_COUNT; i++) {
+            vec3_cross(tmp, data.vecs[i - 1], data.vecs[i]);
+            vec3_addmul(acc, acc, tmp, vec3_dot(data.vecs[i - 1], data.vecs[i]));
+            vec3_norm(tmp, acc);
+            vec3_add(acc, acc, tmp);
+        }
+    }
+    bench_sink = acc[0];
+}
+
+static void bench_quat_ops(void * user, unsigned long iterations) {
+    quat q;
+    vec3 v;
+    for (unsigned long n = 0; n < iterations; n++) {
+        for (int i = 1; i < BENCH_MATH_COUNT; i++) {
+            quat_mul(q, data.quats[i - 1], data.quats[i]);
+            quat_norm(q);
+            quat_mul_vec3(v, q, data.vecs[i]);
+        }
+    }
+    bench_sink = v[0];
+}
+
+static void bench_quat_2mat4(void * user, unsigned long iterations) {
+    mat4 m;
+    for (unsigned long n = 0; n < iterations; n++)
+        for (int i = 0; i < BENCH_MATH_COUNT; i++)
+            quat_2mat4(data.quats[i], m);
+    bench_sink = m[0];
+}
+
+void bench_math() {
+    bench_math_init();
+    const BenchCase cases[] = {
+        {"ldmath.mat4_mul x1023", bench_mat4_mul, NULL, NULL},
+        {"ldmath.vec3_ops x1023", bench_vec3_ops, NULL, NULL},
+        {"ldmath.quat_ops x1023", bench_quat_ops, NULL, NULL},
+        {"ldmath.quat_2mat4 x1024", bench_quat_2mat4, NULL, NULL},
+    };
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        bench_run(cases + i);
+}
@@ -0,0 +1,51 @@
+#include "bench.h"
+#include "scene.h"
+#include "mob.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    unsigned count;
+    MobDef def;
+    Mob * mobs;
+    char name[32];
+} SceneBench;
+
+// Mobs start on a grid a little tighter than their diameter, so the collision
+// pass has real work to do.
+static void bench_scene_reset(void * user) {
+    static const vec3 zero = {0, 0, 0};
+    SceneBench * b = user;
+    unsigned side = 1;
+    while (side * side < b->count)
+        side++;
+    for (unsigned i = 0; i < b->count; i++) {
+        vec3 pos = {(i % side) * 0.9f, 0, (i / side) * 0.9f};
+        mob_init(b->mobs + i, &b->def, pos);
+        vec3_assign(b->mobs[i]._position_penalty, zero);
+    }
+}
+
+static void bench_scene_update(void * user, unsigned long iterations) {
+    for (unsigned long n = 0; n < iterations; n++)
+        scene_update();
+}
+
+void bench_scene() {
+    static const unsigned counts[] = {16, 128, 1024};
+    for (unsigned c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        SceneBench b;
+        b.count = counts[c];
+        mobdef_init(&b.def);
+        b.mobs = calloc(b.count, sizeof(Mob));
+        snprintf(b.name, sizeof(b.name), "scene_update %u mobs", b.count);
+        bench_scene_reset(&b);
+        for (unsigned i = 0; i < b.count; i++)
+            scene_add_mob(b.mobs + i);
+        BenchCase bc = {b.name, bench_scene_update, bench_scene_reset, &b};
+        bench_run(&bc);
+        for (unsigned i = 0; i < b.count; i++)
+            scene_remove_mob(b.mobs + i);
+        free(b.mobs);
+    }
+}
@@ -0,0 +1,68 @@
+#include "bench.h"
+#include "fntdraw.h"
+#include <stdlib.h>
+#include <string.h>
+
+// About a screen of console output. The markup sequences take the escape path
+// of fill_buffers; the UTF-8 variant takes the multibyte decoder.
+static const char * ascii_paragraph =
+    "The quick brown fox jumps over the lazy dog. $#ffff00Pack my box$#ffffff with five dozen "
+    "liquor jugs. Sphinx of black quartz, judge my vow! How vexingly quick daft zebras jump. ";
+static const char * utf8_paragraph =
+    "Voix ambigu\xc3\xab d'un c\xc5\x93ur qui, au z\xc3\xa9phyr, pr\xc3\xa9" "f\xc3\xa8re les jattes de kiwis. "
+    "\xc3\x9c" "bergr\xc3\xb6\xc3\x9f" "e Stra\xc3\x9f" "enb\xc3\xa4ume f\xc3\xbchren zur Z\xc3\xbcrcher Vorstadt. ";
+// Latin, Greek and Cyrillic. Scripts outside the direct table take the glyph
+// hash lookup, and a font without them falls back for every character.
+static const char * mixed_paragraph =
+    "Jackdaws love my big sphinx of quartz. "
+    "\xce\x9e\xce\xb5\xcf\x83\xce\xba\xce\xb5\xcf\x80\xce\xac\xce\xb6\xcf\x89 \xcf\x84\xce\xb7\xce\xbd \xcf\x88\xcf\x85\xcf\x87\xce\xbf\xcf\x86\xce\xb8\xcf\x8c\xcf\x81\xce\xb1 \xce\xb2\xce\xb4\xce\xb5\xce\xbb\xcf\x85\xce\xb3\xce\xbc\xce\xaf\xce\xb1. "
+    "\xd0\xa1\xd1\x8a\xd0\xb5\xd1\x88\xd1\x8c \xd0\xb6\xd0\xb5 \xd0\xb5\xd1\x89\xd1\x91 \xd1\x8d\xd1\x82\xd0\xb8\xd1\x85 \xd0\xbc\xd1\x8f\xd0\xb3\xd0\xba\xd0\xb8\xd1\x85 \xd1\x84\xd1\x80\xd0\xb0\xd0\xbd\xd1\x86\xd1\x83\xd0\xb7\xd1\x81\xd0\xba\xd0\xb8\xd1\x85 \xd0\xb1\xd1\x83\xd0\xbb\xd0\xbe\xd0\xba, \xd0\xb4\xd0\xb0 \xd0\xb2\xd1\x8b\xd0\xbf\xd0\xb5\xd0\xb9 \xd1\x87\xd0\xb0\xd1\x8e. ";
+
+#define BENCH_TEXT_REPEAT 16
+
+typedef struct {
+    Text text;
+    char * string;
+} TextBench;
+
+static void bench_text_set(void * user, unsigned long iterations) {
+    TextBench * b = user;
+    for (unsigned long n = 0; n < iterations; n++)
+        text_set(&b->text, b->string);
+    bench_sink = b->text.num_quads;
+}
+
+static void bench_text_case(const char * name, FontDef * fd, const char * paragraph) {
+    TextBench b;
+    size_t len = strlen(paragraph);
+    b.string = malloc(len * BENCH_TEXT_REPEAT + 1);
+    for (int i = 0; i < BENCH_TEXT_REPEAT; i++)
+        memcpy(b.string + i * len, paragraph, len);
+    b.string[len * BENCH_TEXT_REPEAT] = '\0';
+
+    TextOptions options;
+    fnt_default_options(fd, &options);
+    options.width = 800;
+    text_init(&b.text, &options, b.string);
+    // Keep the upload out of the measurement; only the layout is timed.
+    text_unloadbuffer(&b.text);
+
+    // Throughput counts codepoints, so the UTF-8 cases compare with ASCII.
+    size_t chars = 0;
+    for (const char * c = b.string; *c; c++)
+        chars += (*c & 0xC0) != 0x80;
+    BenchCase bc = {name, bench_text_set, NULL, &b};
+    bench_run_rate(&bc, chars, 1e9, "chars/s");
+
+    text_deinit(&b.text);
+    free(b.string);
+}
+
+void bench_text() {
+    FontDef fd;
+    fnt_init(&fd, "hud.txt");
+    bench_text_case("text_set ascii 2.8k", &fd, ascii_paragraph);
+    bench_text_case("text_set utf8 2.2k", &fd, utf8_paragraph);
+    bench_text_case("text_set mixed 3.3k", &fd, mixed_paragraph);
+    fnt_deinit(&fd);
+}
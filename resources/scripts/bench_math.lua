@@ -0,0 +1,60 @@
+-- Compares transforming 100k points with plain Lua tables against ldoom.math.
+-- Run with dofile or ldoom's script loader; results go to the console.
+
+local N = 100000
+local m = ldoom.math
+local log = ldoom.console and ldoom.console.log or print
+
+local function time(name, f)
+    f() -- warm up the JIT
+    local start = os.clock()
+    f()
+    log(string.format("%-28s %8.2f ms", name, (os.clock() - start) * 1000))
+end
+
+local M = m.rotationY(0.5) * m.translation(1, 2, 3)
+local Mt = { M:unpack() }
+
+local points = {}
+for i = 1, N do
+    points[i] = { i, i * 0.5, -i }
+end
+
+time("tables", function()
+    local out = {}
+    for i = 1, N do
+        local p = points[i]
+        local x, y, z = p[1], p[2], p[3]
+        out[i] = {
+            Mt[1] * x + Mt[5] * y + Mt[9] * z + Mt[13],
+            Mt[2] * x + Mt[6] * y + Mt[10] * z + Mt[14],
+            Mt[3] * x + Mt[7] * y + Mt[11] * z + Mt[15],
+        }
+    end
+end)
+
+local vecs = {}
+for i = 1, N do
+    vecs[i] = m.vec3(i, i * 0.5, -i)
+end
+
+time("vec3 userdata", function()
+    local out = {}
+    for i = 1, N do
+        out[i] = M * vecs[i]
+    end
+end)
+
+local src = m.vec3array(N)
+local dst = m.vec3array(N)
+for i = 1, N do
+    src:set(i, i, i * 0.5, -i)
+end
+
+time("vec3array:transformPoints", function()
+    M:transformPoints(src, dst)
+end)
+
+time("vec3array:within", function()
+    dst:within(m.vec3(0, 0, 0), 1000)
+end)
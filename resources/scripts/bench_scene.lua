@@ -0,0 +1,22 @@
+-- A fixed scenario for headless runs:
+--   ldoom --headless --fixed-dt 0.016666 --script scripts/bench_scene.lua --report bench.json
+-- Draws a grid of quads for 600 frames, then quits.
+
+local FRAMES = 600
+local frame = 0
+local draw = levent.draw
+
+function levent.draw()
+    if draw then draw() end
+    local t = frame / 60
+    for i = 0, 31 do
+        for j = 0, 17 do
+            local s = 10 + 8 * math.sin(t + i * 0.3 + j * 0.2)
+            ldoom.quickdraw.rect('fill', i * 40, j * 40, s, s)
+        end
+    end
+    frame = frame + 1
+    if frame >= FRAMES then
+        ldoom.quit()
+    end
+end
@@ -0,0 +1,44 @@
+-- Measures loading a large script set with and without the bytecode cache.
+-- Generates 50 scripts of 1000 lines each, then loads them three times: with
+-- loadfile, with ldoom.loadScript on an empty cache, and again once cached.
+
+local FILES = 50
+local LINES = 1000
+local log = ldoom.console and ldoom.console.log or print
+
+-- The stamp keeps earlier runs from warming the cache.
+local stamp = tostring(os.time()) .. tostring(os.clock())
+local base = os.tmpname()
+local paths = {}
+
+for f = 1, FILES do
+    local lines = { "-- " .. stamp, "local M = {}" }
+    for i = 1, LINES - 3 do
+        lines[#lines + 1] = string.format(
+            "function M.f%d(a, b) local t = { a, b, %d } return t[1] * t[2] + #t end", i, i)
+    end
+    lines[#lines + 1] = "return M"
+    local path = string.format("%s_%d.lua", base, f)
+    local out = assert(io.open(path, "w"))
+    out:write(table.concat(lines, "\n"))
+    out:close()
+    paths[f] = path
+end
+
+local function time(name, load)
+    local start = os.clock()
+    for _, path in ipairs(paths) do
+        assert(load(path))
+    end
+    log(string.format("%-16s %8.2f ms", name, (os.clock() - start) * 1000))
+end
+
+time("loadfile", loadfile)
+time("cache miss", ldoom.loadScript)
+time("cache hit", ldoom.loadScript)
+
+for _, path in ipairs(paths) do
+    ldoom.dropScriptCache(path)
+    os.remove(path)
+end
+os.remove(base)
@@ -11,6 +11,8 @@ end
 function levent.keyboard(key, action)
     if key == "escape" then
         ldoom.quit()
+    elseif key == "f3" and action == "down" then
+        ldoom.frametime.glOverlay(not ldoom.frametime.glOverlay())
     end
     ldoom.console.logc(action)
 end
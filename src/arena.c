@@ -0,0 +1,200 @@
+#include "arena.h"
+#include "memtrack.h"
+#include "util.h"
+#include <pthread.h>
+
+// Blocks are at least this big. A larger request gets a block of its own,
+// which is given back at the end of the frame, or of the job on a worker.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock * next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+#define ARENA_BLOCK_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+#define BLOCK_DATA(b) ((char *) (b) + ARENA_BLOCK_HEADER)
+
+typedef struct Arena {
+    struct Arena * next;
+    // Blocks past current are kept for reuse after a reset.
+    ArenaBlock * first;
+    ArenaBlock * current; // NULL until the first allocation after a frame
+    size_t used;
+    size_t high; // Since the last arena_frame
+    // Read by arena_stats from other threads.
+    size_t frame;
+    size_t peak;
+    size_t reserved;
+} Arena;
+
+static __thread Arena * arena_local;
+
+static struct {
+    pthread_mutex_t lock;
+    Arena * arenas;
+    Arena * main; // The thread that calls arena_frame
+} arena_globals = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static Arena * arena_get() {
+    if (!arena_local) {
+        Arena * a = tcalloc(MEM_TAG_SCRATCH, 1, sizeof(Arena));
+        if (!a)
+            uerr("Could not allocate a scratch arena.");
+        pthread_mutex_lock(&arena_globals.lock);
+        a->next = arena_globals.arenas;
+        arena_globals.arenas = a;
+        pthread_mutex_unlock(&arena_globals.lock);
+        arena_local = a;
+    }
+    return arena_local;
+}
+
+// Moves to the block after the current one, or inserts a new one there if
+// it is too small.
+static ArenaBlock * arena_next_block(Arena * a, size_t size) {
+    ArenaBlock ** link = a->current ? &a->current->next : &a->first;
+    ArenaBlock * b = *link;
+    if (!b || b->size < size) {
+        size_t bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = tmalloc(MEM_TAG_SCRATCH, ARENA_BLOCK_HEADER + bsize);
+        if (!b)
+            uerr("Could not grow the scratch arena.");
+        b->size = bsize;
+        b->next = *link;
+        *link = b;
+        __atomic_add_fetch(&a->reserved, ARENA_BLOCK_HEADER + bsize, __ATOMIC_RELAXED);
+    }
+    b->used = 0;
+    a->current = b;
+    return b;
+}
+
+void * arena_alloc(size_t size) {
+    Arena * a = arena_get();
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    ArenaBlock * b = a->current;
+    if (!b || b->size - b->used < size)
+        b = arena_next_block(a, size);
+    void * ptr = BLOCK_DATA(b) + b->used;
+    b->used += size;
+    a->used += size;
+    if (a->used > a->high) {
+        a->high = a->used;
+        if (a->high > a->peak)
+            __atomic_store_n(&a->peak, a->high, __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+char * arena_strdup(const char * str) {
+    size_t len = strlen(str) + 1;
+    return memcpy(arena_alloc(len), str, len);
+}
+
+char * arena_vprintf(const char * format, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (len < 0)
+        return NULL;
+    char * out = arena_alloc(len + 1);
+    vsnprintf(out, len + 1, format, args);
+    return out;
+}
+
+char * arena_printf(const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    char * out = arena_vprintf(format, args);
+    va_end(args);
+    return out;
+}
+
+ArenaMark arena_mark() {
+    Arena * a = arena_get();
+    ArenaMark mark = {a->current, a->current ? a->current->used : 0, a->used};
+    return mark;
+}
+
+void arena_reset(ArenaMark mark) {
+    Arena * a = arena_get();
+    a->current = mark.block;
+    if (a->current)
+        a->current->used = mark.offset;
+    a->used = mark.used;
+}
+
+// Frees the oversized blocks past the current one, which nothing is using.
+static void arena_free_oversized(Arena * a) {
+    ArenaBlock ** link = a->current ? &a->current->next : &a->first;
+    while (*link) {
+        ArenaBlock * b = *link;
+        if (b->size > ARENA_BLOCK_SIZE) {
+            *link = b->next;
+            __atomic_sub_fetch(&a->reserved, ARENA_BLOCK_HEADER + b->size, __ATOMIC_RELAXED);
+            tfree(b);
+        } else {
+            link = &b->next;
+        }
+    }
+}
+
+void arena_trim() {
+    if (arena_local)
+        arena_free_oversized(arena_local);
+}
+
+void arena_frame() {
+    Arena * a = arena_get();
+    if (arena_globals.main != a) {
+        pthread_mutex_lock(&arena_globals.lock);
+        arena_globals.main = a;
+        pthread_mutex_unlock(&arena_globals.lock);
+    }
+    __atomic_store_n(&a->frame, a->high, __ATOMIC_RELAXED);
+    a->current = NULL;
+    a->used = 0;
+    a->high = 0;
+    arena_free_oversized(a);
+}
+
+void arena_stats(ArenaStats * stats) {
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&arena_globals.lock);
+    for (Arena * a = arena_globals.arenas; a; a = a->next) {
+        size_t peak = __atomic_load_n(&a->peak, __ATOMIC_RELAXED);
+        if (peak > stats->peak)
+            stats->peak = peak;
+        stats->reserved += __atomic_load_n(&a->reserved, __ATOMIC_RELAXED);
+        stats->threads++;
+    }
+    if (arena_globals.main)
+        stats->frame = __atomic_load_n(&arena_globals.main->frame, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&arena_globals.lock);
+}
+
+void arena_deinit() {
+    pthread_mutex_lock(&arena_globals.lock);
+    Arena * a = arena_globals.arenas;
+    while (a) {
+        Arena * next = a->next;
+        ArenaBlock * b = a->first;
+        while (b) {
+            ArenaBlock * bnext = b->next;
+            tfree(b);
+            b = bnext;
+        }
+        tfree(a);
+        a = next;
+    }
+    arena_globals.arenas = NULL;
+    arena_globals.main = NULL;
+    pthread_mutex_unlock(&arena_globals.lock);
+    arena_local = NULL;
+}
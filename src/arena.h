@@ -0,0 +1,60 @@
+#ifndef ARENA_H_T8VN3KXD
+#define ARENA_H_T8VN3KXD
+
+#include <stddef.h>
+#include <stdarg.h>
+
+// Per thread scratch memory. Each thread bumps a pointer through a chain of
+// blocks, so any number of temporary allocations can be live at once and
+// none of them is freed on its own. Instead, arena_mark and arena_reset
+// bracket a scope and drop everything allocated inside it, and arena_frame
+// drops everything on the main thread at the end of every frame. Jobs get a
+// scope around each run, so scratch memory never outlives the job.
+//
+// Pointers from the arena are valid until the enclosing scope or frame ends;
+// copy anything that has to live longer.
+
+typedef struct {
+    void * block;
+    size_t offset;
+    size_t used;
+} ArenaMark;
+
+typedef struct {
+    size_t frame;    // Main thread high water in the last complete frame
+    size_t peak;     // Highest high water of any thread
+    size_t reserved; // Bytes held in blocks by every thread
+    unsigned threads;
+} ArenaStats;
+
+// Returns size bytes aligned for any type. Never returns NULL.
+void * arena_alloc(size_t size);
+
+char * arena_strdup(const char * str);
+
+// Formats into the arena. Returns NULL if the format can't be expanded.
+char * arena_printf(const char * format, ...);
+char * arena_vprintf(const char * format, va_list args);
+
+ArenaMark arena_mark();
+
+// Frees everything allocated since the mark was taken. Marks must be reset
+// in reverse order, on the thread that took them.
+void arena_reset(ArenaMark mark);
+
+// Ends the frame for the calling thread: records its high water and frees
+// everything in its arena. Call once per frame on the main thread.
+void arena_frame();
+
+// Frees the calling thread's blocks that were made for oversized requests
+// and aren't in use. Threads that never call arena_frame, like job workers,
+// call this once they're done with their scratch memory.
+void arena_trim();
+
+// Safe to call from any thread.
+void arena_stats(ArenaStats * stats);
+
+// Frees every thread's arena. Call after the other threads have stopped.
+void arena_deinit();
+
+#endif /* end of include guard: ARENA_H_T8VN3KXD */
@@ -3,6 +3,10 @@
 #include "util.h"
 #include "platform.h"
 #include "lua_interop.h"
+#include "jobs.h"
+#include "pcmcache.h"
+#include "memtrack.h"
+#include <string.h>
 
 const char * GetOpenALErrorString(int errID) {
 	if (errID == AL_NO_ERROR) return "";
@@ -30,70 +34,305 @@ void CheckOpenALError() {
     #define AL_CHECK(stmt) stmt
 #endif
 
+typedef struct {
+    Sound ** sounds;
+    unsigned count;
+    unsigned capacity;
+} SoundList;
+
+typedef struct {
+    Sound * sound;
+    float score;
+} VoiceCandidate;
+
 static struct {
     ALCdevice * device;
     ALCcontext * context;
+    SoundList streams;
+    SoundList loading;
+    SoundList active;
+    ALuint voices[AUDIO_MAX_VOICES];
+    Sound * voice_owners[AUDIO_MAX_VOICES];
+    unsigned voice_count;
+    VoiceCandidate * candidates;
+    unsigned candidate_capacity;
+    vec3 listener;
+#ifdef ALC_SOFT_loopback
+    LPALCRENDERSAMPLESSOFT render; // Set for loopback devices
+#endif
 } audio_globals;
 
-SoundData * audio_data_init(SoundData * data, const char * resource) {
+static void sound_list_add(SoundList * list, Sound * sound) {
+    if (list->count >= list->capacity) {
+        list->capacity = 2 * list->capacity + 4;
+        list->sounds = trealloc(MEM_TAG_AUDIO, list->sounds, list->capacity * sizeof(Sound *));
+    }
+    list->sounds[list->count++] = sound;
+}
+
+static void sound_list_remove(SoundList * list, Sound * sound) {
+    for (unsigned i = 0; i < list->count; i++) {
+        if (list->sounds[i] == sound) {
+            list->sounds[i] = list->sounds[--list->count];
+            return;
+        }
+    }
+}
+
+static void sound_list_free(SoundList * list) {
+    tfree(list->sounds);
+    list->sounds = NULL;
+    list->count = list->capacity = 0;
+}
 
-    int channels;
-	int sample_rate;
-	short * s_data;
-	int samples = stb_vorbis_decode_filename(platform_res2file_ez(resource), &channels, &sample_rate, &s_data);
+static void audio_data_upload(SoundData * data, short * pcm, int samples, int channels, int sample_rate) {
     ALuint buffer;
     alGenBuffers(1, &buffer);
 	ALenum format = channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
-    alBufferData(buffer, format, s_data, samples * channels * sizeof(short), sample_rate);
-    free(s_data);
-
+    alBufferData(buffer, format, pcm, samples * channels * sizeof(short), sample_rate);
     data->samples = samples;
     data->buffer = buffer;
     data->channels = channels;
     data->sample_rate = sample_rate;
+}
+
+SoundData * audio_data_init(SoundData * data, const char * resource) {
+
+    PcmData pcm;
+    if (!pcm_load(platform_res2file_ez(resource), &pcm)) {
+        uerr("Could not decode ogg file.");
+    }
+    pcm_log_load(resource, &pcm);
+    audio_data_upload(data, pcm.pcm, pcm.samples, pcm.channels, pcm.sample_rate);
+    pcm_free(&pcm);
+
     data->resource = resource;
+    data->loading = 0;
+    data->job = NULL;
+
+    return data;
+}
+
+// Decoding happens on a worker thread, which only ever touches the job. The
+// SoundData is filled in from the completion callback on the main thread, or
+// not at all if it was deinitialized in the meantime.
+typedef struct AudioDecodeJob {
+    SoundData * data;
+    char * path;
+    PcmData pcm;
+    int ok;
+} AudioDecodeJob;
+
+static void audio_decode_work(void * user) {
+    AudioDecodeJob * job = user;
+    job->ok = pcm_load(job->path, &job->pcm);
+}
+
+static void audio_decode_done(void * user) {
+    AudioDecodeJob * job = user;
+    SoundData * data = job->data;
+    if (data) {
+        if (!job->ok) {
+            uerr("Could not decode ogg file.");
+        }
+        PcmData * pcm = &job->pcm;
+        pcm_log_load(data->resource, pcm);
+        audio_data_upload(data, pcm->pcm, pcm->samples, pcm->channels, pcm->sample_rate);
+        data->loading = 0;
+        data->job = NULL;
+    }
+    if (job->ok)
+        pcm_free(&job->pcm);
+    tfree(job->path);
+    tfree(job);
+}
 
+SoundData * audio_data_init_async(SoundData * data, const char * resource) {
+    const char * path = platform_res2file_ez(resource);
+    AudioDecodeJob * job = tmalloc(MEM_TAG_AUDIO, sizeof(AudioDecodeJob));
+    job->data = data;
+    job->path = tstrdup(MEM_TAG_AUDIO, path);
+    job->ok = 0;
+    data->buffer = 0;
+    data->samples = 0;
+    data->channels = 0;
+    data->sample_rate = 0;
+    data->resource = resource;
+    data->loading = 1;
+    data->job = job;
+    jobs_submit(audio_decode_work, audio_decode_done, job);
     return data;
 }
 
 void audio_data_deinit(SoundData * data) {
+    if (data->loading) {
+        // Let the job finish and throw away the result.
+        data->job->data = NULL;
+        return;
+    }
     alDeleteBuffers(1, &data->buffer);
 }
 
+// CACHE
+
+#define AUDIO_CACHE_BUCKETS 256
+
+typedef struct AudioCacheEntry {
+    SoundData data;
+    struct AudioCacheEntry * next;
+    char * resource;
+    unsigned refcount;
+    unsigned long lastuse;
+} AudioCacheEntry;
+
+static struct {
+    AudioCacheEntry * buckets[AUDIO_CACHE_BUCKETS];
+    unsigned long clock;
+    AudioCacheStats stats;
+} audio_cache;
+
+static unsigned audio_cache_hash(const char * str) {
+    unsigned h = 5381;
+    while (*str)
+        h = 33 * h + (unsigned char) *str++;
+    return h & (AUDIO_CACHE_BUCKETS - 1);
+}
+
+static size_t audio_cache_entry_bytes(const AudioCacheEntry * e) {
+    return (size_t) e->data.samples * e->data.channels * sizeof(short);
+}
+
+static void audio_cache_free_entry(AudioCacheEntry * e) {
+    audio_data_deinit(&e->data);
+    tfree(e->resource);
+    tfree(e);
+}
+
+// Frees the least recently released unreferenced entries until the cache fits
+// in its budget. Entries that are still referenced are never evicted.
+static void audio_cache_evict() {
+    size_t bytes = 0;
+    for (unsigned i = 0; i < AUDIO_CACHE_BUCKETS; i++)
+        for (AudioCacheEntry * e = audio_cache.buckets[i]; e; e = e->next)
+            bytes += audio_cache_entry_bytes(e);
+    while (bytes > audio_cache.stats.budget) {
+        AudioCacheEntry ** lru = NULL;
+        for (unsigned i = 0; i < AUDIO_CACHE_BUCKETS; i++) {
+            for (AudioCacheEntry ** e = audio_cache.buckets + i; *e; e = &(*e)->next) {
+                if (!(*e)->refcount && (!lru || (*e)->lastuse < (*lru)->lastuse))
+                    lru = e;
+            }
+        }
+        if (!lru)
+            break;
+        AudioCacheEntry * victim = *lru;
+        *lru = victim->next;
+        bytes -= audio_cache_entry_bytes(victim);
+        audio_cache.stats.evictions++;
+        audio_cache.stats.entries--;
+        audio_cache_free_entry(victim);
+    }
+}
+
+SoundData * audio_data_acquire(const char * resource, int async) {
+    unsigned h = audio_cache_hash(resource);
+    for (AudioCacheEntry * e = audio_cache.buckets[h]; e; e = e->next) {
+        if (strcmp(e->resource, resource) == 0) {
+            e->refcount++;
+            audio_cache.stats.hits++;
+            return &e->data;
+        }
+    }
+    audio_cache.stats.misses++;
+    AudioCacheEntry * e = tmalloc(MEM_TAG_AUDIO, sizeof(AudioCacheEntry));
+    e->resource = tstrdup(MEM_TAG_AUDIO, resource);
+    e->refcount = 1;
+    e->lastuse = 0;
+    if (async)
+        audio_data_init_async(&e->data, e->resource);
+    else
+        audio_data_init(&e->data, e->resource);
+    e->next = audio_cache.buckets[h];
+    audio_cache.buckets[h] = e;
+    audio_cache.stats.entries++;
+    return &e->data;
+}
+
+void audio_data_release(SoundData * data) {
+    AudioCacheEntry * e = (AudioCacheEntry *) data;
+    uassert(e->refcount > 0);
+    if (--e->refcount == 0) {
+        e->lastuse = ++audio_cache.clock;
+        audio_cache_evict();
+    }
+}
+
+void audio_cache_set_budget(size_t bytes) {
+    audio_cache.stats.budget = bytes;
+    audio_cache_evict();
+}
+
+void audio_cache_stats(AudioCacheStats * stats) {
+    *stats = audio_cache.stats;
+    stats->bytes = 0;
+    for (unsigned i = 0; i < AUDIO_CACHE_BUCKETS; i++)
+        for (AudioCacheEntry * e = audio_cache.buckets[i]; e; e = e->next)
+            stats->bytes += audio_cache_entry_bytes(e);
+}
+
 Sound * audio_sound_init(Sound * sound, SoundData * data) {
     static const vec3 zero = {0, 0, 0};
     vec3_assign(sound->position, zero);
     sound->data = data;
+    sound->stream = NULL;
+    sound->onload = NULL;
+    sound->onload_user = NULL;
     sound->flags = AUDIO_ACTIVE;
+    sound->source = 0;
+    sound->voice = -1;
+    sound->cursor = 0;
+    sound->priority = 1;
     sound->volume = 1;
     sound->pitch = 1;
     sound->gain = 1;
-    alGenSources(1, &sound->source);
-    AL_CHECK(alSourceQueueBuffers(sound->source, 1, &data->buffer));
-    audio_sound_update(sound);
+    if (data->loading) {
+        sound->flags |= AUDIO_LOADING;
+        sound_list_add(&audio_globals.loading, sound);
+    }
     return sound;
 }
 
 Sound * audio_sound_init_resource(Sound * sound, const char * resource) {
-    SoundData * data = malloc(sizeof(SoundData));
-    audio_data_init(data, resource);
-    audio_sound_init(sound, data);
-    sound->flags |= AUDIO_OWNS_DATA;
+    audio_sound_init(sound, audio_data_acquire(resource, 0));
+    sound->flags |= AUDIO_CACHED_DATA;
     return sound;
 }
 
-void audio_sound_deinit(Sound * sound) {
-    if (sound->flags & AUDIO_ACTIVE) {
-        sound->flags &= ~AUDIO_ACTIVE;
-        alDeleteSources(1, &sound->source);
-        if (sound->flags & AUDIO_OWNS_DATA) {
-            audio_data_deinit(sound->data);
-            free(sound->data);
-        }
-    }
+Sound * audio_sound_init_resource_async(Sound * sound, const char * resource,
+        AudioLoadCallback onload, void * user) {
+    audio_sound_init(sound, audio_data_acquire(resource, 1));
+    sound->flags |= AUDIO_CACHED_DATA;
+    sound->onload = onload;
+    sound->onload_user = user;
+    return sound;
 }
 
-void audio_sound_update(Sound * sound) {
+// Starts a sound whose data has finished loading if it was played in the
+// meantime.
+static void audio_sound_finish_loading(Sound * sound) {
+    sound->flags &= ~AUDIO_LOADING;
+    if (sound->flags & AUDIO_LOOP_ON_LOAD)
+        audio_sound_loop(sound);
+    else if (sound->flags & AUDIO_PLAY_ON_LOAD)
+        audio_sound_play(sound);
+    sound->flags &= ~(AUDIO_PLAY_ON_LOAD | AUDIO_LOOP_ON_LOAD);
+    if (sound->onload)
+        sound->onload(sound, sound->onload_user);
+}
+
+// VOICES
+
+static void audio_voice_apply(Sound * sound) {
     alSourcef(sound->source, AL_PITCH, sound->pitch);
     alSourcef(sound->source, AL_GAIN, sound->gain);
     alSource3f(sound->source, AL_POSITION,
@@ -102,34 +341,404 @@ void audio_sound_update(Sound * sound) {
             sound->position[2]);
 }
 
-void audio_sound_play(Sound * sound) {
-    alSourcei(sound->source, AL_LOOPING, AL_FALSE);
+// Gives a playing sound a real source and resumes it from its cursor.
+static int audio_voice_acquire(Sound * sound) {
+    int v = -1;
+    for (unsigned i = 0; i < audio_globals.voice_count; i++) {
+        if (!audio_globals.voice_owners[i]) {
+            v = i;
+            break;
+        }
+    }
+    if (v < 0)
+        return 0;
+    audio_globals.voice_owners[v] = sound;
+    sound->voice = v;
+    sound->source = audio_globals.voices[v];
+    alSourcei(sound->source, AL_BUFFER, sound->data->buffer);
+    alSourcei(sound->source, AL_LOOPING, (sound->flags & AUDIO_LOOPING) ? AL_TRUE : AL_FALSE);
+    audio_voice_apply(sound);
     alSourcePlay(sound->source);
+    if (sound->cursor > 0)
+        alSourcef(sound->source, AL_SEC_OFFSET, sound->cursor);
+    return 1;
+}
+
+// Takes the real source away from a sound, remembering where it was.
+static void audio_voice_release(Sound * sound) {
+    alGetSourcef(sound->source, AL_SEC_OFFSET, &sound->cursor);
+    alSourceStop(sound->source);
+    alSourcei(sound->source, AL_BUFFER, 0);
+    audio_globals.voice_owners[sound->voice] = NULL;
+    sound->voice = -1;
+    sound->source = 0;
+}
+
+static void audio_voice_start(Sound * sound, int looping) {
+    sound->cursor = 0;
+    if (looping)
+        sound->flags |= AUDIO_LOOPING;
+    else
+        sound->flags &= ~AUDIO_LOOPING;
+    if (sound->voice >= 0) {
+        alSourcei(sound->source, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
+        alSourcePlay(sound->source);
+        return;
+    }
+    if (!(sound->flags & AUDIO_PLAYING))
+        sound_list_add(&audio_globals.active, sound);
+    sound->flags |= AUDIO_PLAYING;
+    audio_voice_acquire(sound);
+}
+
+static void audio_voice_stop(Sound * sound) {
+    if (sound->voice >= 0)
+        audio_voice_release(sound);
+    if (sound->flags & AUDIO_PLAYING)
+        sound_list_remove(&audio_globals.active, sound);
+    sound->flags &= ~AUDIO_PLAYING;
+    sound->cursor = 0;
+}
+
+// How much a voice matters, using the same inverse distance clamped model
+// OpenAL uses by default (reference distance and rolloff of 1).
+static float audio_voice_score(const Sound * sound) {
+    vec3 delta;
+    vec3_sub(delta, sound->position, audio_globals.listener);
+    float d = vec3_len(delta);
+    float attenuation = d > 1 ? 1 / d : 1;
+    float score = sound->priority * sound->gain * attenuation;
+    // Favor voices that are already real so near ties don't thrash sources.
+    return sound->voice >= 0 ? score * 1.1f : score;
+}
+
+static int audio_voice_compare(const void * a, const void * b) {
+    float sa = ((const VoiceCandidate *) a)->score;
+    float sb = ((const VoiceCandidate *) b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+static void audio_voices_update(double dt) {
+    SoundList * active = &audio_globals.active;
+    // Retire sounds that finished, and advance the virtual ones.
+    for (unsigned i = 0; i < active->count;) {
+        Sound * sound = active->sounds[i];
+        int finished = 0;
+        if (sound->voice >= 0) {
+            ALint state;
+            alGetSourcei(sound->source, AL_SOURCE_STATE, &state);
+            finished = state == AL_STOPPED;
+        } else {
+            float duration = (float) sound->data->samples / sound->data->sample_rate;
+            sound->cursor += dt * sound->pitch;
+            if (sound->cursor >= duration) {
+                if ((sound->flags & AUDIO_LOOPING) && duration > 0)
+                    sound->cursor = fmodf(sound->cursor, duration);
+                else
+                    finished = 1;
+            }
+        }
+        if (finished) {
+            if (sound->voice >= 0)
+                audio_voice_release(sound);
+            sound->flags &= ~AUDIO_PLAYING;
+            sound->cursor = 0;
+            active->sounds[i] = active->sounds[--active->count];
+        } else {
+            i++;
+        }
+    }
+    if (active->count <= audio_globals.voice_count) {
+        for (unsigned i = 0; i < active->count; i++)
+            if (active->sounds[i]->voice < 0)
+                audio_voice_acquire(active->sounds[i]);
+        return;
+    }
+    // More sounds than sources, so the loudest ones get them.
+    if (active->count > audio_globals.candidate_capacity) {
+        audio_globals.candidate_capacity = 2 * active->count;
+        audio_globals.candidates = trealloc(MEM_TAG_AUDIO, audio_globals.candidates,
+                audio_globals.candidate_capacity * sizeof(VoiceCandidate));
+    }
+    VoiceCandidate * candidates = audio_globals.candidates;
+    for (unsigned i = 0; i < active->count; i++) {
+        candidates[i].sound = active->sounds[i];
+        candidates[i].score = audio_voice_score(active->sounds[i]);
+    }
+    qsort(candidates, active->count, sizeof(VoiceCandidate), audio_voice_compare);
+    for (unsigned i = audio_globals.voice_count; i < active->count; i++)
+        if (candidates[i].sound->voice >= 0)
+            audio_voice_release(candidates[i].sound);
+    for (unsigned i = 0; i < audio_globals.voice_count; i++)
+        if (candidates[i].sound->voice < 0)
+            audio_voice_acquire(candidates[i].sound);
+}
+
+void audio_set_listener(const vec3 position, const vec3 forward, const vec3 up) {
+    ALfloat orientation[6] = {
+        forward[0], forward[1], forward[2],
+        up[0], up[1], up[2]
+    };
+    vec3_assign(audio_globals.listener, position);
+    alListener3f(AL_POSITION, position[0], position[1], position[2]);
+    alListenerfv(AL_ORIENTATION, orientation);
+}
+
+void audio_voice_stats(AudioVoiceStats * stats) {
+    stats->voices = audio_globals.voice_count;
+    stats->real = 0;
+    for (unsigned i = 0; i < audio_globals.voice_count; i++)
+        if (audio_globals.voice_owners[i])
+            stats->real++;
+    stats->virtual = audio_globals.active.count - stats->real;
+}
+
+// STREAMING
+
+// Decodes the next block of the stream into an AL buffer. Looping streams wrap
+// around to the start of the file. Returns 0 if there was nothing left to decode.
+static int audio_stream_fill(Sound * sound, ALuint buffer) {
+    SoundStream * stream = sound->stream;
+    int channels = stream->channels;
+    int frames = 0;
+    int rewound = 0;
+    while (frames < AUDIO_STREAM_BUFFER_SAMPLES && !stream->eof) {
+        int n = stb_vorbis_get_samples_short_interleaved(stream->vorbis, channels,
+                stream->pcm + frames * channels,
+                (AUDIO_STREAM_BUFFER_SAMPLES - frames) * channels);
+        if (n > 0) {
+            frames += n;
+            rewound = 0;
+        } else if ((sound->flags & AUDIO_LOOPING) && !rewound) {
+            stb_vorbis_seek_start(stream->vorbis);
+            rewound = 1;
+        } else {
+            stream->eof = 1;
+        }
+    }
+    if (!frames)
+        return 0;
+    AL_CHECK(alBufferData(buffer, stream->format, stream->pcm,
+                frames * channels * sizeof(short), stream->sample_rate));
+    return 1;
+}
+
+// Throws away whatever is queued on the source, refills the queue from the
+// decoder's current position and starts playing.
+static void audio_stream_start(Sound * sound) {
+    SoundStream * stream = sound->stream;
+    alSourceStop(sound->source);
+    alSourcei(sound->source, AL_BUFFER, 0);
+    stream->eof = 0;
+    int count = 0;
+    while (count < AUDIO_STREAM_BUFFERS && audio_stream_fill(sound, stream->buffers[count]))
+        count++;
+    if (!count) {
+        sound->flags &= ~AUDIO_PLAYING;
+        return;
+    }
+    AL_CHECK(alSourceQueueBuffers(sound->source, count, stream->buffers));
+    alSourcePlay(sound->source);
+    sound->flags |= AUDIO_PLAYING;
+}
+
+static void audio_stream_update(Sound * sound) {
+    ALint processed, queued, state;
+    alGetSourcei(sound->source, AL_BUFFERS_PROCESSED, &processed);
+    while (processed-- > 0) {
+        ALuint buffer;
+        alSourceUnqueueBuffers(sound->source, 1, &buffer);
+        if (audio_stream_fill(sound, buffer)) {
+            AL_CHECK(alSourceQueueBuffers(sound->source, 1, &buffer));
+        }
+    }
+    alGetSourcei(sound->source, AL_BUFFERS_QUEUED, &queued);
+    alGetSourcei(sound->source, AL_SOURCE_STATE, &state);
+    if (!queued) {
+        sound->flags &= ~AUDIO_PLAYING;
+    } else if (state != AL_PLAYING) {
+        // The source ran dry before we refilled it, so it stopped by itself.
+        alSourcePlay(sound->source);
+    }
+}
+
+Sound * audio_sound_init_stream(Sound * sound, const char * resource) {
+    static const vec3 zero = {0, 0, 0};
+    int error;
+    stb_vorbis * vorbis = stb_vorbis_open_filename(platform_res2file_ez(resource), &error, NULL);
+    if (!vorbis) {
+        uerr("Could not open ogg stream.");
+    }
+    stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+    SoundStream * stream = tmalloc(MEM_TAG_AUDIO, sizeof(SoundStream));
+    stream->vorbis = vorbis;
+    stream->channels = info.channels > 1 ? 2 : 1;
+    stream->sample_rate = info.sample_rate;
+    stream->format = stream->channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+    stream->samples = stb_vorbis_stream_length_in_samples(vorbis);
+    stream->pcm = tmalloc(MEM_TAG_AUDIO, AUDIO_STREAM_BUFFER_SAMPLES * stream->channels * sizeof(short));
+    stream->eof = 0;
+    alGenBuffers(AUDIO_STREAM_BUFFERS, stream->buffers);
+
+    vec3_assign(sound->position, zero);
+    sound->data = NULL;
+    sound->stream = stream;
+    sound->onload = NULL;
+    sound->onload_user = NULL;
+    sound->voice = -1;
+    sound->cursor = 0;
+    sound->priority = 1;
+    sound->flags = AUDIO_ACTIVE | AUDIO_STREAMING;
+    sound->volume = 1;
+    sound->pitch = 1;
+    sound->gain = 1;
+    alGenSources(1, &sound->source);
+    audio_sound_update(sound);
+    sound_list_add(&audio_globals.streams, sound);
+    return sound;
+}
+
+void audio_update(double dt) {
+    for (unsigned i = 0; i < audio_globals.streams.count; i++) {
+        Sound * sound = audio_globals.streams.sounds[i];
+        if (sound->flags & AUDIO_PLAYING)
+            audio_stream_update(sound);
+    }
+    SoundList * loading = &audio_globals.loading;
+    for (unsigned i = 0; i < loading->count;) {
+        Sound * sound = loading->sounds[i];
+        if (sound->data->loading) {
+            i++;
+            continue;
+        }
+        // Remove the sound first, as the callback may add or remove sounds.
+        loading->sounds[i] = loading->sounds[--loading->count];
+        audio_sound_finish_loading(sound);
+    }
+    audio_voices_update(dt);
+}
+
+void audio_sound_deinit(Sound * sound) {
+    if (sound->flags & AUDIO_ACTIVE) {
+        if (sound->flags & AUDIO_STREAMING)
+            alDeleteSources(1, &sound->source);
+        else
+            audio_voice_stop(sound);
+        sound->flags &= ~AUDIO_ACTIVE;
+        if (sound->flags & AUDIO_LOADING)
+            sound_list_remove(&audio_globals.loading, sound);
+        if (sound->flags & AUDIO_STREAMING) {
+            SoundStream * stream = sound->stream;
+            sound_list_remove(&audio_globals.streams, sound);
+            alDeleteBuffers(AUDIO_STREAM_BUFFERS, stream->buffers);
+            stb_vorbis_close(stream->vorbis);
+            tfree(stream->pcm);
+            tfree(stream);
+        }
+        if (sound->flags & AUDIO_CACHED_DATA) {
+            audio_data_release(sound->data);
+        }
+    }
+}
+
+void audio_sound_update(Sound * sound) {
+    // Virtual sounds pick up their properties when they get a source.
+    if (sound->source)
+        audio_voice_apply(sound);
+}
+
+void audio_sound_play(Sound * sound) {
+    if (sound->flags & AUDIO_LOADING) {
+        sound->flags = (sound->flags & ~AUDIO_LOOP_ON_LOAD) | AUDIO_PLAY_ON_LOAD;
+        return;
+    }
+    if (sound->flags & AUDIO_STREAMING) {
+        sound->flags &= ~AUDIO_LOOPING;
+        stb_vorbis_seek_start(sound->stream->vorbis);
+        audio_stream_start(sound);
+        return;
+    }
+    audio_voice_start(sound, 0);
 }
 
 void audio_sound_persist(Sound * sound) {
-    ALint source_state;
-    AL_CHECK(alGetSourcei(sound->source, AL_SOURCE_STATE, &source_state));
-    if (source_state == AL_STOPPED || source_state == AL_INITIAL) {
-        audio_sound_play(sound);
+    if (sound->flags & AUDIO_LOADING) {
+        if (!(sound->flags & AUDIO_LOOP_ON_LOAD))
+            sound->flags |= AUDIO_PLAY_ON_LOAD;
+        return;
     }
+    if (!(sound->flags & AUDIO_PLAYING))
+        audio_sound_play(sound);
 }
 
 void audio_sound_stop(Sound * sound) {
-    alSourceStop(sound->source);
+    sound->flags &= ~(AUDIO_PLAY_ON_LOAD | AUDIO_LOOP_ON_LOAD);
+    if (sound->flags & AUDIO_STREAMING) {
+        sound->flags &= ~AUDIO_PLAYING;
+        alSourceStop(sound->source);
+        return;
+    }
+    audio_voice_stop(sound);
 }
 
 void audio_sound_stop_looping(Sound * sound) {
-    alSourcei(sound->source, AL_LOOPING, AL_FALSE);
+    if (sound->flags & AUDIO_LOOP_ON_LOAD) {
+        sound->flags = (sound->flags & ~AUDIO_LOOP_ON_LOAD) | AUDIO_PLAY_ON_LOAD;
+        return;
+    }
+    sound->flags &= ~AUDIO_LOOPING;
+    if (sound->voice >= 0)
+        alSourcei(sound->source, AL_LOOPING, AL_FALSE);
 }
 
 void audio_sound_loop(Sound * sound) {
-    alSourcei(sound->source, AL_LOOPING, AL_TRUE);
-    alSourcePlay(sound->source);
+    if (sound->flags & AUDIO_LOADING) {
+        sound->flags = (sound->flags & ~AUDIO_PLAY_ON_LOAD) | AUDIO_LOOP_ON_LOAD;
+        return;
+    }
+    if (sound->flags & AUDIO_STREAMING) {
+        sound->flags |= AUDIO_LOOPING;
+        stb_vorbis_seek_start(sound->stream->vorbis);
+        audio_stream_start(sound);
+        return;
+    }
+    audio_voice_start(sound, 1);
+}
+
+void audio_sound_seek(Sound * sound, unsigned sample) {
+    if (sound->flags & AUDIO_LOADING)
+        return;
+    if (sound->flags & AUDIO_STREAMING) {
+        SoundStream * stream = sound->stream;
+        if (sample >= stream->samples)
+            sample = 0;
+        stb_vorbis_seek(stream->vorbis, sample);
+        if (sound->flags & AUDIO_PLAYING)
+            audio_stream_start(sound);
+        return;
+    }
+    if (sample >= (unsigned) sound->data->samples)
+        sample = 0;
+    sound->cursor = (float) sample / sound->data->sample_rate;
+    if (sound->voice >= 0)
+        alSourcei(sound->source, AL_SAMPLE_OFFSET, sample);
 }
 
 // INITIALIZATION / DEINITIALIZATION
 
+// Sets up what both kinds of device share, once the context is current.
+static void audio_init_common() {
+    audio_cache.stats.budget = AUDIO_CACHE_DEFAULT_BUDGET;
+    // Grab as many sources as the device gives us, up to the pool size.
+    audio_globals.voice_count = 0;
+    while (audio_globals.voice_count < AUDIO_MAX_VOICES) {
+        alGenSources(1, audio_globals.voices + audio_globals.voice_count);
+        if (alGetError() != AL_NO_ERROR)
+            break;
+        audio_globals.voice_owners[audio_globals.voice_count++] = NULL;
+    }
+}
+
 void audio_init() {
 
     alGetError();
@@ -144,9 +753,70 @@ void audio_init() {
     audio_globals.context = alcCreateContext(audio_globals.device, NULL);
     AL_CHECK( alcMakeContextCurrent(audio_globals.context) );
 
+    audio_init_common();
+
+}
+
+int audio_init_loopback(int sample_rate) {
+#ifdef ALC_SOFT_loopback
+    if (!alcIsExtensionPresent(NULL, "ALC_SOFT_loopback"))
+        return 0;
+    LPALCLOOPBACKOPENDEVICESOFT open_loopback =
+        (LPALCLOOPBACKOPENDEVICESOFT) alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+    audio_globals.render = (LPALCRENDERSAMPLESSOFT) alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+    if (!open_loopback || !audio_globals.render)
+        return 0;
+
+    alGetError();
+
+    audio_globals.device = open_loopback(NULL);
+    if (audio_globals.device == NULL)
+        return 0;
+    const ALCint attributes[] = {
+        ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+        ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT,
+        ALC_FREQUENCY, sample_rate,
+        0
+    };
+    audio_globals.context = alcCreateContext(audio_globals.device, attributes);
+    if (audio_globals.context == NULL) {
+        alcCloseDevice(audio_globals.device);
+        return 0;
+    }
+    AL_CHECK( alcMakeContextCurrent(audio_globals.context) );
+
+    audio_init_common();
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void audio_render(short * out, unsigned frames) {
+#ifdef ALC_SOFT_loopback
+    audio_globals.render(audio_globals.device, out, frames);
+#endif
 }
 
 void audio_deinit() {
+    for (unsigned i = 0; i < AUDIO_CACHE_BUCKETS; i++) {
+        AudioCacheEntry * e = audio_cache.buckets[i];
+        while (e) {
+            AudioCacheEntry * next = e->next;
+            audio_cache_free_entry(e);
+            e = next;
+        }
+        audio_cache.buckets[i] = NULL;
+    }
+    audio_cache.stats.entries = 0;
+    sound_list_free(&audio_globals.streams);
+    sound_list_free(&audio_globals.loading);
+    sound_list_free(&audio_globals.active);
+    tfree(audio_globals.candidates);
+    audio_globals.candidates = NULL;
+    audio_globals.candidate_capacity = 0;
+    alDeleteSources(audio_globals.voice_count, audio_globals.voices);
+    audio_globals.voice_count = 0;
     alcMakeContextCurrent(NULL);
     alcDestroyContext(audio_globals.context);
     alcCloseDevice(audio_globals.device);
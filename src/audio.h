@@ -8,16 +8,49 @@
 #else
 #include <AL/al.h>
 #include <AL/alc.h>
+#include <AL/alext.h>
 #endif
 #include "stb_vorbis.h"
 #include "ldmath.h"
 
 void audio_init();
 
+// Like audio_init, but opens an ALC_SOFT_loopback device that plays nothing
+// and mixes only when audio_render asks it to, into interleaved 16 bit stereo
+// at sample_rate. Returns 0 with nothing initialized if loopback devices are
+// not supported.
+int audio_init_loopback(int sample_rate);
+
+// Mixes the next frames of a loopback device.
+void audio_render(short * out, unsigned frames);
+
 void audio_deinit();
 
 #define AUDIO_ACTIVE 0x02
-#define AUDIO_OWNS_DATA 0x04
+#define AUDIO_STREAMING 0x08
+#define AUDIO_LOOPING 0x10
+#define AUDIO_PLAYING 0x20
+#define AUDIO_LOADING 0x40
+#define AUDIO_PLAY_ON_LOAD 0x80
+#define AUDIO_LOOP_ON_LOAD 0x100
+#define AUDIO_CACHED_DATA 0x200
+
+// Size of the pool of real AL sources shared by all non-streaming sounds. A
+// playing sound without a source is virtual: its position is tracked but it
+// is not mixed. Streams own their source and are never virtualized.
+#define AUDIO_MAX_VOICES 32
+
+// Decoded sounds nobody is using are kept around until the cache holds more
+// than this many bytes of PCM.
+#define AUDIO_CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// Streams keep AUDIO_STREAM_BUFFERS buffers of AUDIO_STREAM_BUFFER_SAMPLES
+// sample frames queued, about 0.75 seconds of 44.1kHz audio. A stereo stream
+// holds 128KB of queued PCM plus one buffer's worth of scratch space.
+#define AUDIO_STREAM_BUFFERS 4
+#define AUDIO_STREAM_BUFFER_SAMPLES 8192
+
+struct AudioDecodeJob;
 
 typedef struct {
     ALuint buffer;
@@ -25,26 +58,87 @@ typedef struct {
     int samples;
     int channels;
     int sample_rate;
+    int loading;
+    struct AudioDecodeJob * job;
 } SoundData;
 
 typedef struct {
+    stb_vorbis * vorbis;
+    ALuint buffers[AUDIO_STREAM_BUFFERS];
+    ALenum format;
+    short * pcm;
+    unsigned samples;
+    int channels;
+    int sample_rate;
+    int eof;
+} SoundStream;
+
+struct Sound;
+
+typedef void (*AudioLoadCallback)(struct Sound * sound, void * user);
+
+typedef struct Sound {
     uint32_t flags;
     SoundData * data;
+    SoundStream * stream;
+    AudioLoadCallback onload;
+    void * onload_user;
     ALuint source;
+    int voice;
+    float cursor;
+    float priority;
     vec3 position;
     float volume;
     float pitch;
     float gain;
 } Sound;
 
+typedef struct {
+    unsigned voices;
+    unsigned real;
+    unsigned virtual;
+} AudioVoiceStats;
+
 SoundData * audio_data_init(SoundData * data, const char * resource);
 
+// Decodes the file on a worker thread. The AL buffer is created on the main
+// thread once decoding finishes, and until then data->loading is set.
+SoundData * audio_data_init_async(SoundData * data, const char * resource);
+
 void audio_data_deinit(SoundData * data);
 
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned entries;
+    size_t bytes;
+    size_t budget;
+} AudioCacheStats;
+
+// Gets the shared SoundData for a resource, loading it on a miss. Every call
+// must be paired with audio_data_release.
+SoundData * audio_data_acquire(const char * resource, int async);
+
+void audio_data_release(SoundData * data);
+
+void audio_cache_set_budget(size_t bytes);
+
+void audio_cache_stats(AudioCacheStats * stats);
+
 Sound * audio_sound_init(Sound * sound, SoundData * data);
 
 Sound * audio_sound_init_resource(Sound * sound, const char * resource);
 
+// Like audio_sound_init_resource, but the file is decoded in the background.
+// The sound can be used right away; playing it before it has loaded starts it
+// as soon as it is ready. onload, if not NULL, is called on the main thread
+// once the sound is ready.
+Sound * audio_sound_init_resource_async(Sound * sound, const char * resource,
+        AudioLoadCallback onload, void * user);
+
+Sound * audio_sound_init_stream(Sound * sound, const char * resource);
+
 void audio_sound_deinit(Sound * sound);
 
 void audio_sound_play(Sound * sound);
@@ -59,4 +153,12 @@ void audio_sound_stop_looping(Sound * sound);
 
 void audio_sound_loop(Sound * sound);
 
+void audio_sound_seek(Sound * sound, unsigned sample);
+
+void audio_set_listener(const vec3 position, const vec3 forward, const vec3 up);
+
+void audio_voice_stats(AudioVoiceStats * stats);
+
+void audio_update(double dt);
+
 #endif /* end of include guard: AUDIO_H_WMDLVZMG */
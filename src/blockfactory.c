@@ -1,9 +1,11 @@
 #include "blockfactory.h"
+#include "memtrack.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
 
-// Float array sections (Total 14N)
+// Float array sections (Total 10N)
 // 0..2N    - Base points (N sides, 2 floats per coord)
 // 2N..4N   - Top uv coords (N verts on top, 2 floats perr uv coord.)
 // 4N..6N   - Bottom uv coords
@@ -11,18 +13,18 @@
 #define calc_floats(N) ((N) * 10)
 #define calc_size(N) (calc_floats(N) * sizeof(float))
 #define btpl_base(X, N) (X)->points
-#define btpl_base_size(N) (sizeof(float) + 2 * N)
-#define btpl_top_uv(X, N) ((X)->points + sizeof(float) * 2 * N)
+#define btpl_base_size(N) (sizeof(float) * 2 * N)
+#define btpl_top_uv(X, N) ((X)->points + 2 * N)
 #define btpl_top_size(N) (sizeof(float) * 2 * N)
-#define btpl_bot_uv(X, N) ((X)->points + sizeof(float) * 4 * N)
+#define btpl_bot_uv(X, N) ((X)->points + 4 * N)
 #define btpl_bot_size(N) (sizeof(float) * 2 * N)
-#define btpl_sides_uv(X, N) ((X)->points + sizeof(float) * 6 * N)
+#define btpl_sides_uv(X, N) ((X)->points + 6 * N)
 #define btpl_sides_size(N) (sizeof(float) * 4 * N)
 
 BlockMeshTemplate * btpl_init(BlockMeshTemplate * tpl, float height, unsigned sides, float * base) {
     tpl->height = height;
     tpl->sides = sides;
-    tpl->points = malloc(calc_size(sides));
+    tpl->points = tmalloc(MEM_TAG_MESH, calc_size(sides));
     memcpy(btpl_base(tpl, sides), base, btpl_base_size(sides));
 
     // Set good defaults for uvs on top
@@ -83,7 +85,7 @@ BlockMeshTemplate * btpl_init(BlockMeshTemplate * tpl, float height, unsigned si
 }
 
 void btpl_deinit(BlockMeshTemplate * tpl) {
-    free(tpl->points);
+    tfree(tpl->points);
 }
 
 // For face:
@@ -175,17 +177,17 @@ static void btpl_extract_point(BlockMeshTemplate * tpl, unsigned side, int face,
     out[7] = v;
 }
 
-#define BTPL_INDEX(S, F) (48 * S + 8 * F)
+#define BTPL_INDEX(S, F) (6 * (S) + (F))
 
 void btpl_tomesh(BlockMeshTemplate * tpl, Mesh * mesh, unsigned flags) {
 
     unsigned sides = tpl->sides;
-    unsigned vcount = 8 * 6 * sides;
-    unsigned ecount = 12 * sides;
-    size_t vsize = sizeof(GLfloat) * vcount;
+    unsigned vcount = 6 * sides;
+    unsigned ecount = 12 * sides - 12;
+    size_t vsize = sizeof(GLfloat) * 8 * vcount;
     size_t esize = sizeof(GLushort) * ecount;
 
-    void * ptr = malloc(vsize + esize);
+    void * ptr = tmalloc(MEM_TAG_MESH, vsize + esize);
     GLfloat * vertices = ptr;
     GLushort * elements = ptr + vsize;
     GLfloat * v = vertices;
@@ -225,6 +227,6 @@ void btpl_tomesh(BlockMeshTemplate * tpl, Mesh * mesh, unsigned flags) {
         e += 6;
     }
 
-    mesh_init_mem(mesh, MESHTYPE_3D, GL_STATIC_DRAW, vcount, vertices, 1, ecount, elements, 0);
+    mesh_init_mem(mesh, MESHTYPE_3D, GL_STATIC_DRAW, 8 * vcount, vertices, 1, ecount, elements, 0);
 
 }
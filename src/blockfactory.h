@@ -18,6 +18,6 @@ BlockMeshTemplate * btpl_init(BlockMeshTemplate * tpl, float height, unsigned si
 
 void btpl_deinit(BlockMeshTemplate * tpl);
 
-void bfactory_tomesh(BlockMeshTemplate * tpl, Mesh * mesh, unsigned flags);
+void btpl_tomesh(BlockMeshTemplate * tpl, Mesh * mesh, unsigned flags);
 
 #endif /* end of include guard: BLOCKFACTORY_H_TWKIKJNB */
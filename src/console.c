@@ -4,6 +4,8 @@
 #include "ldmath.h"
 #include "quickdraw.h"
 #include "util.h"
+#include "memtrack.h"
+#include "arena.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -62,18 +64,14 @@ void console_lograw(const char * message) {
 }
 
 void console_log(const char * format, ...) {
+    ArenaMark mark = arena_mark();
     va_list list;
     va_start(list, format);
-    int neededlen = vsnprintf(NULL, 0, format, list);
-    if (neededlen < 0) return;
-    uqfree_if_needed();
-    char * buffer = uqmalloc(neededlen + 1);
+    char * buffer = arena_vprintf(format, list);
     va_end(list);
-    va_start(list, format);
-    vsnprintf(buffer, neededlen + 1, format, list);
-    console_lograw(buffer);
-    va_end(list);
-    uqfree_if_needed();
+    if (buffer)
+        console_lograw(buffer);
+    arena_reset(mark);
 }
 
 void console_clear() {
@@ -121,10 +119,11 @@ void console_set_history(unsigned length) {
         }
         console_globals.history_len = length;
     }
-    Text * history_tmp = malloc(sizeof(Text) * length);
+    Text * history_tmp = tmalloc(MEM_TAG_CONSOLE, sizeof(Text) * length);
     for (unsigned i = 0; i < console_globals.history_len; i++) {
         memcpy(history_tmp + i, nth_history(i), sizeof(Text));
     }
+    tfree(console_globals.history);
     console_globals.history = history_tmp;
     console_globals.history_start = 0;
 
@@ -152,7 +151,7 @@ void console_pushn(const char * string, size_t n) {
     console_globals.write_buffer_len = oldlen + n;
     if (console_globals.write_buffer_len > console_globals.write_buffer_capacity) {
         console_globals.write_buffer_capacity = console_globals.write_buffer_len * 1.5 + 1;
-        console_globals.write_buffer = realloc(console_globals.write_buffer, console_globals.write_buffer_capacity + 1);
+        console_globals.write_buffer = trealloc(MEM_TAG_CONSOLE, console_globals.write_buffer, console_globals.write_buffer_capacity + 1);
     }
     strncpy(console_globals.write_buffer + oldlen, string, n);
 }
@@ -164,7 +163,7 @@ void console_flush(int useMarkup) {
         size_t newlen = textutil_get_escapedlength(console_globals.write_buffer);
         if (newlen > console_globals.write_buffer_capacity) {
             console_globals.write_buffer_capacity = newlen;
-            console_globals.write_buffer = realloc(console_globals.write_buffer, newlen + 1);
+            console_globals.write_buffer = trealloc(MEM_TAG_CONSOLE, console_globals.write_buffer, newlen + 1);
         }
         textutil_escape_inplace(console_globals.write_buffer, newlen + 1);
     }
@@ -195,11 +194,11 @@ void console_init() {
     console_globals.history_capacity = 10;
     console_globals.history_len = 0;
     console_globals.history_start = 0;
-    console_globals.history = malloc(sizeof(Text) * console_globals.history_capacity);
+    console_globals.history = tmalloc(MEM_TAG_CONSOLE, sizeof(Text) * console_globals.history_capacity);
 
     console_globals.write_buffer_capacity = 63;
     console_globals.write_buffer_len = 0;
-    console_globals.write_buffer = malloc(console_globals.write_buffer_capacity + 1);
+    console_globals.write_buffer = tmalloc(MEM_TAG_CONSOLE, console_globals.write_buffer_capacity + 1);
 }
 
 void console_deinit() {
@@ -208,6 +207,6 @@ void console_deinit() {
         Text * t = console_globals.history + ((console_globals.history_start + i) % console_globals.history_capacity);
         text_deinit(t);
     }
-    free(console_globals.history);
-    free(console_globals.write_buffer);
+    tfree(console_globals.history);
+    tfree(console_globals.write_buffer);
 }
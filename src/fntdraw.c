@@ -1,88 +1,193 @@
 #include "fntdraw.h"
+#include "trace.h"
 #include "platform.h"
 #include "shader.h"
 #include "util.h"
+#include "memtrack.h"
 #include <stdarg.h>
 #include <stdlib.h>
 
 #define CHAR_VERT_SIZE 8
 #define CHAR_SIZE (CHAR_VERT_SIZE * 4)
 
-// Begin Sparse Array implementation for kerning tables
+// Begin kerning table implementation
 
-typedef struct {
-    unsigned long key;
-    float value;
-} SparseArrayBucket;
-
-typedef struct {
-    unsigned count;
-    unsigned capacity;
-    SparseArrayBucket * data;
-} SparseArray;
+static inline unsigned kerning_hash(uint32_t first, uint32_t second) {
+    uint32_t h = first * 0x9E3779B1u ^ second * 0x85EBCA77u;
+    return h ^ (h >> 15);
+}
 
-static SparseArray * sarray_init(SparseArray * sa, unsigned capacity) {
-    sa->capacity = capacity;
-    sa->count = 0;
-    sa->data = malloc(sizeof(SparseArrayBucket) * capacity);
-    return sa;
+// Allocates an empty table with room for at least count pairs. The table is kept
+// at most half full so misses usually end on the first probe, and always has at
+// least one empty bucket so lookups terminate without checking the count.
+static void kerning_init(FontDef * fd, unsigned count) {
+    unsigned capacity = 1;
+    while (capacity < 2 * count + 1)
+        capacity <<= 1;
+    fd->kerningcount = 0;
+    fd->kerningmask = capacity - 1;
+    fd->kernings = tcalloc(MEM_TAG_TEXT, capacity, sizeof(FontKerning));
 }
 
-static void sarray_deinit(SparseArray * sa) {
-    free(sa->data);
+static void kerning_deinit(FontDef * fd) {
+    tfree(fd->kernings);
 }
 
-static int sarray_bucket(const SparseArray * sa, unsigned long key) {
-    SparseArrayBucket * low = sa->data;
-    SparseArrayBucket * hi = sa->data + sa->count - 1;
-    SparseArrayBucket * mid;
-    while(hi >= low) {
-        mid = low + (hi - low) / 2;
-        if (mid->key > key) {
-            hi = mid - 1;
-        } else if (mid->key < key) {
-            low = mid + 1;
-        } else {
-            return mid - sa->data;
+static void kerning_set(FontDef * fd, uint32_t first, uint32_t second, float amount) {
+    if (first == 0)
+        return;
+    if (2 * (fd->kerningcount + 1) > fd->kerningmask) {
+        uerr("Kerning table overflow.");
+    }
+    unsigned mask = fd->kerningmask;
+    unsigned i = kerning_hash(first, second) & mask;
+    FontKerning * k;
+    for (;;) {
+        k = fd->kernings + i;
+        if (k->first == 0) {
+            fd->kerningcount++;
+            break;
         }
+        if (k->first == first && k->second == second)
+            break;
+        i = (i + 1) & mask;
     }
-    return (sa->data - low) - 1;
+    k->first = first;
+    k->second = second;
+    k->amount = amount;
 }
 
 // Returns 0 by default, which is okay for kerning
-static float sarray_get(const SparseArray * sa, unsigned long key) {
-    int bucketi;
-    if ((bucketi = sarray_bucket(sa, key)) >= 0) {
-        return sa->data[bucketi].value;
-    } else {
-        return 0.0f;
+static inline float kerning_get(const FontDef * fd, uint32_t first, uint32_t second) {
+    unsigned mask = fd->kerningmask;
+    unsigned i = kerning_hash(first, second) & mask;
+    const FontKerning * k;
+    while ((k = fd->kernings + i)->first) {
+        if (k->first == first && k->second == second)
+            return k->amount;
+        i = (i + 1) & mask;
     }
+    return 0.0f;
+}
+
+// End kerning table implementation
+
+// Begin glyph table implementation
+
+static inline unsigned glyph_hash(uint32_t codepoint) {
+    uint32_t h = codepoint * 0x9E3779B1u;
+    return h ^ (h >> 15);
 }
 
-static void sarray_trim(SparseArray * sa) {
-    sa->data = realloc(sa->data, sa->count * sizeof(SparseArrayBucket));
-    sa->capacity = sa->count;
+static void glyphs_init(FontDef * fd, unsigned count) {
+    unsigned capacity = 1;
+    while (capacity < 2 * count + 1)
+        capacity <<= 1;
+    fd->glyphcount = 0;
+    fd->glyphmask = capacity - 1;
+    fd->glyphs = tcalloc(MEM_TAG_TEXT, capacity, sizeof(FontGlyph));
 }
 
-static void sarray_set(SparseArray * sa, unsigned long key, float value) {
-    int bucketi;
-    if ((bucketi = sarray_bucket(sa, key)) >= 0) { // Key already exists.
-        sa->data[bucketi].value = value;
-    } else { // Insert new bucket
-        int dif = -bucketi - 1;
-        sa->count++;
-        if (sa->capacity < sa->count) {
-            sa->capacity = 2 * sa->count;
-            sa->data = realloc(sa->data, sa->capacity * sizeof(SparseArrayBucket));
+static void glyphs_deinit(FontDef * fd) {
+    tfree(fd->glyphs);
+}
+
+static FontCharDef * glyphs_insert(FontDef * fd, uint32_t codepoint) {
+    if (2 * (fd->glyphcount + 1) > fd->glyphmask) {
+        uerr("Glyph table overflow.");
+    }
+    unsigned mask = fd->glyphmask;
+    unsigned i = glyph_hash(codepoint) & mask;
+    FontGlyph * g;
+    for (;;) {
+        g = fd->glyphs + i;
+        if (g->codepoint == 0) {
+            fd->glyphcount++;
+            break;
         }
-        memmove(sa->data + dif + 1, sa->data + dif, (sa->count - dif - 1) * sizeof(SparseArrayBucket));
-        SparseArrayBucket * bucket = sa->data + dif;
-        bucket->key = key;
-        bucket->value = value;
+        if (g->codepoint == codepoint)
+            break;
+        i = (i + 1) & mask;
+    }
+    g->codepoint = codepoint;
+    return &g->def;
+}
+
+static const FontCharDef * glyphs_get(const FontDef * fd, uint32_t codepoint) {
+    unsigned mask = fd->glyphmask;
+    unsigned i = glyph_hash(codepoint) & mask;
+    const FontGlyph * g;
+    while ((g = fd->glyphs + i)->codepoint) {
+        if (g->codepoint == codepoint)
+            return &g->def;
+        i = (i + 1) & mask;
     }
+    return fd->chars;
+}
+
+// Gets the glyph for a codepoint, falling back to a space for missing glyphs.
+static inline const FontCharDef * get_glyph(const FontDef * fd, uint32_t codepoint) {
+    const FontCharDef * fcd = codepoint < 256 ? fd->chars + codepoint : glyphs_get(fd, codepoint);
+    return fcd->valid ? fcd : fd->chars + ' ';
 }
 
-// End Sparse Array implementation
+static inline float get_advance(const FontDef * fd, uint32_t codepoint) {
+    if (codepoint < 256)
+        return fd->advances[codepoint];
+    return get_glyph(fd, codepoint)->xadvance;
+}
+
+// End glyph table implementation
+
+// Begin UTF-8 decoding
+
+// Decodes a multibyte UTF-8 sequence. Malformed sequences decode to U+FFFD one
+// byte at a time, so decoding never reads past a null terminator.
+static unsigned utf8_decode_multibyte(const unsigned char * u, uint32_t * codepoint) {
+    unsigned len;
+    uint32_t cp, min;
+    if ((u[0] & 0xE0) == 0xC0) {
+        len = 2; cp = u[0] & 0x1F; min = 0x80;
+    } else if ((u[0] & 0xF0) == 0xE0) {
+        len = 3; cp = u[0] & 0x0F; min = 0x800;
+    } else if ((u[0] & 0xF8) == 0xF0) {
+        len = 4; cp = u[0] & 0x07; min = 0x10000;
+    } else {
+        len = 0; cp = 0; min = 0;
+    }
+    for (unsigned i = 1; i < len; i++) {
+        if ((u[i] & 0xC0) != 0x80) {
+            len = 0;
+            break;
+        }
+        cp = (cp << 6) | (u[i] & 0x3F);
+    }
+    if (len == 0 || cp < min || cp > 0x10FFFF) {
+        *codepoint = 0xFFFD;
+        return 1;
+    }
+    *codepoint = cp;
+    return len;
+}
+
+// Decodes the UTF-8 sequence at c. Returns the length of the sequence in bytes.
+static inline unsigned utf8_decode(const char * c, uint32_t * codepoint) {
+    const unsigned char * u = (const unsigned char *) c;
+    if (u[0] < 0x80) {
+        *codepoint = u[0];
+        return 1;
+    }
+    return utf8_decode_multibyte(u, codepoint);
+}
+
+static inline const char * utf8_next(const char * c) {
+    uint32_t codepoint;
+    if (!(*c & 0x80))
+        return c + 1;
+    return c + utf8_decode(c, &codepoint);
+}
+
+// End UTF-8 decoding
 
 // Text Shaders start
 
@@ -209,6 +314,60 @@ static void text_shader_deinit() {
 
 // Text Shaders end
 
+// Atlas pages start
+
+// Approximate GPU memory of a page, including mipmaps.
+static size_t page_size(const FontPage * p) {
+    return (size_t) p->tex.w * p->tex.h * 4 * 4 / 3;
+}
+
+// Unloads the least recently used pages until the font is under its budget.
+// Pages used by the current draw stay, even if that leaves the font over.
+static void page_evict(FontDef * fd) {
+    while (fd->pagebytes > fd->pagebudget) {
+        FontPage * lru = NULL;
+        for (unsigned i = 0; i < fd->pagecount; i++) {
+            FontPage * p = fd->pages + i;
+            if (p->loaded && p->lastuse <= fd->drawclock && (!lru || p->lastuse < lru->lastuse))
+                lru = p;
+        }
+        if (!lru) {
+            if (!fd->pagewarned)
+                fprintf(stderr, "A text needs %lu KB of font pages, over the %lu KB budget.\n",
+                        (unsigned long) (fd->pagebytes / 1024), (unsigned long) (fd->pagebudget / 1024));
+            fd->pagewarned = 1;
+            return;
+        }
+        texture_deinit(&lru->tex);
+        lru->loaded = 0;
+        fd->pagebytes -= page_size(lru);
+    }
+}
+
+// Gets the texture for a page, loading it first if needed.
+static GLuint page_bind(FontDef * fd, unsigned page) {
+    FontPage * p = fd->pages + page;
+    p->lastuse = ++fd->pageclock;
+    if (!p->loaded) {
+        if (!p->file)
+            uerr("Font page has no image file.");
+        texture_init_file(&p->tex, p->file, -1);
+        p->loaded = 1;
+        fd->pagebytes += page_size(p);
+        page_evict(fd);
+    }
+    return p->tex.id;
+}
+
+void fnt_set_page_budget(FontDef * fd, size_t bytes) {
+    fd->pagebudget = bytes;
+    fd->drawclock = fd->pageclock;
+    fd->pagewarned = 0;
+    page_evict(fd);
+}
+
+// Atlas pages end
+
 // File Reader start
 
 static void skip_whitespace(const char ** p) {
@@ -218,11 +377,11 @@ static void skip_whitespace(const char ** p) {
     *p = c;
 }
 
-static int is_eol(const char c) {
+static int is_eol(uint32_t c) {
     return c == '\r' || c == '\n' || c == '\0';
 }
 
-static int is_whitespace(const char c) {
+static int is_whitespace(uint32_t c) {
     return c <= 32;
 }
 
@@ -352,23 +511,40 @@ FontDef * fnt_init(FontDef * fd, const char * resource) {
     fd->lineHeight = atof(buf);
     line_find_value(srcp, "base", buf, BUFLEN);
     fd->base = atof(buf);
+    fd->scaleW = line_find_value(srcp, "scaleW", buf, BUFLEN) ? atoi(buf) : 0;
+    fd->scaleH = line_find_value(srcp, "scaleH", buf, BUFLEN) ? atoi(buf) : 0;
+    fd->pagecount = line_find_value(srcp, "pages", buf, BUFLEN) ? atoi(buf) : 1;
+    if (fd->pagecount == 0)
+        fd->pagecount = 1;
     srcp = line_next(srcp);
-    // Get the texture
-    line_find_value(srcp, "file", buf, BUFLEN);
+    // Get the atlas pages. Textures are not loaded until a page is drawn.
+    fd->pages = tcalloc(MEM_TAG_TEXT, fd->pagecount, sizeof(FontPage));
+    fd->pagebytes = 0;
+    fd->pagebudget = FNTDRAW_DEFAULT_PAGE_BUDGET;
+    fd->pageclock = 0;
+    fd->drawclock = 0;
+    fd->pagewarned = 0;
     char buf2[BUFLEN];
-    resolve_path_name(path, buf, buf2, BUFLEN);
-    texture_init_file(&fd->tex, buf2, -1);
-    srcp = line_next(srcp);
+    while (srcp && line_get_type(srcp) == FNT_PAGE_TYPE) {
+        unsigned pageid = line_find_value(srcp, "id", buf, BUFLEN) ? atoi(buf) : 0;
+        line_find_value(srcp, "file", buf, BUFLEN);
+        resolve_path_name(path, buf, buf2, BUFLEN);
+        if (pageid < fd->pagecount && !fd->pages[pageid].file) {
+            fd->pages[pageid].file = tstrdup(MEM_TAG_TEXT, buf2);
+        }
+        srcp = line_next(srcp);
+    }
     // Get the number of characters
     line_find_value(srcp, "count", buf, BUFLEN);
     fd->charcount = atoi(buf);
-    FontCharDef * cd = fd->chars = calloc(256, sizeof(FontCharDef));
+    FontCharDef * cd = fd->chars = tcalloc(MEM_TAG_TEXT, 256, sizeof(FontCharDef));
+    glyphs_init(fd, fd->charcount);
     for(;;) {
         srcp = line_next(srcp);
         if (!srcp || (line_get_type(srcp) != FNT_CHAR_TYPE)) {
             break;
         }
-        unsigned id;
+        unsigned id, page;
         unsigned x, y, w, h;
         float xoff, yoff, xadvance;
         line_find_value(srcp, "id", buf, BUFLEN); id = atoi(buf);
@@ -379,17 +555,18 @@ FontDef * fnt_init(FontDef * fd, const char * resource) {
         line_find_value(srcp, "xoffset", buf, BUFLEN); xoff = atof(buf);
         line_find_value(srcp, "yoffset", buf, BUFLEN); yoff = atof(buf);
         line_find_value(srcp, "xadvance", buf, BUFLEN); xadvance = atof(buf);
-        // Ignore non ascii and extended characters. Unicode support would be awesome, though.
-        if (id > 255) continue;
-        cd[id].valid = 1;
-        cd[id].x = x;
-        cd[id].y = y;
-        cd[id].w = w;
-        cd[id].h = h;
-        cd[id].xoffset = xoff;
-        cd[id].yoffset = yoff;
-        cd[id].xadvance = xadvance;
-        cd[id].kerning.data = NULL;
+        page = line_find_value(srcp, "page", buf, BUFLEN) ? atoi(buf) : 0;
+        if (id == 0 || id > 0x10FFFF) continue;
+        FontCharDef * fcd = id < 256 ? cd + id : glyphs_insert(fd, id);
+        fcd->valid = 1;
+        fcd->x = x;
+        fcd->y = y;
+        fcd->w = w;
+        fcd->h = h;
+        fcd->xoffset = xoff;
+        fcd->yoffset = yoff;
+        fcd->xadvance = xadvance;
+        fcd->page = page < fd->pagecount ? page : 0;
     }
     // Infer tabs to be 4 x spaces
     if (!cd[9].valid && cd[32].valid) {
@@ -401,46 +578,51 @@ FontDef * fnt_init(FontDef * fd, const char * resource) {
         cd[9].xoffset = cd[32].xoffset;
         cd[9].yoffset = cd[32].yoffset;
         cd[9].xadvance = 4 * cd[32].xadvance;
-        cd[9].kerning.data = NULL;
+        cd[9].page = cd[32].page;
+    }
+    for (int id = 0; id < 256; id++) {
+        fd->advances[id] = cd[id].valid ? cd[id].xadvance : cd[' '].xadvance;
     }
-    if (srcp)  {
+    int kerningcount = 0;
+    if (srcp && line_get_type(srcp) == FNT_KERNINGS_TYPE) {
         line_find_value(srcp, "count", buf, BUFLEN);
-        int kerningcount = atoi(buf);
-        for (int ii = 0; ii < kerningcount; ii++) {
-            srcp = line_next(srcp);
-            line_find_value(srcp, "first", buf, BUFLEN);
-            unsigned long first = atoi(buf);
-            line_find_value(srcp, "second", buf, BUFLEN);
-            unsigned long second = atoi(buf);
-            line_find_value(srcp, "amount", buf, BUFLEN);
-            float amount = atof(buf);
-            SparseArray * sa = (SparseArray *) &cd[first].kerning;
-            if (!sa->data)
-                sarray_init(sa, 10);
-
-            sarray_set(sa, second, amount);
-        }
-        for (int id = 0; id < 128; id++) {
-            if (cd[id].valid && cd[id].kerning.data) {
-                sarray_trim((SparseArray *) &cd[id].kerning);
-            }
-        }
+        kerningcount = atoi(buf);
+    }
+    kerning_init(fd, kerningcount);
+    for (int ii = 0; ii < kerningcount; ii++) {
+        srcp = line_next(srcp);
+        if (!srcp) break;
+        line_find_value(srcp, "first", buf, BUFLEN);
+        uint32_t first = atoi(buf);
+        line_find_value(srcp, "second", buf, BUFLEN);
+        uint32_t second = atoi(buf);
+        line_find_value(srcp, "amount", buf, BUFLEN);
+        float amount = atof(buf);
+        kerning_set(fd, first, second, amount);
     }
     free(source);
-    uqfree_if_needed();
+    // Older files don't declare the atlas size, so get it from the first page.
+    if (fd->scaleW == 0 || fd->scaleH == 0) {
+        page_bind(fd, 0);
+        fd->scaleW = fd->pages[0].tex.w;
+        fd->scaleH = fd->pages[0].tex.h;
+    }
     return fd;
 }
 
 // File Reader end
 
 void fnt_deinit(FontDef * fd) {
-    for (int i = 0; i < 128; i++) {
-        FontCharDef * fcd = fd->chars + i;
-        if (fcd->valid && fcd->kerning.data)
-            sarray_deinit((SparseArray *) &fcd->kerning);
+    for (unsigned i = 0; i < fd->pagecount; i++) {
+        FontPage * p = fd->pages + i;
+        if (p->loaded)
+            texture_deinit(&p->tex);
+        tfree(p->file);
     }
-    free(fd->chars);
-    texture_deinit(&fd->tex);
+    tfree(fd->pages);
+    kerning_deinit(fd);
+    glyphs_deinit(fd);
+    tfree(fd->chars);
     if (--fntdef_count == 0) {
         text_shader_deinit();
     }
@@ -487,7 +669,7 @@ static inline const char * next_token(const char * c, int escape) {
     if (*c == '\0')
         return c;
     else
-        return first_printable_token(c + 1, escape);
+        return first_printable_token(utf8_next(c), escape);
 }
 
 static size_t fntdraw_string_join_len(int n, const char ** strings, const char * sep) {
@@ -516,45 +698,20 @@ static void fntdraw_string_join(char * buffer, int n, const char ** strings, con
     *current = 0;
 }
 
-#define CHARNONE ((unsigned long) -1)
-
-// Gets the kerning between two characters
-static float get_kerning(const FontCharDef * fcd, unsigned long next) {
-    if (!fcd->kerning.data)
-        return 0.0f;
-    SparseArray * sa = (SparseArray *) &fcd->kerning;
-    return sarray_get(sa, next);
-}
-
-// Gets the width and kerning between two characters.
-// Behavior depends on if c1 or c2 are CHARNONE
-static float get_charwidth(const FontDef * fd, unsigned long c1, unsigned long c2) {
-    const FontCharDef * fcds, * fcd1, * fcd2;
-    if (c1 == CHARNONE) return get_charwidth(fd, c2, c1);
-    fcds = fd->chars;
-    fcd1 = fcds + c1; if (!fcd1->valid) fcd1 = fcds + ' ';
-    if (c2 == CHARNONE) {
-        if (c1 < 255 && is_eol(c1)) return 0;
-        return fcd1->xadvance;
-    }
-    fcd2 = fcds + c2; if (!fcd2->valid) fcd2 = fcds + ' ';
-    if (c2 == CHARNONE) return fcd1->xadvance;
-    if (!fcd1->kerning.data)
-        return fcd2->xadvance;
-    SparseArray * sa = (SparseArray *) &fcd1->kerning;
-    float kerning = sarray_get(sa, c2);
-    return kerning + fcd2->xadvance;
+// Gets the advance of c2 plus the kerning between c1 and c2.
+static inline float get_charwidth(const FontDef * fd, uint32_t c1, uint32_t c2) {
+    return get_advance(fd, c2) + kerning_get(fd, c1, c2);
 }
 
 static const char * append_line(Text * t, TextLine tl) {
     if (!t->lines) { // We're just refilling the old line buffer
         t->line_capacity = 10;
-        t->lines = malloc(t->line_capacity * sizeof(TextLine));
+        t->lines = tmalloc(MEM_TAG_TEXT, t->line_capacity * sizeof(TextLine));
     }
     unsigned line = t->line_count++;
     if (line >= t->line_capacity) {
         t->line_capacity = (line > 15 ? line * 1.4 : line * 2) + 1;
-        t->lines = realloc(t->lines, t->line_capacity * sizeof(TextLine));
+        t->lines = trealloc(MEM_TAG_TEXT, t->lines, t->line_capacity * sizeof(TextLine));
     }
     TextLine * newline = t->lines + line;
     *newline = tl;
@@ -587,21 +744,26 @@ static void calc_wrap(Text * t) {
             first = append_line(t, tl);
             continue;
         }
+        uint32_t cp, nextcp;
+        unsigned len = utf8_decode(current, &cp);
         count = lastCount = 1;
-        current_length = valid_length = get_charwidth(fd, *current, CHARNONE);
+        current_length = valid_length = get_advance(fd, cp);
         int spaceEncountered = 0;
         while (1) {
-            float dlen = get_charwidth(fd, *current, *next_token(current, escape)) * scale;
-            current_length += dlen;
-            current = next_token(current, escape);
+            // current is never an end of line here, so skip the check in next_token.
+            const char * next = first_printable_token(current + len, escape);
+            len = utf8_decode(next, &nextcp);
+            current_length += get_charwidth(fd, cp, nextcp) * scale;
+            current = next;
+            cp = nextcp;
             if (max_width != 0 && current_length > max_width) break;
-            if (!spaceEncountered || is_whitespace(*current) || is_eol(*current)) {
+            if (!spaceEncountered || is_whitespace(cp) || is_eol(cp)) {
                 last = current;
                 lastCount = count;
                 valid_length = current_length;
-                if (is_eol(*current))
+                if (is_eol(cp))
                     break;
-                if (!is_whitespace(*current))
+                if (!is_whitespace(cp))
                     spaceEncountered = 1;
             }
             count++;
@@ -613,7 +775,6 @@ static void calc_wrap(Text * t) {
     }
 }
 
-#undef CHARNONE
 #undef ADDLINE
 
 static unsigned calc_num_quads(Text * t) {
@@ -636,19 +797,42 @@ static unsigned read_hex_digit(const char * c) {
     return 0;
 }
 
-static void fill_buffers(Text * t) {
+static void append_run(Text * t, unsigned page, unsigned first) {
+    if (t->run_count >= t->run_capacity) {
+        t->run_capacity = 2 * t->run_capacity + 1;
+        t->runs = trealloc(MEM_TAG_TEXT, t->runs, t->run_capacity * sizeof(TextRun));
+    }
+    TextRun * run = t->runs + t->run_count++;
+    run->page = page;
+    run->first = first;
+}
+
+// Sets the quad count of each run once the total is known.
+static void close_runs(Text * t, unsigned num_quads) {
+    for (unsigned i = 0; i < t->run_count; i++) {
+        unsigned end = i + 1 < t->run_count ? t->runs[i + 1].first : num_quads;
+        t->runs[i].count = end - t->runs[i].first;
+    }
+}
+
+// Fills the vertex and element buffers. When utf8 is 0 the text is known to be
+// ASCII, and the compiler can drop the decoding and glyph table lookups.
+static inline void fill_buffers_impl(Text * t, const int utf8) {
     float xcurrent = 0;
     float ycurrent = 0;
     unsigned index = 0;
     GLushort * els = t->elementBuffer;
     GLfloat * vs = t->vertexBuffer;
-    float tw = t->fontdef->tex.w;
-    float th = t->fontdef->tex.h;
+    const FontDef * fd = t->fontdef;
+    float tw = fd->scaleW;
+    float th = fd->scaleH;
     float invtw = 1.0f / tw;
     float invth = 1.0f / th;
     float max_width = t->max_width;
     float scale = t->pt / (double) t->fontdef->size;
     float vcolor[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    unsigned page = (unsigned) -1;
+    t->run_count = 0;
     switch (t->valign) {
         case ALIGN_TOP:
             ycurrent = 0.0f;
@@ -708,11 +892,20 @@ static void fill_buffers(Text * t) {
                         break;
                 }
             }
-            FontCharDef * fcd = t->fontdef->chars + c;
-            if (!fcd->valid) {
-                fcd = t->fontdef->chars + ' ';
+            uint32_t cp, nextcp;
+            if (utf8) {
+                j += utf8_decode(t->text + j, &cp) - 1;
+                utf8_decode(t->text + j + 1, &nextcp);
+            } else {
+                cp = (unsigned char) c;
+                nextcp = (unsigned char) t->text[j + 1];
+            }
+            const FontCharDef * fcd = get_glyph(fd, cp);
+            // Start a new run whenever the atlas page changes.
+            if (fcd->page != page) {
+                page = fcd->page;
+                append_run(t, page, index / 4);
             }
-            float kerning = get_kerning(fcd, t->text[j + 1]);
             float x1 = xcurrent + fcd->xoffset * scale;
             float x2 = x1 + fcd->w * scale;
             float y1 = ycurrent + fcd->yoffset * scale;
@@ -753,14 +946,37 @@ static void fill_buffers(Text * t) {
             els += 6;
             index += 4;
             // Move the location of the next character to the right.
-            xcurrent += (fcd->xadvance + kerning) * scale;
+            xcurrent += (fcd->xadvance + kerning_get(fd, cp, nextcp)) * scale;
         }
         // Move the next line down.
         ycurrent += t->fontdef->lineHeight * scale;
     }
+    close_runs(t, index / 4);
+}
+
+static int is_ascii(const char * text, unsigned length) {
+    unsigned char bits = 0;
+    for (unsigned i = 0; i < length; i++)
+        bits |= text[i];
+    return bits < 0x80;
+}
+
+static void fill_buffers(Text * t) {
+    if (is_ascii(t->text, t->text_length))
+        fill_buffers_impl(t, 0);
+    else
+        fill_buffers_impl(t, 1);
+}
+
+static long long text_vram(unsigned num_quads) {
+    return (long long) (sizeof(GLfloat) * CHAR_SIZE + sizeof(GLushort) * 6) * num_quads;
 }
 
 static void text_buffer_data(Text * t) {
+    if (t->num_quads != t->buffer_quads) {
+        memtrack_vram(MEM_TAG_TEXT, text_vram(t->num_quads) - text_vram(t->buffer_quads));
+        t->buffer_quads = t->num_quads;
+    }
     GLenum drawtype = (t->flags & FNTDRAW_TEXT_DYNAMIC_BIT) ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
     glBindBuffer(GL_ARRAY_BUFFER, t->VBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, t->EBO);
@@ -773,6 +989,7 @@ void text_loadbuffer(Text * t) {
         return;
     }
     t->flags |= FNTDRAW_TEXT_LOADED_BIT;
+    t->buffer_quads = 0;
     glGenBuffers(1, &t->VBO);
     glGenBuffers(1, &t->EBO);
     glGenVertexArrays(1, &t->VAO);
@@ -796,6 +1013,8 @@ void text_unloadbuffer(Text * t) {
     glDeleteBuffers(1, &t->VBO);
     glDeleteBuffers(1, &t->EBO);
     glDeleteVertexArrays(1, &t->VAO);
+    memtrack_vram(MEM_TAG_TEXT, -text_vram(t->buffer_quads));
+    t->buffer_quads = 0;
 }
 
 static void update_buffers(Text * t) {
@@ -804,7 +1023,7 @@ static void update_buffers(Text * t) {
         t->quad_capacity = new_num_quads;
         size_t vbuf_size = sizeof(GLfloat) * CHAR_SIZE * new_num_quads;
         size_t ebuf_size = sizeof(GLushort) * 6 * new_num_quads;
-        void * ptr = realloc(t->vertexBuffer, vbuf_size + ebuf_size);
+        void * ptr = trealloc(MEM_TAG_TEXT, t->vertexBuffer, vbuf_size + ebuf_size);
         t->vertexBuffer = (ptr);
         t->elementBuffer = (ptr + vbuf_size);
     }
@@ -819,7 +1038,6 @@ static void bind_shader(const Text * t, const mat4 mvp) {
     if (t->flags & FNTDRAW_TEXT_NODF_BIT) {
         glUseProgram(text_shader_nodf_program.id);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, t->fontdef->tex.id);
         glUniform1i(nodf_shader_tex_loc, 0);
         glUniform4fv(nodf_shader_color_loc, 1, t->color);
         glUniform2fv(nodf_shader_offset_loc, 1, t->position);
@@ -827,7 +1045,6 @@ static void bind_shader(const Text * t, const mat4 mvp) {
     } else {
         glUseProgram(text_shader_program.id);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, t->fontdef->tex.id);
         glUniform1i(shader_tex_loc, 0);
         glUniform4fv(shader_color_loc, 1, t->color);
         glUniform2fv(shader_offset_loc, 1, t->position);
@@ -837,15 +1054,29 @@ static void bind_shader(const Text * t, const mat4 mvp) {
     }
 }
 
+// Draws the quads in [start, end), binding the atlas page of each run.
+static void draw_runs(Text * t, unsigned start, unsigned end) {
+    t->fontdef->drawclock = t->fontdef->pageclock;
+    glBindVertexArray(t->VAO);
+    for (unsigned i = 0; i < t->run_count; i++) {
+        const TextRun * run = t->runs + i;
+        unsigned first = run->first > start ? run->first : start;
+        unsigned last = run->first + run->count < end ? run->first + run->count : end;
+        if (first >= last) continue;
+        glBindTexture(GL_TEXTURE_2D, page_bind(t->fontdef, run->page));
+        glDrawElements(GL_TRIANGLES, (last - first) * 6, GL_UNSIGNED_SHORT, (GLvoid *)(first * 6 * sizeof(GLushort)));
+    }
+    glBindVertexArray(0);
+}
+
 void text_draw(Text * t, const mat4 mvp) {
+    TRACE_SCOPE("text_draw");
     if (t->flags & FNTDRAW_TEXT_NEEDS_BUFFER_UPDATE) {
         calc_wrap(t);
         update_buffers(t);
     }
     bind_shader(t, mvp);
-    glBindVertexArray(t->VAO);
-    glDrawElements(GL_TRIANGLES, t->num_quads * 6, GL_UNSIGNED_SHORT, 0);
-    glBindVertexArray(0);
+    draw_runs(t, 0, t->num_quads);
 }
 
 void text_draw_screen(Text * t) {
@@ -861,9 +1092,7 @@ void text_draw_range(Text * t, const mat4 mvp, unsigned start, unsigned length)
         uerr("Range not renderable.");
     }
     bind_shader(t, mvp);
-    glBindVertexArray(t->VAO);
-    glDrawElements(GL_TRIANGLES, length * 6, GL_UNSIGNED_SHORT, (GLvoid *)(start * 6 * sizeof(GLushort)));
-    glBindVertexArray(0);
+    draw_runs(t, start, start + length);
 }
 
 void text_draw_range_screen(Text * t, unsigned start, unsigned length) {
@@ -889,13 +1118,16 @@ static void text_init_common(Text * t, const TextOptions * options, size_t slen)
     // Get the number of lines and store the line buffer.
     t->lines = NULL;
     t->line_count = 0;
+    t->runs = NULL;
+    t->run_count = 0;
+    t->run_capacity = 0;
     calc_wrap(t);
     // Calculate how many quads need to be drawn.
     t->num_quads = calc_num_quads(t);
     // Allocate vertex buffers
     size_t vbuf_size = sizeof(GLfloat) * CHAR_SIZE * t->num_quads;
     size_t ebuf_size = sizeof(GLushort) * 6 * t->num_quads;
-    void * ptr = malloc(vbuf_size + ebuf_size);
+    void * ptr = tmalloc(MEM_TAG_TEXT, vbuf_size + ebuf_size);
     t->vertexBuffer = (ptr);
     t->elementBuffer = (ptr + vbuf_size);
     t->quad_capacity = t->num_quads;
@@ -906,7 +1138,7 @@ static void text_init_common(Text * t, const TextOptions * options, size_t slen)
 Text * text_init(Text * t, const TextOptions * options, const char * text) {
     size_t slen = strlen(text);
     // Allocate text buffer
-    t->text = malloc(slen + 1);
+    t->text = tmalloc(MEM_TAG_TEXT, slen + 1);
     t->text_capacity = slen;
     t->text_length = slen;
     memcpy(t->text, text, slen + 1);
@@ -925,7 +1157,7 @@ Text * text_init_nocopy(Text * t, const TextOptions * options, char * text) {
 
 Text * text_initn(Text * t, const TextOptions * options, const char * text, size_t len) {
     // Allocate text buffer
-    t->text = malloc(len + 1);
+    t->text = tmalloc(MEM_TAG_TEXT, len + 1);
     t->text_capacity = len;
     t->text_length = len;
     memcpy(t->text, text, len);
@@ -936,9 +1168,10 @@ Text * text_initn(Text * t, const TextOptions * options, const char * text, size
 
 void text_deinit(Text * t) {
     text_unloadbuffer(t);
-    free(t->text);
-    free(t->vertexBuffer);
-    free(t->lines);
+    tfree(t->text);
+    tfree(t->vertexBuffer);
+    tfree(t->lines);
+    tfree(t->runs);
 }
 
 void text_set(Text * t, const char * newtext) {
@@ -946,7 +1179,7 @@ void text_set(Text * t, const char * newtext) {
     t->text_length = slen;
     if (slen > t->text_capacity) {
         t->text_capacity = slen;
-        t->text = realloc(t->text, slen + 1);
+        t->text = trealloc(MEM_TAG_TEXT, t->text, slen + 1);
     }
     strcpy(t->text, newtext);
     t->flags |= FNTDRAW_TEXT_NEEDS_BUFFER_UPDATE;
@@ -958,7 +1191,7 @@ void text_setn(Text * t, const char * string, size_t len) {
     t->text_length = len;
     if (len > t->text_capacity) {
         t->text_capacity = len;
-        t->text = realloc(t->text, len + 1);
+        t->text = trealloc(MEM_TAG_TEXT, t->text, len + 1);
     }
     memcpy(t->text, string, len);
     t->text[len] = '\0';
@@ -5,6 +5,7 @@
 #include "texture.h"
 #include "ldmath.h"
 #include <stdarg.h>
+#include <stdint.h>
 
 typedef struct {
     unsigned char valid;
@@ -15,20 +16,62 @@ typedef struct {
     float xoffset;
     float yoffset;
     float xadvance;
-    struct {
-        unsigned count;
-        unsigned capacity;
-        void * data;
-    } kerning;
+    unsigned page;
 } FontCharDef;
 
+// One bucket of the glyph hash table for codepoints above 255. A bucket with codepoint == 0 is empty.
+typedef struct {
+    uint32_t codepoint;
+    FontCharDef def;
+} FontGlyph;
+
+// One bucket of the kerning hash table. A bucket with first == 0 is empty.
+typedef struct {
+    uint32_t first;
+    uint32_t second;
+    float amount;
+} FontKerning;
+
+// A page of the glyph atlas. Page textures are loaded on first use, and the least
+// recently used pages are unloaded when a font goes over its page budget. Pages
+// bound by the draw in progress are never unloaded, so a text that needs more
+// pages than the budget holds goes over it instead of reloading pages per run.
+typedef struct {
+    char * file;
+    Texture tex;
+    int loaded;
+    unsigned long lastuse;
+} FontPage;
+
+#define FNTDRAW_DEFAULT_PAGE_BUDGET (32 * 1024 * 1024)
+
 typedef struct {
     unsigned size;
     float lineHeight;
     float base;
-    Texture tex;
+    unsigned scaleW;
+    unsigned scaleH;
     unsigned charcount;
+    // Codepoints 0 - 255, indexed directly.
     FontCharDef * chars;
+    // Advance of each character, with invalid characters resolved to a space.
+    float advances[256];
+    // Open addressing hash table of all other codepoints.
+    unsigned glyphcount;
+    unsigned glyphmask;
+    FontGlyph * glyphs;
+    // Open addressing hash table keyed on (first, second) codepoint pairs.
+    unsigned kerningcount;
+    unsigned kerningmask;
+    FontKerning * kernings;
+    // Atlas pages
+    unsigned pagecount;
+    FontPage * pages;
+    size_t pagebytes;
+    size_t pagebudget;
+    unsigned long pageclock;
+    unsigned long drawclock; // Pages used after this are in the current draw
+    int pagewarned;
 } FontDef;
 
 #define FNTDRAW_ESCAPE '$'
@@ -53,6 +96,13 @@ typedef struct {
     float width;
 } TextLine;
 
+// A range of quads that are drawn from the same atlas page.
+typedef struct {
+    unsigned page;
+    unsigned first;
+    unsigned count;
+} TextRun;
+
 typedef struct {
     FontDef * font;
     float pt;
@@ -76,7 +126,7 @@ typedef struct {
     unsigned text_length;
     unsigned text_capacity;
     // Rendering
-    const FontDef * fontdef;
+    FontDef * fontdef;
     GLuint VBO; // Vertex Buffer Object for position and texture coordinate data
     GLuint EBO;
     GLuint VAO;
@@ -84,6 +134,10 @@ typedef struct {
     GLfloat * vertexBuffer;
     unsigned num_quads;
     unsigned quad_capacity;
+    unsigned buffer_quads; // Quads in the GL buffers, for the VRAM estimate
+    unsigned run_count;
+    unsigned run_capacity;
+    TextRun * runs;
     float smoothing;
     float threshold;
     float color[4];
@@ -102,12 +156,16 @@ FontDef * fnt_init(FontDef * fd, const char * resource);
 
 void fnt_deinit(FontDef * fd);
 
+// Sets the number of bytes of atlas pages a font may keep loaded.
+void fnt_set_page_budget(FontDef * fd, size_t bytes);
+
 TextOptions * fnt_default_options(FontDef * fd, TextOptions * out);
 
 Text * text_init(Text * t, const TextOptions * options, const char * text);
 
 Text * text_initn(Text * t, const TextOptions * options, const char * string, size_t len);
 
+// The text is owned by t afterwards and must come from tmalloc(MEM_TAG_TEXT, ...).
 Text * text_init_nocopy(Text * t, const TextOptions * options, char * text);
 
 void text_set(Text * t, const char * newtext);
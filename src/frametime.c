@@ -0,0 +1,188 @@
+#include "frametime.h"
+#include "console.h"
+#include "arena.h"
+#include "memtrack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Histogram buckets are in microseconds. Values under 128 get a bucket each;
+// above that every power of two is split into 64 buckets, in the style of
+// HdrHistogram. That covers up to 2^32 microseconds with 1.6% resolution.
+#define FRAMETIME_LINEAR 128
+#define FRAMETIME_SUB 64
+#define FRAMETIME_BUCKETS (FRAMETIME_LINEAR + 25 * FRAMETIME_SUB)
+
+typedef struct {
+    uint32_t counts[FRAMETIME_BUCKETS];
+    unsigned long count;
+    double total;
+    double max;
+} FrameTimeHistogram;
+
+static struct {
+    FrameTimeSample ring[FRAMETIME_RING];
+    unsigned long head;
+    FrameTimeHistogram histograms[FRAMETIME_PHASES];
+    // Every sample, when dumping to CSV.
+    char * csv_path;
+    FrameTimeSample * all;
+    unsigned long all_count;
+    unsigned long all_capacity;
+} frametime;
+
+static const char * frametime_names[FRAMETIME_PHASES] = {
+    "frame", "swap", "events", "update", "draw", "gc"
+};
+
+static unsigned frametime_bucket(double msec) {
+    double usec = msec * 1000;
+    if (usec < 0)
+        usec = 0;
+    if (usec >= 4294967295.0)
+        usec = 4294967295.0;
+    uint32_t v = (uint32_t) usec;
+    if (v < FRAMETIME_LINEAR)
+        return v;
+    int shift = 31 - __builtin_clz(v) - 6;
+    return FRAMETIME_LINEAR + (shift - 1) * FRAMETIME_SUB + (v >> shift) - FRAMETIME_SUB;
+}
+
+// The highest value that lands in a bucket, in milliseconds.
+static double frametime_bucket_msec(unsigned bucket) {
+    if (bucket < FRAMETIME_LINEAR)
+        return (bucket + 1) / 1000.0;
+    unsigned shift = (bucket - FRAMETIME_LINEAR) / FRAMETIME_SUB + 1;
+    uint64_t sub = (bucket - FRAMETIME_LINEAR) % FRAMETIME_SUB + FRAMETIME_SUB;
+    return ((sub + 1) << shift) / 1000.0;
+}
+
+static double frametime_percentile(const FrameTimeHistogram * h, double p) {
+    if (!h->count)
+        return 0;
+    unsigned long rank = (unsigned long) (p * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    unsigned long seen = 0;
+    for (unsigned i = 0; i < FRAMETIME_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            double v = frametime_bucket_msec(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void frametime_init(const char * csv_path) {
+    memset(&frametime, 0, sizeof(frametime));
+    if (csv_path)
+        frametime.csv_path = tstrdup(MEM_TAG_TOOLS, csv_path);
+}
+
+static void frametime_write_csv() {
+    FILE * f = fopen(frametime.csv_path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write frame times to %s\n", frametime.csv_path);
+        return;
+    }
+    fprintf(f, "frame");
+    for (int p = 0; p < FRAMETIME_PHASES; p++)
+        fprintf(f, ",%s_ms", frametime_names[p]);
+    fprintf(f, "\n");
+    for (unsigned long i = 0; i < frametime.all_count; i++) {
+        const FrameTimeSample * s = frametime.all + i;
+        fprintf(f, "%lu", s->frame);
+        for (int p = 0; p < FRAMETIME_PHASES; p++)
+            fprintf(f, ",%.4f", s->msec[p]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+}
+
+void frametime_deinit() {
+    if (frametime.csv_path)
+        frametime_write_csv();
+    tfree(frametime.csv_path);
+    tfree(frametime.all);
+    memset(&frametime, 0, sizeof(frametime));
+}
+
+void frametime_record(const double seconds[FRAMETIME_PHASES]) {
+    unsigned long head = frametime.head;
+    // Keeps the slot writes below from becoming visible before the last frame's
+    // head store, which frametime_recent relies on to see which slot is busy.
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    FrameTimeSample * s = frametime.ring + head % FRAMETIME_RING;
+    s->frame = head;
+    for (int p = 0; p < FRAMETIME_PHASES; p++) {
+        double msec = seconds[p] * 1000;
+        FrameTimeHistogram * h = frametime.histograms + p;
+        h->counts[frametime_bucket(msec)]++;
+        h->count++;
+        h->total += msec;
+        if (msec > h->max)
+            h->max = msec;
+        s->msec[p] = msec;
+    }
+    if (frametime.csv_path) {
+        if (frametime.all_count == frametime.all_capacity) {
+            frametime.all_capacity = frametime.all_capacity * 2 + 1024;
+            frametime.all = trealloc(MEM_TAG_TOOLS, frametime.all, frametime.all_capacity * sizeof(FrameTimeSample));
+        }
+        frametime.all[frametime.all_count++] = *s;
+    }
+    __atomic_store_n(&frametime.head, head + 1, __ATOMIC_RELEASE);
+}
+
+void frametime_stats(int phase, FrameTimeStats * stats) {
+    const FrameTimeHistogram * h = frametime.histograms + phase;
+    stats->count = h->count;
+    stats->mean = h->count ? h->total / h->count : 0;
+    stats->p50 = frametime_percentile(h, 0.50);
+    stats->p95 = frametime_percentile(h, 0.95);
+    stats->p99 = frametime_percentile(h, 0.99);
+    stats->max = h->max;
+}
+
+void frametime_reset() {
+    memset(frametime.histograms, 0, sizeof(frametime.histograms));
+}
+
+unsigned frametime_recent(FrameTimeSample * out, unsigned max) {
+    unsigned long head = __atomic_load_n(&frametime.head, __ATOMIC_ACQUIRE);
+    unsigned long n = head < max ? head : max;
+    if (n > FRAMETIME_RING)
+        n = FRAMETIME_RING;
+    unsigned long first = head - n;
+    for (unsigned long i = 0; i < n; i++)
+        out[i] = frametime.ring[(first + i) % FRAMETIME_RING];
+    // The writer may have lapped us while copying; drop the slots it reached.
+    // The fence keeps the copies above from being read after the head is.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    unsigned long now = __atomic_load_n(&frametime.head, __ATOMIC_RELAXED);
+    unsigned long lost = now + 1 > first + FRAMETIME_RING ? now + 1 - first - FRAMETIME_RING : 0;
+    if (lost >= n)
+        return 0;
+    memmove(out, out + lost, (n - lost) * sizeof(FrameTimeSample));
+    return n - lost;
+}
+
+const char * frametime_phase_name(int phase) {
+    return frametime_names[phase];
+}
+
+void frametime_log() {
+    console_log("phase     p50 ms   p95 ms   p99 ms   max ms  (%lu frames)",
+            frametime.histograms[FRAMETIME_FRAME].count);
+    for (int p = 0; p < FRAMETIME_PHASES; p++) {
+        FrameTimeStats s;
+        frametime_stats(p, &s);
+        console_log("%-8s %7.2f  %7.2f  %7.2f  %7.2f", frametime_names[p], s.p50, s.p95, s.p99, s.max);
+    }
+    ArenaStats a;
+    arena_stats(&a);
+    console_log("scratch  %.1f KB last frame, %.1f KB peak, %.1f KB reserved",
+            a.frame / 1024.0, a.peak / 1024.0, a.reserved / 1024.0);
+}
@@ -0,0 +1,55 @@
+#ifndef FRAMETIME_H_K2W9PDQM
+#define FRAMETIME_H_K2W9PDQM
+
+// Per frame timing. Each frame's phases go into a ring of recent samples and a
+// log-linear histogram per phase, so percentiles cover the whole run at under
+// 2% error. Optionally every sample is kept for a CSV dump on exit.
+
+#define FRAMETIME_FRAME 0 // From one frame's start to the next
+#define FRAMETIME_SWAP 1
+#define FRAMETIME_EVENTS 2 // Polling and dispatching input
+#define FRAMETIME_UPDATE 3
+#define FRAMETIME_DRAW 4
+#define FRAMETIME_GC 5
+#define FRAMETIME_PHASES 6
+
+#define FRAMETIME_RING 4096
+
+typedef struct {
+    unsigned long frame;
+    float msec[FRAMETIME_PHASES];
+} FrameTimeSample;
+
+typedef struct {
+    unsigned long count;
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+} FrameTimeStats;
+
+// If csv_path is not NULL, every sample is kept and written there by
+// frametime_deinit.
+void frametime_init(const char * csv_path);
+
+void frametime_deinit();
+
+// Records one frame. Times are in seconds. Call from the main thread only.
+void frametime_record(const double seconds[FRAMETIME_PHASES]);
+
+// Statistics in milliseconds since the last reset.
+void frametime_stats(int phase, FrameTimeStats * stats);
+
+void frametime_reset();
+
+// Copies up to max of the most recent samples, oldest first, and returns how
+// many were copied. Safe to call from any thread.
+unsigned frametime_recent(FrameTimeSample * out, unsigned max);
+
+const char * frametime_phase_name(int phase);
+
+// Writes a summary of every phase to the console.
+void frametime_log();
+
+#endif /* end of include guard: FRAMETIME_H_K2W9PDQM */
@@ -0,0 +1,522 @@
+#include "glstats.h"
+#include "console.h"
+#include "fntdraw.h"
+#include "platform.h"
+#include "quickdraw.h"
+#include <glad/glad.h>
+#include <stdio.h>
+#include <string.h>
+
+#define GLSTATS_OVERLAY_WIDTH 240
+#define GLSTATS_OVERLAY_BORDER 5
+#define GLSTATS_OVERLAY_TOP_FUNCTIONS 6
+#define GLSTATS_OVERLAY_FONT "consolefont.txt"
+
+static struct {
+    GLFrameStats current;
+    GLFrameStats last;
+    int paused;
+    int overlay;
+    int overlay_loaded;
+    FontDef overlay_font;
+    Text overlay_text;
+} glstats;
+
+#ifdef LDOOMC_GLSTATS
+
+#define GLSTATS_CALL 0
+#define GLSTATS_DRAW 1
+#define GLSTATS_STATE 2
+
+// Every counted entry point. V wraps a void function and R one with a return
+// value. H entries have hand written wrappers below, because they track
+// bindings or uploads.
+#define GLSTATS_FUNCTIONS(V, R, H) \
+    V(GLSTATS_CALL, AttachShader, (GLuint program, GLuint shader), (program, shader)) \
+    V(GLSTATS_CALL, Clear, (GLbitfield mask), (mask)) \
+    V(GLSTATS_CALL, CompileShader, (GLuint shader), (shader)) \
+    R(GLSTATS_CALL, GLuint, CreateProgram, (), ()) \
+    R(GLSTATS_CALL, GLuint, CreateShader, (GLenum type), (type)) \
+    V(GLSTATS_CALL, DeleteProgram, (GLuint program), (program)) \
+    V(GLSTATS_CALL, DeleteQueries, (GLsizei n, const GLuint * ids), (n, ids)) \
+    V(GLSTATS_CALL, DeleteShader, (GLuint shader), (shader)) \
+    V(GLSTATS_CALL, DetachShader, (GLuint program, GLuint shader), (program, shader)) \
+    V(GLSTATS_CALL, Finish, (), ()) \
+    V(GLSTATS_CALL, Flush, (), ()) \
+    V(GLSTATS_CALL, GenBuffers, (GLsizei n, GLuint * buffers), (n, buffers)) \
+    V(GLSTATS_CALL, GenFramebuffers, (GLsizei n, GLuint * framebuffers), (n, framebuffers)) \
+    V(GLSTATS_CALL, GenQueries, (GLsizei n, GLuint * ids), (n, ids)) \
+    V(GLSTATS_CALL, GenTextures, (GLsizei n, GLuint * textures), (n, textures)) \
+    V(GLSTATS_CALL, GenVertexArrays, (GLsizei n, GLuint * arrays), (n, arrays)) \
+    V(GLSTATS_CALL, GenerateMipmap, (GLenum target), (target)) \
+    R(GLSTATS_CALL, GLenum, GetError, (), ()) \
+    V(GLSTATS_CALL, GetInteger64v, (GLenum pname, GLint64 * data), (pname, data)) \
+    V(GLSTATS_CALL, GetIntegerv, (GLenum pname, GLint * data), (pname, data)) \
+    V(GLSTATS_CALL, GetProgramInfoLog, (GLuint program, GLsizei size, GLsizei * length, GLchar * log), (program, size, length, log)) \
+    V(GLSTATS_CALL, GetProgramiv, (GLuint program, GLenum pname, GLint * params), (program, pname, params)) \
+    V(GLSTATS_CALL, GetQueryObjectiv, (GLuint id, GLenum pname, GLint * params), (id, pname, params)) \
+    V(GLSTATS_CALL, GetQueryObjectui64v, (GLuint id, GLenum pname, GLuint64 * params), (id, pname, params)) \
+    V(GLSTATS_CALL, GetShaderInfoLog, (GLuint shader, GLsizei size, GLsizei * length, GLchar * log), (shader, size, length, log)) \
+    V(GLSTATS_CALL, GetShaderiv, (GLuint shader, GLenum pname, GLint * params), (shader, pname, params)) \
+    R(GLSTATS_CALL, const GLubyte *, GetString, (GLenum name), (name)) \
+    R(GLSTATS_CALL, GLint, GetUniformLocation, (GLuint program, const GLchar * name), (program, name)) \
+    V(GLSTATS_CALL, LinkProgram, (GLuint program), (program)) \
+    V(GLSTATS_CALL, QueryCounter, (GLuint id, GLenum target), (id, target)) \
+    V(GLSTATS_CALL, ReadPixels, (GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, void * pixels), (x, y, w, h, format, type, pixels)) \
+    V(GLSTATS_CALL, ShaderSource, (GLuint shader, GLsizei count, const GLchar * const * string, const GLint * length), (shader, count, string, length)) \
+    V(GLSTATS_DRAW, DrawArrays, (GLenum mode, GLint first, GLsizei count), (mode, first, count)) \
+    V(GLSTATS_DRAW, DrawArraysInstanced, (GLenum mode, GLint first, GLsizei count, GLsizei instances), (mode, first, count, instances)) \
+    V(GLSTATS_DRAW, DrawElements, (GLenum mode, GLsizei count, GLenum type, const void * indices), (mode, count, type, indices)) \
+    V(GLSTATS_DRAW, DrawElementsInstanced, (GLenum mode, GLsizei count, GLenum type, const void * indices, GLsizei instances), (mode, count, type, indices, instances)) \
+    V(GLSTATS_STATE, BlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor)) \
+    V(GLSTATS_STATE, ClearColor, (GLfloat r, GLfloat g, GLfloat b, GLfloat a), (r, g, b, a)) \
+    V(GLSTATS_STATE, CullFace, (GLenum mode), (mode)) \
+    V(GLSTATS_STATE, DepthFunc, (GLenum func), (func)) \
+    V(GLSTATS_STATE, DepthMask, (GLboolean flag), (flag)) \
+    V(GLSTATS_STATE, Disable, (GLenum cap), (cap)) \
+    V(GLSTATS_STATE, DisableVertexAttribArray, (GLuint index), (index)) \
+    V(GLSTATS_STATE, Enable, (GLenum cap), (cap)) \
+    V(GLSTATS_STATE, EnableVertexAttribArray, (GLuint index), (index)) \
+    V(GLSTATS_STATE, PixelStorei, (GLenum pname, GLint param), (pname, param)) \
+    V(GLSTATS_STATE, Scissor, (GLint x, GLint y, GLsizei w, GLsizei h), (x, y, w, h)) \
+    V(GLSTATS_STATE, TexParameterf, (GLenum target, GLenum pname, GLfloat param), (target, pname, param)) \
+    V(GLSTATS_STATE, TexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param)) \
+    V(GLSTATS_STATE, Uniform1f, (GLint location, GLfloat v0), (location, v0)) \
+    V(GLSTATS_STATE, Uniform1i, (GLint location, GLint v0), (location, v0)) \
+    V(GLSTATS_STATE, Uniform2fv, (GLint location, GLsizei count, const GLfloat * value), (location, count, value)) \
+    V(GLSTATS_STATE, Uniform3fv, (GLint location, GLsizei count, const GLfloat * value), (location, count, value)) \
+    V(GLSTATS_STATE, Uniform4fv, (GLint location, GLsizei count, const GLfloat * value), (location, count, value)) \
+    V(GLSTATS_STATE, UniformMatrix3fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat * value), (location, count, transpose, value)) \
+    V(GLSTATS_STATE, UniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat * value), (location, count, transpose, value)) \
+    V(GLSTATS_STATE, VertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void * pointer), (index, size, type, normalized, stride, pointer)) \
+    V(GLSTATS_STATE, Viewport, (GLint x, GLint y, GLsizei w, GLsizei h), (x, y, w, h)) \
+    H(ActiveTexture) \
+    H(BindBuffer) \
+    H(BindFramebuffer) \
+    H(BindTexture) \
+    H(BindVertexArray) \
+    H(BufferData) \
+    H(BufferSubData) \
+    H(DeleteBuffers) \
+    H(DeleteFramebuffers) \
+    H(DeleteTextures) \
+    H(DeleteVertexArrays) \
+    H(TexImage2D) \
+    H(TexSubImage2D) \
+    H(UseProgram)
+
+#define GLSTATS_ENUM_V(kind, name, params, args) GLSTATS_FN_##name,
+#define GLSTATS_ENUM_R(kind, type, name, params, args) GLSTATS_FN_##name,
+#define GLSTATS_ENUM_H(name) GLSTATS_FN_##name,
+enum {
+    GLSTATS_FUNCTIONS(GLSTATS_ENUM_V, GLSTATS_ENUM_R, GLSTATS_ENUM_H)
+    GLSTATS_FN_COUNT
+};
+
+_Static_assert(GLSTATS_FN_COUNT <= GLSTATS_MAX_FUNCTIONS, "Raise GLSTATS_MAX_FUNCTIONS");
+
+#define GLSTATS_NAME_V(kind, name, params, args) "gl" #name,
+#define GLSTATS_NAME_R(kind, type, name, params, args) "gl" #name,
+#define GLSTATS_NAME_H(name) "gl" #name,
+static const char * glstats_names[] = {
+    GLSTATS_FUNCTIONS(GLSTATS_NAME_V, GLSTATS_NAME_R, GLSTATS_NAME_H)
+};
+
+// The loader's pointers, called by the wrappers.
+#define GLSTATS_REAL_V(kind, name, params, args) static __typeof__(glad_gl##name) glstats_real_##name;
+#define GLSTATS_REAL_R(kind, type, name, params, args) static __typeof__(glad_gl##name) glstats_real_##name;
+#define GLSTATS_REAL_H(name) static __typeof__(glad_gl##name) glstats_real_##name;
+GLSTATS_FUNCTIONS(GLSTATS_REAL_V, GLSTATS_REAL_R, GLSTATS_REAL_H)
+
+static inline void glstats_count(int fn, int kind) {
+    if (glstats.paused)
+        return;
+    glstats.current.calls++;
+    glstats.current.function_calls[fn]++;
+    if (kind == GLSTATS_DRAW)
+        glstats.current.draws++;
+    else if (kind == GLSTATS_STATE)
+        glstats.current.state_changes++;
+}
+
+#define GLSTATS_WRAP_V(kind, name, params, args) \
+    static void APIENTRY glstats_##name params { \
+        glstats_count(GLSTATS_FN_##name, kind); \
+        glstats_real_##name args; \
+    }
+#define GLSTATS_WRAP_R(kind, type, name, params, args) \
+    static type APIENTRY glstats_##name params { \
+        glstats_count(GLSTATS_FN_##name, kind); \
+        return glstats_real_##name args; \
+    }
+#define GLSTATS_WRAP_H(name)
+GLSTATS_FUNCTIONS(GLSTATS_WRAP_V, GLSTATS_WRAP_R, GLSTATS_WRAP_H)
+
+// Bindings as last set through the wrappers. GLSTATS_UNKNOWN never matches,
+// so the first bind of anything is not called redundant.
+
+#define GLSTATS_UNKNOWN 0xFFFFFFFFu
+#define GLSTATS_TEXTURE_UNITS 32
+
+enum { GLSTATS_BUFFER_ARRAY, GLSTATS_BUFFER_ELEMENT, GLSTATS_BUFFER_UNIFORM, GLSTATS_BUFFER_TARGETS };
+enum { GLSTATS_TEXTURE_2D, GLSTATS_TEXTURE_CUBE, GLSTATS_TEXTURE_TARGETS };
+
+static struct {
+    GLuint buffers[GLSTATS_BUFFER_TARGETS];
+    GLuint textures[GLSTATS_TEXTURE_UNITS][GLSTATS_TEXTURE_TARGETS];
+    GLuint unit;
+    GLuint vertex_array;
+    GLuint program;
+    GLuint framebuffer;
+} glstats_bound;
+
+static void glstats_forget_bindings() {
+    memset(&glstats_bound, 0xFF, sizeof(glstats_bound));
+    glstats_bound.unit = 0;
+}
+
+// Counts a bind as a state change, or as redundant if the object is already
+// bound. slot may be NULL for targets that aren't tracked.
+static int glstats_bind(int fn, GLuint * slot, GLuint object) {
+    if (glstats.paused)
+        return 0;
+    glstats.current.calls++;
+    glstats.current.function_calls[fn]++;
+    if (slot && *slot == object) {
+        glstats.current.redundant_binds++;
+        return 1;
+    }
+    glstats.current.state_changes++;
+    return 0;
+}
+
+static void glstats_track(GLuint * slot, GLuint object) {
+    if (slot)
+        *slot = object;
+}
+
+static void glstats_upload(int fn, size_t bytes) {
+    glstats_count(fn, GLSTATS_CALL);
+    if (!glstats.paused)
+        glstats.current.upload_bytes += bytes;
+}
+
+static GLuint * glstats_buffer_slot(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER: return glstats_bound.buffers + GLSTATS_BUFFER_ARRAY;
+        case GL_ELEMENT_ARRAY_BUFFER: return glstats_bound.buffers + GLSTATS_BUFFER_ELEMENT;
+        case GL_UNIFORM_BUFFER: return glstats_bound.buffers + GLSTATS_BUFFER_UNIFORM;
+        default: return NULL;
+    }
+}
+
+static GLuint * glstats_texture_slot(GLenum target) {
+    if (glstats_bound.unit >= GLSTATS_TEXTURE_UNITS)
+        return NULL;
+    switch (target) {
+        case GL_TEXTURE_2D: return glstats_bound.textures[glstats_bound.unit] + GLSTATS_TEXTURE_2D;
+        case GL_TEXTURE_CUBE_MAP: return glstats_bound.textures[glstats_bound.unit] + GLSTATS_TEXTURE_CUBE;
+        default: return NULL;
+    }
+}
+
+static void APIENTRY glstats_ActiveTexture(GLenum texture) {
+    glstats_bind(GLSTATS_FN_ActiveTexture, &glstats_bound.unit, texture - GL_TEXTURE0);
+    glstats_bound.unit = texture - GL_TEXTURE0;
+    glstats_real_ActiveTexture(texture);
+}
+
+static void APIENTRY glstats_BindBuffer(GLenum target, GLuint buffer) {
+    GLuint * slot = glstats_buffer_slot(target);
+    glstats_bind(GLSTATS_FN_BindBuffer, slot, buffer);
+    glstats_track(slot, buffer);
+    glstats_real_BindBuffer(target, buffer);
+}
+
+static void APIENTRY glstats_BindFramebuffer(GLenum target, GLuint framebuffer) {
+    GLuint * slot = target == GL_FRAMEBUFFER ? &glstats_bound.framebuffer : NULL;
+    glstats_bind(GLSTATS_FN_BindFramebuffer, slot, framebuffer);
+    glstats_track(slot, framebuffer);
+    glstats_real_BindFramebuffer(target, framebuffer);
+}
+
+static void APIENTRY glstats_BindTexture(GLenum target, GLuint texture) {
+    GLuint * slot = glstats_texture_slot(target);
+    glstats_bind(GLSTATS_FN_BindTexture, slot, texture);
+    glstats_track(slot, texture);
+    glstats_real_BindTexture(target, texture);
+}
+
+static void APIENTRY glstats_BindVertexArray(GLuint array) {
+    if (!glstats_bind(GLSTATS_FN_BindVertexArray, &glstats_bound.vertex_array, array)) {
+        // The element buffer binding belongs to the vertex array.
+        glstats_bound.buffers[GLSTATS_BUFFER_ELEMENT] = GLSTATS_UNKNOWN;
+    }
+    glstats_bound.vertex_array = array;
+    glstats_real_BindVertexArray(array);
+}
+
+static void APIENTRY glstats_UseProgram(GLuint program) {
+    glstats_bind(GLSTATS_FN_UseProgram, &glstats_bound.program, program);
+    glstats_bound.program = program;
+    glstats_real_UseProgram(program);
+}
+
+// Deleting a bound object unbinds it, and its name may come back from the
+// next Gen call, so forget it.
+static void glstats_forget(GLuint * slots, unsigned count, GLsizei n, const GLuint * objects) {
+    for (GLsizei i = 0; i < n; i++)
+        for (unsigned j = 0; j < count; j++)
+            if (objects[i] && slots[j] == objects[i])
+                slots[j] = 0;
+}
+
+static void APIENTRY glstats_DeleteBuffers(GLsizei n, const GLuint * buffers) {
+    glstats_count(GLSTATS_FN_DeleteBuffers, GLSTATS_CALL);
+    glstats_forget(glstats_bound.buffers, GLSTATS_BUFFER_TARGETS, n, buffers);
+    glstats_real_DeleteBuffers(n, buffers);
+}
+
+static void APIENTRY glstats_DeleteFramebuffers(GLsizei n, const GLuint * framebuffers) {
+    glstats_count(GLSTATS_FN_DeleteFramebuffers, GLSTATS_CALL);
+    glstats_forget(&glstats_bound.framebuffer, 1, n, framebuffers);
+    glstats_real_DeleteFramebuffers(n, framebuffers);
+}
+
+static void APIENTRY glstats_DeleteTextures(GLsizei n, const GLuint * textures) {
+    glstats_count(GLSTATS_FN_DeleteTextures, GLSTATS_CALL);
+    glstats_forget(glstats_bound.textures[0], GLSTATS_TEXTURE_UNITS * GLSTATS_TEXTURE_TARGETS, n, textures);
+    glstats_real_DeleteTextures(n, textures);
+}
+
+static void APIENTRY glstats_DeleteVertexArrays(GLsizei n, const GLuint * arrays) {
+    glstats_count(GLSTATS_FN_DeleteVertexArrays, GLSTATS_CALL);
+    for (GLsizei i = 0; i < n; i++) {
+        if (arrays[i] && arrays[i] == glstats_bound.vertex_array) {
+            glstats_bound.vertex_array = 0;
+            glstats_bound.buffers[GLSTATS_BUFFER_ELEMENT] = GLSTATS_UNKNOWN;
+        }
+    }
+    glstats_real_DeleteVertexArrays(n, arrays);
+}
+
+static void APIENTRY glstats_BufferData(GLenum target, GLsizeiptr size, const void * data, GLenum usage) {
+    glstats_upload(GLSTATS_FN_BufferData, data ? size : 0);
+    glstats_real_BufferData(target, size, data, usage);
+}
+
+static void APIENTRY glstats_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void * data) {
+    glstats_upload(GLSTATS_FN_BufferSubData, size);
+    glstats_real_BufferSubData(target, offset, size, data);
+}
+
+// Bytes per pixel of client pixel data, ignoring row alignment.
+static size_t glstats_pixel_size(GLenum format, GLenum type) {
+    switch (type) {
+        case GL_UNSIGNED_BYTE_3_3_2:
+        case GL_UNSIGNED_BYTE_2_3_3_REV:
+            return 1;
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_5_6_5_REV:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+        case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+            return 2;
+        case GL_UNSIGNED_INT_8_8_8_8:
+        case GL_UNSIGNED_INT_8_8_8_8_REV:
+        case GL_UNSIGNED_INT_10_10_10_2:
+        case GL_UNSIGNED_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_24_8:
+        case GL_UNSIGNED_INT_10F_11F_11F_REV:
+        case GL_UNSIGNED_INT_5_9_9_9_REV:
+            return 4;
+        default:
+            break;
+    }
+    size_t components;
+    switch (format) {
+        case GL_RED: case GL_GREEN: case GL_BLUE: case GL_RED_INTEGER:
+        case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX:
+            components = 1;
+            break;
+        case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL:
+            components = 2;
+            break;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: case GL_BGR_INTEGER:
+            components = 3;
+            break;
+        default:
+            components = 4;
+            break;
+    }
+    switch (type) {
+        case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT:
+            return 2 * components;
+        case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT:
+            return 4 * components;
+        default:
+            return components;
+    }
+}
+
+static void APIENTRY glstats_TexImage2D(GLenum target, GLint level, GLint internalformat,
+        GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void * pixels) {
+    size_t bytes = pixels ? (size_t) width * height * glstats_pixel_size(format, type) : 0;
+    glstats_upload(GLSTATS_FN_TexImage2D, bytes);
+    glstats_real_TexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+static void APIENTRY glstats_TexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+        GLsizei width, GLsizei height, GLenum format, GLenum type, const void * pixels) {
+    glstats_upload(GLSTATS_FN_TexSubImage2D, (size_t) width * height * glstats_pixel_size(format, type));
+    glstats_real_TexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
+#define GLSTATS_INSTALL_V(kind, name, params, args) GLSTATS_INSTALL_H(name)
+#define GLSTATS_INSTALL_R(kind, type, name, params, args) GLSTATS_INSTALL_H(name)
+#define GLSTATS_INSTALL_H(name) \
+    glstats_real_##name = glad_gl##name; \
+    if (glad_gl##name) glad_gl##name = glstats_##name;
+
+#define GLSTATS_RESTORE_V(kind, name, params, args) GLSTATS_RESTORE_H(name)
+#define GLSTATS_RESTORE_R(kind, type, name, params, args) GLSTATS_RESTORE_H(name)
+#define GLSTATS_RESTORE_H(name) glad_gl##name = glstats_real_##name;
+
+void glstats_init() {
+    memset(&glstats.current, 0, sizeof(glstats.current));
+    memset(&glstats.last, 0, sizeof(glstats.last));
+    glstats_forget_bindings();
+    GLSTATS_FUNCTIONS(GLSTATS_INSTALL_V, GLSTATS_INSTALL_R, GLSTATS_INSTALL_H)
+}
+
+static void glstats_restore() {
+    GLSTATS_FUNCTIONS(GLSTATS_RESTORE_V, GLSTATS_RESTORE_R, GLSTATS_RESTORE_H)
+}
+
+int glstats_enabled() {
+    return 1;
+}
+
+unsigned glstats_function_count() {
+    return GLSTATS_FN_COUNT;
+}
+
+const char * glstats_function_name(unsigned i) {
+    return i < GLSTATS_FN_COUNT ? glstats_names[i] : NULL;
+}
+
+#else
+
+void glstats_init() {
+}
+
+static void glstats_restore() {
+}
+
+int glstats_enabled() {
+    return 0;
+}
+
+unsigned glstats_function_count() {
+    return 0;
+}
+
+const char * glstats_function_name(unsigned i) {
+    return NULL;
+}
+
+#endif
+
+void glstats_frame() {
+    glstats.current.frame = glstats.last.frame + 1;
+    glstats.last = glstats.current;
+    unsigned long frame = glstats.current.frame;
+    memset(&glstats.current, 0, sizeof(glstats.current));
+    glstats.current.frame = frame;
+}
+
+void glstats_last(GLFrameStats * stats) {
+    *stats = glstats.last;
+}
+
+// OVERLAY
+
+static void glstats_overlay_load() {
+    TextOptions options;
+    fnt_init(&glstats.overlay_font, GLSTATS_OVERLAY_FONT);
+    fnt_default_options(&glstats.overlay_font, &options);
+    options.width = GLSTATS_OVERLAY_WIDTH;
+    options.pt = 12;
+    options.useMarkup = 0;
+    options.threshold = 0.3f;
+    options.smoothing = 1.0f / 4.0f;
+    text_init(&glstats.overlay_text, &options, " ");
+    glstats.overlay_loaded = 1;
+}
+
+void glstats_set_overlay(int visible) {
+    if (visible && !glstats_enabled()) {
+        console_log("GL call counting needs a build with LDOOMC_GLSTATS.");
+        return;
+    }
+    glstats.overlay = visible;
+}
+
+int glstats_get_overlay() {
+    return glstats.overlay;
+}
+
+void glstats_draw_overlay() {
+    if (!glstats.overlay)
+        return;
+    glstats.paused = 1;
+    if (!glstats.overlay_loaded)
+        glstats_overlay_load();
+
+    const GLFrameStats * s = &glstats.last;
+    char buffer[1024];
+    int len = snprintf(buffer, sizeof(buffer),
+            "GL frame %lu\ncalls %lu  draws %lu\nstate %lu  redundant %lu\nupload %.1f KB\n",
+            s->frame, s->calls, s->draws, s->state_changes, s->redundant_binds,
+            s->upload_bytes / 1024.0);
+
+    // The busiest entry points, by selection since the list is short.
+    unsigned count = glstats_function_count();
+    char shown[GLSTATS_MAX_FUNCTIONS] = {0};
+    for (int n = 0; n < GLSTATS_OVERLAY_TOP_FUNCTIONS && len < (int) sizeof(buffer); n++) {
+        unsigned best = count;
+        for (unsigned i = 0; i < count; i++)
+            if (!shown[i] && s->function_calls[i] && (best == count || s->function_calls[i] > s->function_calls[best]))
+                best = i;
+        if (best == count)
+            break;
+        shown[best] = 1;
+        len += snprintf(buffer + len, sizeof(buffer) - len, "\n%s %lu",
+                glstats_function_name(best), s->function_calls[best]);
+    }
+    text_set(&glstats.overlay_text, buffer);
+
+    float x = platform_width() - GLSTATS_OVERLAY_WIDTH - GLSTATS_OVERLAY_BORDER;
+    float height = glstats.overlay_text.line_count *
+        glstats.overlay_font.lineHeight / glstats.overlay_font.size * glstats.overlay_text.pt;
+    qd_rgba(0.2f, 0.2f, 0.2f, 0.8f);
+    qd_rect(x - GLSTATS_OVERLAY_BORDER, 0,
+            GLSTATS_OVERLAY_WIDTH + 2 * GLSTATS_OVERLAY_BORDER,
+            height + 2 * GLSTATS_OVERLAY_BORDER, QD_FILL);
+    qd_rgba(1, 1, 1, 1);
+    glstats.overlay_text.position[0] = x;
+    glstats.overlay_text.position[1] = GLSTATS_OVERLAY_BORDER;
+    text_draw_screen(&glstats.overlay_text);
+    glstats.paused = 0;
+}
+
+void glstats_deinit() {
+    if (glstats.overlay_loaded) {
+        text_deinit(&glstats.overlay_text);
+        fnt_deinit(&glstats.overlay_font);
+        glstats.overlay_loaded = 0;
+    }
+    glstats.overlay = 0;
+    glstats_restore();
+}
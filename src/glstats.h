@@ -0,0 +1,48 @@
+#ifndef GLSTATS_H_R4TB8WNE
+#define GLSTATS_H_R4TB8WNE
+
+// GL call accounting. Built with LDOOMC_GLSTATS, glstats_init swaps the glad
+// function pointers the engine uses for counting wrappers, so every call made
+// through glad is tallied per frame by entry point. The wrappers also sum the
+// bytes handed to buffer and texture uploads and flag binds of an object that
+// is already bound. In a normal build the module does nothing and reports
+// zeros.
+
+#define GLSTATS_MAX_FUNCTIONS 96
+
+typedef struct {
+    unsigned long frame;
+    unsigned long calls;
+    unsigned long draws;
+    unsigned long state_changes; // Binds, enables, uniforms and other state
+    unsigned long redundant_binds;
+    unsigned long upload_bytes;
+    unsigned long function_calls[GLSTATS_MAX_FUNCTIONS];
+} GLFrameStats;
+
+// Call right after loading glad, with the context current.
+void glstats_init();
+
+// Puts the original glad pointers back.
+void glstats_deinit();
+
+// Returns 1 if the build counts GL calls.
+int glstats_enabled();
+
+// Ends the current frame. Call once per frame on the main thread.
+void glstats_frame();
+
+// Copies the counts of the last complete frame.
+void glstats_last(GLFrameStats * stats);
+
+// Names of the counted entry points, indexed like function_calls.
+unsigned glstats_function_count();
+const char * glstats_function_name(unsigned i);
+
+// The overlay shows the last frame's counts in the top right of the screen.
+// Its own GL calls are not counted.
+void glstats_set_overlay(int visible);
+int glstats_get_overlay();
+void glstats_draw_overlay();
+
+#endif /* end of include guard: GLSTATS_H_R4TB8WNE */
@@ -0,0 +1,227 @@
+#include "inputlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define INPUTLOG_VERSION 1
+#define INPUTLOG_HEADER_SIZE 32
+
+static struct {
+    FILE * out;
+    unsigned char * data;
+    size_t size;
+    size_t pos;
+    int done;
+} inputlog;
+
+// WRITING
+
+static void put_u8(unsigned char ** p, unsigned v) {
+    *(*p)++ = v;
+}
+
+static void put_u16(unsigned char ** p, unsigned v) {
+    put_u8(p, v & 0xFF);
+    put_u8(p, (v >> 8) & 0xFF);
+}
+
+static void put_u32(unsigned char ** p, uint32_t v) {
+    put_u16(p, v & 0xFFFF);
+    put_u16(p, v >> 16);
+}
+
+static void put_f64(unsigned char ** p, double d) {
+    uint64_t v;
+    memcpy(&v, &d, sizeof(v));
+    put_u32(p, v & 0xFFFFFFFF);
+    put_u32(p, v >> 32);
+}
+
+static void inputlog_fail() {
+    fprintf(stderr, "Could not write the input log; stopping the recording.\n");
+    fclose(inputlog.out);
+    inputlog.out = NULL;
+}
+
+static void inputlog_put(const unsigned char * buf, const unsigned char * end) {
+    if (inputlog.out && fwrite(buf, 1, end - buf, inputlog.out) != (size_t) (end - buf))
+        inputlog_fail();
+}
+
+int inputlog_record(const char * path, const InputLogHeader * header) {
+    inputlog_close();
+    inputlog.out = fopen(path, "wb");
+    if (!inputlog.out)
+        return 0;
+    unsigned char buf[INPUTLOG_HEADER_SIZE], * p = buf;
+    memcpy(p, "LDIL", 4);
+    p += 4;
+    put_u32(&p, INPUTLOG_VERSION);
+    put_u32(&p, header->width);
+    put_u32(&p, header->height);
+    put_f64(&p, header->x);
+    put_f64(&p, header->y);
+    inputlog_put(buf, p);
+    return inputlog.out != NULL;
+}
+
+void inputlog_write_event(const InputLogEvent * e) {
+    if (!inputlog.out)
+        return;
+    unsigned char buf[32], * p = buf;
+    put_u8(&p, e->type);
+    switch (e->type) {
+        case INPUTLOG_KEY:
+            put_u16(&p, e->code);
+            put_u32(&p, e->scancode);
+            put_u8(&p, e->action);
+            put_u8(&p, e->mods);
+            break;
+        case INPUTLOG_MOUSE:
+            put_u8(&p, e->code);
+            put_u8(&p, e->action);
+            put_u8(&p, e->mods);
+            break;
+        case INPUTLOG_CURSOR:
+        case INPUTLOG_SCROLL:
+            put_f64(&p, e->x);
+            put_f64(&p, e->y);
+            break;
+        case INPUTLOG_RESIZE:
+            put_u32(&p, (int) e->x);
+            put_u32(&p, (int) e->y);
+            break;
+        default:
+            return;
+    }
+    inputlog_put(buf, p);
+}
+
+void inputlog_write_frame(double delta) {
+    if (!inputlog.out)
+        return;
+    unsigned char buf[16], * p = buf;
+    put_u8(&p, INPUTLOG_FRAME);
+    put_f64(&p, delta);
+    inputlog_put(buf, p);
+    // Hand each finished frame to the OS, so a crash of the game loses at
+    // most the frame in progress.
+    if (inputlog.out && fflush(inputlog.out))
+        inputlog_fail();
+}
+
+// READING
+
+// Each get_ checks that the bytes are there; a short read ends the replay.
+static int get_bytes(size_t n) {
+    if (inputlog.size - inputlog.pos < n) {
+        inputlog.done = 1;
+        return 0;
+    }
+    return 1;
+}
+
+static unsigned get_u8() {
+    return inputlog.data[inputlog.pos++];
+}
+
+static unsigned get_u16() {
+    unsigned v = get_u8();
+    return v | get_u8() << 8;
+}
+
+static uint32_t get_u32() {
+    uint32_t v = get_u16();
+    return v | (uint32_t) get_u16() << 16;
+}
+
+static double get_f64() {
+    uint64_t v = get_u32();
+    v |= (uint64_t) get_u32() << 32;
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+int inputlog_replay(const char * path, InputLogHeader * header) {
+    inputlog_close();
+    FILE * f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    fseek(f, 0L, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+    if (size < INPUTLOG_HEADER_SIZE) {
+        fclose(f);
+        return 0;
+    }
+    inputlog.data = malloc(size);
+    inputlog.size = size;
+    inputlog.pos = 0;
+    inputlog.done = 0;
+    int ok = fread(inputlog.data, size, 1, f) == 1 &&
+        memcmp(inputlog.data, "LDIL", 4) == 0;
+    fclose(f);
+    inputlog.pos = 4;
+    if (!ok || get_u32() != INPUTLOG_VERSION) {
+        inputlog_close();
+        return 0;
+    }
+    header->width = (int32_t) get_u32();
+    header->height = (int32_t) get_u32();
+    header->x = get_f64();
+    header->y = get_f64();
+    return 1;
+}
+
+int inputlog_read_event(InputLogEvent * e, double * delta) {
+    if (inputlog.done || !get_bytes(1))
+        return -1;
+    memset(e, 0, sizeof(*e));
+    e->type = get_u8();
+    switch (e->type) {
+        case INPUTLOG_KEY:
+            if (!get_bytes(8)) return -1;
+            e->code = (int16_t) get_u16();
+            e->scancode = (int32_t) get_u32();
+            e->action = get_u8();
+            e->mods = get_u8();
+            return 1;
+        case INPUTLOG_MOUSE:
+            if (!get_bytes(3)) return -1;
+            e->code = get_u8();
+            e->action = get_u8();
+            e->mods = get_u8();
+            return 1;
+        case INPUTLOG_CURSOR:
+        case INPUTLOG_SCROLL:
+            if (!get_bytes(16)) return -1;
+            e->x = get_f64();
+            e->y = get_f64();
+            return 1;
+        case INPUTLOG_RESIZE:
+            if (!get_bytes(8)) return -1;
+            e->x = (int32_t) get_u32();
+            e->y = (int32_t) get_u32();
+            return 1;
+        case INPUTLOG_FRAME:
+            if (!get_bytes(8)) return -1;
+            *delta = get_f64();
+            return 0;
+        default:
+            fprintf(stderr, "Corrupt input log at byte %lu.\n", (unsigned long) inputlog.pos - 1);
+            inputlog.done = 1;
+            return -1;
+    }
+}
+
+void inputlog_close() {
+    if (inputlog.out && fclose(inputlog.out))
+        fprintf(stderr, "Could not finish the input log.\n");
+    inputlog.out = NULL;
+    free(inputlog.data);
+    inputlog.data = NULL;
+    inputlog.size = inputlog.pos = 0;
+    inputlog.done = 1;
+}
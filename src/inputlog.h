@@ -0,0 +1,57 @@
+#ifndef INPUTLOG_H_C5MZ8QWA
+#define INPUTLOG_H_C5MZ8QWA
+
+// Binary log of input events and frame deltas, for replaying a play session
+// frame for frame. The platform layer writes each callback's arguments as
+// they arrive and closes every frame with the delta it used, so a replay
+// that feeds the events back through the same callbacks sees the same
+// frames.
+//
+// Layout, little endian: the header, then one record per event or frame.
+// Each record starts with its type byte.
+//     header  "LDIL" u32 version, i32 width, i32 height, f64 cursor x, y
+//     key     i16 key, i32 scancode, u8 action, u8 mods
+//     mouse   u8 button, u8 action, u8 mods
+//     cursor  f64 x, f64 y
+//     scroll  f64 dx, f64 dy
+//     resize  i32 width, i32 height
+//     frame   f64 delta
+
+#define INPUTLOG_KEY 0
+#define INPUTLOG_MOUSE 1
+#define INPUTLOG_CURSOR 2
+#define INPUTLOG_SCROLL 3
+#define INPUTLOG_RESIZE 4
+#define INPUTLOG_FRAME 0xFF
+
+typedef struct {
+    int width, height;
+    double x, y; // Cursor position
+} InputLogHeader;
+
+typedef struct {
+    int type;
+    int code; // Key or mouse button
+    int scancode;
+    int action;
+    int mods;
+    double x, y; // Cursor position, scroll offset or window size
+} InputLogEvent;
+
+// Recording. Returns 0 if the file can't be created.
+int inputlog_record(const char * path, const InputLogHeader * header);
+void inputlog_write_event(const InputLogEvent * e);
+void inputlog_write_frame(double delta);
+
+// Loads a log for replay. Returns 0 if it can't be read or isn't a log.
+int inputlog_replay(const char * path, InputLogHeader * header);
+
+// Reads the next record. Returns 1 for an event of the current frame, 0 at
+// the frame's end after storing its delta, and -1 at the end of the log. A
+// truncated or corrupt tail also ends the log.
+int inputlog_read_event(InputLogEvent * e, double * delta);
+
+// Finishes a recording and frees a replay.
+void inputlog_close();
+
+#endif /* end of include guard: INPUTLOG_H_C5MZ8QWA */
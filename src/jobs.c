@@ -0,0 +1,153 @@
+#include "jobs.h"
+#include "trace.h"
+#include "arena.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct Job {
+    struct Job * next;
+    JobFunction work;
+    JobFunction done;
+    void * user;
+} Job;
+
+typedef struct {
+    Job * head;
+    Job * tail;
+} JobQueue;
+
+static struct {
+    pthread_t threads[JOBS_MAX_THREADS];
+    unsigned thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    JobQueue pending;
+    JobQueue finished;
+    unsigned outstanding;
+    int running;
+} jobs_globals;
+
+static void queue_push(JobQueue * q, Job * job) {
+    job->next = NULL;
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+}
+
+static Job * queue_pop(JobQueue * q) {
+    Job * job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (!q->head)
+            q->tail = NULL;
+    }
+    return job;
+}
+
+static void * jobs_worker(void * arg) {
+    trace_thread_name("jobs");
+    pthread_mutex_lock(&jobs_globals.lock);
+    for (;;) {
+        Job * job = queue_pop(&jobs_globals.pending);
+        if (!job) {
+            // Only quit once the queue is drained, so every job gets to run.
+            if (!jobs_globals.running)
+                break;
+            pthread_cond_wait(&jobs_globals.wake, &jobs_globals.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&jobs_globals.lock);
+        if (job->work) {
+            TraceMark mark = TRACE_BEGIN("job");
+            ArenaMark scratch = arena_mark();
+            job->work(job->user);
+            arena_reset(scratch);
+            arena_trim();
+            TRACE_END(mark);
+        }
+        pthread_mutex_lock(&jobs_globals.lock);
+        queue_push(&jobs_globals.finished, job);
+    }
+    pthread_mutex_unlock(&jobs_globals.lock);
+    return NULL;
+}
+
+void jobs_submit(JobFunction work, JobFunction done, void * user) {
+    Job * job = malloc(sizeof(Job));
+    job->work = work;
+    job->done = done;
+    job->user = user;
+    jobs_globals.outstanding++;
+    if (!jobs_globals.thread_count) {
+        // No workers, so run inline and defer the callback as usual.
+        if (work) {
+            ArenaMark scratch = arena_mark();
+            work(user);
+            arena_reset(scratch);
+        }
+        queue_push(&jobs_globals.finished, job);
+        return;
+    }
+    pthread_mutex_lock(&jobs_globals.lock);
+    queue_push(&jobs_globals.pending, job);
+    pthread_cond_signal(&jobs_globals.wake);
+    pthread_mutex_unlock(&jobs_globals.lock);
+}
+
+void jobs_update() {
+    if (!jobs_globals.outstanding)
+        return;
+    pthread_mutex_lock(&jobs_globals.lock);
+    Job * job = jobs_globals.finished.head;
+    jobs_globals.finished.head = jobs_globals.finished.tail = NULL;
+    pthread_mutex_unlock(&jobs_globals.lock);
+    while (job) {
+        Job * next = job->next;
+        jobs_globals.outstanding--;
+        if (job->done)
+            job->done(job->user);
+        free(job);
+        job = next;
+    }
+}
+
+unsigned jobs_outstanding() {
+    return jobs_globals.outstanding;
+}
+
+// INITIALIZATION / DEINITIALIZATION
+
+void jobs_init(unsigned threads) {
+    if (!threads) {
+        unsigned cores = util_cpu_count();
+        threads = cores > 1 ? cores - 1 : 1;
+    }
+    if (threads > JOBS_MAX_THREADS)
+        threads = JOBS_MAX_THREADS;
+    pthread_mutex_init(&jobs_globals.lock, NULL);
+    pthread_cond_init(&jobs_globals.wake, NULL);
+    jobs_globals.running = 1;
+    jobs_globals.thread_count = 0;
+    for (unsigned i = 0; i < threads; i++) {
+        if (pthread_create(jobs_globals.threads + i, NULL, jobs_worker, NULL))
+            break;
+        jobs_globals.thread_count++;
+    }
+}
+
+void jobs_deinit() {
+    pthread_mutex_lock(&jobs_globals.lock);
+    jobs_globals.running = 0;
+    pthread_cond_broadcast(&jobs_globals.wake);
+    pthread_mutex_unlock(&jobs_globals.lock);
+    for (unsigned i = 0; i < jobs_globals.thread_count; i++)
+        pthread_join(jobs_globals.threads[i], NULL);
+    jobs_globals.thread_count = 0;
+    while (jobs_globals.outstanding)
+        jobs_update();
+    pthread_cond_destroy(&jobs_globals.wake);
+    pthread_mutex_destroy(&jobs_globals.lock);
+}
@@ -0,0 +1,27 @@
+#ifndef JOBS_H_QX3KZ7PA
+#define JOBS_H_QX3KZ7PA
+
+#define JOBS_MAX_THREADS 8
+
+typedef void (*JobFunction)(void * user);
+
+// Starts the worker threads. A thread count of 0 uses one thread per core,
+// minus one for the main thread.
+void jobs_init(unsigned threads);
+
+// Finishes all submitted jobs, runs their completion callbacks, and stops the
+// worker threads.
+void jobs_deinit();
+
+// Runs work(user) on a worker thread. Once it returns, done(user) is called on
+// the main thread from jobs_update. Either function may be NULL. Scratch arena
+// memory allocated by work is freed when it returns.
+void jobs_submit(JobFunction work, JobFunction done, void * user);
+
+// Runs the completion callbacks of finished jobs. Call once per frame.
+void jobs_update();
+
+// Number of jobs submitted whose completion callbacks have not yet run.
+unsigned jobs_outstanding();
+
+#endif /* end of include guard: JOBS_H_QX3KZ7PA */
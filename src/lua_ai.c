@@ -0,0 +1,371 @@
+#include "lua_interop.h"
+#include "lua_modules.h"
+#include "console.h"
+#include "util.h"
+#include "memtrack.h"
+#include "trace.h"
+#include "platform.h"
+#include "scene.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// AI scripts run in a pool of separate Lua states, one per thread, so thinking
+// for many mobs is spread over the cores. Each frame the mobs are copied into a
+// read-only snapshot, every state runs think(i, dt) for a contiguous range of
+// mobs, and the commands they emit are applied on the main thread in mob order.
+// The result doesn't depend on how the threads were scheduled.
+//
+// AI states only get the base, table, string and math libraries plus the ai
+// module below; they can't reach ldoom or the main state.
+
+#define LUAI_AI_MAX_STATES 8
+
+enum {
+    LUAI_AI_MOVE,
+    LUAI_AI_LOOK,
+    LUAI_AI_FIRE
+};
+
+typedef struct {
+    vec3 position;
+    vec3 velocity;
+    vec3 facing;
+    float health;
+    unsigned flags;
+} AIMob;
+
+typedef struct {
+    unsigned mob;
+    int type;
+    float a, b;
+} AICommand;
+
+typedef struct {
+    lua_State * L;
+    unsigned begin, end;
+    unsigned current;
+    AICommand * commands;
+    unsigned command_count;
+    unsigned command_capacity;
+    char * error;
+} AIState;
+
+static struct {
+    AIState states[LUAI_AI_MAX_STATES];
+    unsigned state_count;
+    pthread_t threads[LUAI_AI_MAX_STATES];
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;
+    unsigned remaining;
+    int quit;
+    int loaded;
+    AIMob * mobs;
+    unsigned mob_count;
+    unsigned mob_capacity;
+    double dt;
+} luai_ai;
+
+static LuaEventSignature les_fire = LUAI_EVENT("fire", 1, (const int[]) { LUA_TNUMBER });
+
+// WORKER API
+
+static AIState * luai_ai_state(lua_State * L) {
+    return lua_touserdata(L, lua_upvalueindex(1));
+}
+
+static const AIMob * luai_ai_mob(lua_State * L, int arg) {
+    int i = luaL_checkinteger(L, arg);
+    luaL_argcheck(L, i >= 0 && (unsigned) i < luai_ai.mob_count, arg, "no such mob");
+    return luai_ai.mobs + i;
+}
+
+static void luai_ai_emit(lua_State * L, int type, float a, float b) {
+    AIState * s = luai_ai_state(L);
+    if (s->command_count == s->command_capacity) {
+        s->command_capacity = s->command_capacity * 2 + 64;
+        s->commands = trealloc(MEM_TAG_SCRIPT, s->commands, s->command_capacity * sizeof(AICommand));
+    }
+    AICommand * c = s->commands + s->command_count++;
+    c->mob = s->current;
+    c->type = type;
+    c->a = a;
+    c->b = b;
+}
+
+static int luai_ai_count(lua_State * L) {
+    lua_pushinteger(L, luai_ai.mob_count);
+    return 1;
+}
+
+static int luai_ai_position(lua_State * L) {
+    const AIMob * m = luai_ai_mob(L, 1);
+    lua_pushnumber(L, m->position[0]);
+    lua_pushnumber(L, m->position[1]);
+    lua_pushnumber(L, m->position[2]);
+    return 3;
+}
+
+static int luai_ai_velocity(lua_State * L) {
+    const AIMob * m = luai_ai_mob(L, 1);
+    lua_pushnumber(L, m->velocity[0]);
+    lua_pushnumber(L, m->velocity[1]);
+    lua_pushnumber(L, m->velocity[2]);
+    return 3;
+}
+
+static int luai_ai_facing(lua_State * L) {
+    const AIMob * m = luai_ai_mob(L, 1);
+    lua_pushnumber(L, m->facing[0]);
+    lua_pushnumber(L, m->facing[1]);
+    lua_pushnumber(L, m->facing[2]);
+    return 3;
+}
+
+static int luai_ai_health(lua_State * L) {
+    lua_pushnumber(L, luai_ai_mob(L, 1)->health);
+    return 1;
+}
+
+static int luai_ai_flags(lua_State * L) {
+    lua_pushnumber(L, luai_ai_mob(L, 1)->flags);
+    return 1;
+}
+
+// ai.move(forward, strafe) for the mob being thought about.
+static int luai_ai_move(lua_State * L) {
+    luai_ai_emit(L, LUAI_AI_MOVE, luaL_checknumber(L, 1), luaL_checknumber(L, 2));
+    return 0;
+}
+
+static int luai_ai_look(lua_State * L) {
+    luai_ai_emit(L, LUAI_AI_LOOK, luaL_checknumber(L, 1), luaL_checknumber(L, 2));
+    return 0;
+}
+
+static int luai_ai_fire(lua_State * L) {
+    luai_ai_emit(L, LUAI_AI_FIRE, 0, 0);
+    return 0;
+}
+
+static lua_State * luai_ai_newstate(AIState * s) {
+    lua_State * L = luaL_newstate();
+    const lua_CFunction libs[] = { luaopen_base, luaopen_table, luaopen_string, luaopen_math };
+    for (int i = 0; i < 4; i++) {
+        lua_pushcfunction(L, libs[i]);
+        lua_call(L, 0, 0);
+    }
+    const luaL_Reg module[] = {
+        {"count", luai_ai_count},
+        {"position", luai_ai_position},
+        {"velocity", luai_ai_velocity},
+        {"facing", luai_ai_facing},
+        {"health", luai_ai_health},
+        {"flags", luai_ai_flags},
+        {"move", luai_ai_move},
+        {"look", luai_ai_look},
+        {"fire", luai_ai_fire},
+        {NULL, NULL}
+    };
+    lua_newtable(L);
+    for (const luaL_Reg * r = module; r->name; r++) {
+        lua_pushlightuserdata(L, s);
+        lua_pushcclosure(L, r->func, 1);
+        lua_setfield(L, -2, r->name);
+    }
+    lua_setglobal(L, "ai");
+    // The base library can load files; AI scripts don't need to.
+    lua_pushnil(L);
+    lua_setglobal(L, "dofile");
+    lua_pushnil(L);
+    lua_setglobal(L, "loadfile");
+    lua_settop(L, 0);
+    return L;
+}
+
+// THREADS
+
+static void luai_ai_think(AIState * s) {
+    TRACE_SCOPE("ai_think");
+    lua_State * L = s->L;
+    s->command_count = 0;
+    lua_getglobal(L, "think");
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        return;
+    }
+    for (unsigned i = s->begin; i < s->end; i++) {
+        s->current = i;
+        lua_pushvalue(L, -1);
+        lua_pushinteger(L, i);
+        lua_pushnumber(L, luai_ai.dt);
+        if (lua_pcall(L, 2, 0, 0)) {
+            if (!s->error)
+                s->error = tstrdup(MEM_TAG_SCRIPT, lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+}
+
+static void * luai_ai_thread(void * user) {
+    AIState * s = user;
+    unsigned seen = 0;
+    trace_thread_name("ai");
+    pthread_mutex_lock(&luai_ai.lock);
+    for (;;) {
+        while (!luai_ai.quit && luai_ai.generation == seen)
+            pthread_cond_wait(&luai_ai.start, &luai_ai.lock);
+        if (luai_ai.quit)
+            break;
+        seen = luai_ai.generation;
+        pthread_mutex_unlock(&luai_ai.lock);
+        luai_ai_think(s);
+        pthread_mutex_lock(&luai_ai.lock);
+        if (--luai_ai.remaining == 0)
+            pthread_cond_signal(&luai_ai.done);
+    }
+    pthread_mutex_unlock(&luai_ai.lock);
+    return NULL;
+}
+
+// MAIN THREAD
+
+static void luai_ai_snapshot() {
+    unsigned count;
+    Mob ** mobs = scene_get_mobs(&count);
+    if (count > luai_ai.mob_capacity) {
+        luai_ai.mob_capacity = count * 2;
+        luai_ai.mobs = trealloc(MEM_TAG_SCRIPT, luai_ai.mobs, luai_ai.mob_capacity * sizeof(AIMob));
+    }
+    for (unsigned i = 0; i < count; i++) {
+        AIMob * a = luai_ai.mobs + i;
+        const Mob * m = mobs[i];
+        vec3_assign(a->position, m->position);
+        vec3_assign(a->velocity, m->velocity);
+        vec3_assign(a->facing, m->facing);
+        a->health = m->health;
+        a->flags = m->flags;
+    }
+    luai_ai.mob_count = count;
+}
+
+static void luai_ai_apply(AIState * s) {
+    unsigned count;
+    Mob ** mobs = scene_get_mobs(&count);
+    for (unsigned i = 0; i < s->command_count; i++) {
+        const AICommand * c = s->commands + i;
+        if (c->mob >= count)
+            continue;
+        switch (c->type) {
+            case LUAI_AI_MOVE:
+                mob_impulse_move(mobs[c->mob], c->a, c->b);
+                break;
+            case LUAI_AI_LOOK:
+                mob_look(mobs[c->mob], c->a, c->b);
+                break;
+            case LUAI_AI_FIRE:
+                luai_event(&les_fire, (double) c->mob);
+                break;
+        }
+    }
+    if (s->error) {
+        console_log("AI think failed: %s", s->error);
+        tfree(s->error);
+        s->error = NULL;
+    }
+}
+
+void luai_ai_update(double dt) {
+    if (!luai_ai.loaded)
+        return;
+    luai_ai_snapshot();
+    if (!luai_ai.mob_count)
+        return;
+    luai_ai.dt = dt;
+    unsigned n = luai_ai.state_count;
+    for (unsigned i = 0; i < n; i++) {
+        luai_ai.states[i].begin = (unsigned) ((unsigned long) luai_ai.mob_count * i / n);
+        luai_ai.states[i].end = (unsigned) ((unsigned long) luai_ai.mob_count * (i + 1) / n);
+    }
+    // State 0 belongs to the main thread.
+    pthread_mutex_lock(&luai_ai.lock);
+    luai_ai.generation++;
+    luai_ai.remaining = n - 1;
+    pthread_cond_broadcast(&luai_ai.start);
+    pthread_mutex_unlock(&luai_ai.lock);
+    luai_ai_think(luai_ai.states);
+    pthread_mutex_lock(&luai_ai.lock);
+    while (luai_ai.remaining)
+        pthread_cond_wait(&luai_ai.done, &luai_ai.lock);
+    pthread_mutex_unlock(&luai_ai.lock);
+    for (unsigned i = 0; i < n; i++)
+        luai_ai_apply(luai_ai.states + i);
+}
+
+void luai_ai_deinit() {
+    pthread_mutex_lock(&luai_ai.lock);
+    luai_ai.quit = 1;
+    pthread_cond_broadcast(&luai_ai.start);
+    pthread_mutex_unlock(&luai_ai.lock);
+    for (unsigned i = 1; i < luai_ai.state_count; i++)
+        pthread_join(luai_ai.threads[i], NULL);
+    for (unsigned i = 0; i < luai_ai.state_count; i++) {
+        lua_close(luai_ai.states[i].L);
+        tfree(luai_ai.states[i].commands);
+        tfree(luai_ai.states[i].error);
+    }
+    pthread_mutex_destroy(&luai_ai.lock);
+    pthread_cond_destroy(&luai_ai.start);
+    pthread_cond_destroy(&luai_ai.done);
+    tfree(luai_ai.mobs);
+    memset(&luai_ai, 0, sizeof(luai_ai));
+}
+
+// MAIN STATE API
+
+// ldoom.ai.load(resource) runs a script in every AI state. It should define
+// think(i, dt).
+static int luai_ai_load(lua_State * L) {
+    const char * resource = luaL_checkstring(L, 1);
+    const char * path = platform_res2file_ez(resource);
+    for (unsigned i = 0; i < luai_ai.state_count; i++) {
+        lua_State * S = luai_ai.states[i].L;
+        if (luai_loadfile_cached(S, path) || lua_pcall(S, 0, 0, 0)) {
+            lua_pushstring(L, lua_tostring(S, -1));
+            lua_pop(S, 1);
+            return lua_error(L);
+        }
+    }
+    luai_ai.loaded = 1;
+    return 0;
+}
+
+static int luai_ai_states(lua_State * L) {
+    lua_pushinteger(L, luai_ai.state_count);
+    return 1;
+}
+
+void luai_load_ai() {
+    unsigned n = util_cpu_count();
+    if (n > LUAI_AI_MAX_STATES)
+        n = LUAI_AI_MAX_STATES;
+    luai_ai.state_count = n;
+    pthread_mutex_init(&luai_ai.lock, NULL);
+    pthread_cond_init(&luai_ai.start, NULL);
+    pthread_cond_init(&luai_ai.done, NULL);
+    for (unsigned i = 0; i < n; i++)
+        luai_ai.states[i].L = luai_ai_newstate(luai_ai.states + i);
+    for (unsigned i = 1; i < n; i++)
+        if (pthread_create(luai_ai.threads + i, NULL, luai_ai_thread, luai_ai.states + i))
+            uerr("Could not start AI thread.");
+
+    const luaL_Reg module[] = {
+        {"load", luai_ai_load},
+        {"states", luai_ai_states},
+        {NULL, NULL}
+    };
+    luai_addsubmodule("ai", module);
+}
@@ -1,13 +1,59 @@
 #include "audio.h"
+#include "mixer.h"
+#include "pcmcache.h"
 #include "lua_modules.h"
 #include "lua_interop.h"
+#include "console.h"
+#include <stdlib.h>
+
+// Registry references held while a sound loads. The sound itself is referenced
+// so it can't be collected before its callback runs.
+typedef struct {
+    int sound_ref;
+    int callback_ref;
+} LuaSoundLoad;
+
+static void luai_audio_sound_onload(Sound * s, void * user) {
+    lua_State * L = globalLuaState;
+    LuaSoundLoad * load = user;
+    s->onload = NULL;
+    s->onload_user = NULL;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, load->callback_ref);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, load->sound_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, load->callback_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, load->sound_ref);
+    free(load);
+    if (lua_pcall(L, 1, 0, 0)) {
+        console_log("Sound load callback failed: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
 
 static int luai_audio_sound_make(lua_State * L) {
-    const char * resource = lua_tostring(L, 1);
+    const char * resource = luaL_checkstring(L, 1);
+    int has_callback = lua_isfunction(L, 2);
+    Sound * s = lua_newuserdata(L, sizeof(Sound));
+    luaL_getmetatable(L, "ldoom.Sound");
+    lua_setmetatable(L , -2);
+    LuaSoundLoad * load = NULL;
+    if (has_callback) {
+        load = malloc(sizeof(LuaSoundLoad));
+        lua_pushvalue(L, -1);
+        load->sound_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_pushvalue(L, 2);
+        load->callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    audio_sound_init_resource_async(s, resource,
+            has_callback ? luai_audio_sound_onload : NULL, load);
+    return 1;
+}
+
+static int luai_audio_sound_stream(lua_State * L) {
+    const char * resource = luaL_checkstring(L, 1);
     Sound * s = lua_newuserdata(L, sizeof(Sound));
     luaL_getmetatable(L, "ldoom.Sound");
     lua_setmetatable(L , -2);
-    audio_sound_init_resource(s, resource);
+    audio_sound_init_stream(s, resource);
     return 1;
 }
 
@@ -17,6 +63,147 @@ static Sound * luai_audio_sound_check(lua_State * L) {
     return (Sound *) ud;
 }
 
+static int luai_audio_sound_set_position(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    s->position[0] = luaL_checknumber(L, 2);
+    s->position[1] = luaL_checknumber(L, 3);
+    s->position[2] = luaL_checknumber(L, 4);
+    audio_sound_update(s);
+    return 0;
+}
+
+static int luai_audio_sound_set_gain(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    s->gain = luaL_checknumber(L, 2);
+    audio_sound_update(s);
+    return 0;
+}
+
+static int luai_audio_sound_set_priority(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    s->priority = luaL_checknumber(L, 2);
+    return 0;
+}
+
+static int luai_audio_sound_isvirtual(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    lua_pushboolean(L, (s->flags & AUDIO_PLAYING) && !s->source);
+    return 1;
+}
+
+static int luai_audio_set_listener(lua_State * L) {
+    vec3 position, forward, up;
+    for (int i = 0; i < 3; i++) {
+        position[i] = luaL_checknumber(L, i + 1);
+        forward[i] = luaL_optnumber(L, i + 4, i == 2 ? -1 : 0);
+        up[i] = luaL_optnumber(L, i + 7, i == 1 ? 1 : 0);
+    }
+    audio_set_listener(position, forward, up);
+    return 0;
+}
+
+static int luai_audio_voice_stats(lua_State * L) {
+    AudioVoiceStats stats;
+    audio_voice_stats(&stats);
+    lua_pushnumber(L, stats.real);
+    lua_pushnumber(L, stats.virtual);
+    lua_pushnumber(L, stats.voices);
+    return 3;
+}
+
+static int luai_audio_clip_load(lua_State * L) {
+    const char * resource = luaL_checkstring(L, 1);
+    MixerClip ** c = lua_newuserdata(L, sizeof(MixerClip *));
+    *c = NULL;
+    luaL_getmetatable(L, "ldoom.Clip");
+    lua_setmetatable(L, -2);
+    *c = mixer_clip_load(resource);
+    return 1;
+}
+
+static MixerClip ** luai_audio_clip_check(lua_State * L) {
+    void * ud = luaL_checkudata(L, 1, "ldoom.Clip");
+    luaL_argcheck(L, ud != NULL, 1, "'ldoom.Clip' expected.");
+    return (MixerClip **) ud;
+}
+
+static int luai_audio_clip_delete(lua_State * L) {
+    MixerClip ** c = luai_audio_clip_check(L);
+    if (*c) {
+        mixer_clip_release(*c);
+        *c = NULL;
+    }
+    return 0;
+}
+
+static int luai_audio_clip_play(lua_State * L) {
+    MixerClip ** c = luai_audio_clip_check(L);
+    if (!*c)
+        return 0;
+    float gain = luaL_optnumber(L, 2, 1);
+    float pitch = luaL_optnumber(L, 3, 1);
+    float pan = luaL_optnumber(L, 4, 0);
+    lua_pushnumber(L, mixer_play(*c, gain, pitch, pan));
+    return 1;
+}
+
+static int luai_audio_voice_set(lua_State * L) {
+    unsigned voice = luaL_checknumber(L, 1);
+    mixer_set(voice, luaL_optnumber(L, 2, 1), luaL_optnumber(L, 3, 1), luaL_optnumber(L, 4, 0));
+    return 0;
+}
+
+static int luai_audio_voice_stop(lua_State * L) {
+    mixer_stop(luaL_checknumber(L, 1));
+    return 0;
+}
+
+static int luai_audio_mixer_voices(lua_State * L) {
+    lua_pushnumber(L, mixer_voice_count());
+    return 1;
+}
+
+static int luai_audio_sound_isloaded(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    lua_pushboolean(L, !(s->flags & AUDIO_LOADING));
+    return 1;
+}
+
+static int luai_audio_cache_stats(lua_State * L) {
+    AudioCacheStats stats;
+    audio_cache_stats(&stats);
+    lua_newtable(L);
+    lua_pushnumber(L, stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, stats.evictions);
+    lua_setfield(L, -2, "evictions");
+    lua_pushnumber(L, stats.entries);
+    lua_setfield(L, -2, "entries");
+    lua_pushnumber(L, stats.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, stats.budget);
+    lua_setfield(L, -2, "budget");
+    PcmCacheStats pcm;
+    pcmcache_stats(&pcm);
+    lua_pushnumber(L, pcm.hits);
+    lua_setfield(L, -2, "diskHits");
+    lua_pushnumber(L, pcm.misses);
+    lua_setfield(L, -2, "diskMisses");
+    lua_pushnumber(L, pcm.hit_usec / 1000.0);
+    lua_setfield(L, -2, "diskHitMs");
+    lua_pushnumber(L, pcm.miss_usec / 1000.0);
+    lua_setfield(L, -2, "decodeMs");
+    return 1;
+}
+
+static int luai_audio_cache_set_budget(lua_State * L) {
+    double bytes = luaL_checknumber(L, 1);
+    audio_cache_set_budget(bytes > 0 ? (size_t) bytes : 0);
+    return 0;
+}
+
 static int luai_audio_sound_tostring(lua_State * L) {
     lua_pushstring(L, "ldoom.Sound");
     return 1;
@@ -24,6 +211,15 @@ static int luai_audio_sound_tostring(lua_State * L) {
 
 static int luai_audio_sound_delete(lua_State * L) {
     Sound * s = luai_audio_sound_check(L);
+    if (s->onload_user) {
+        // Destroyed before it finished loading, so the callback will never run.
+        LuaSoundLoad * load = s->onload_user;
+        luaL_unref(L, LUA_REGISTRYINDEX, load->callback_ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, load->sound_ref);
+        free(load);
+        s->onload = NULL;
+        s->onload_user = NULL;
+    }
     audio_sound_deinit(s);
     return 0;
 }
@@ -34,9 +230,44 @@ static int luai_audio_sound_play(lua_State * L) {
     return 0;
 }
 
+static int luai_audio_sound_loop(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    audio_sound_loop(s);
+    return 0;
+}
+
+static int luai_audio_sound_stop(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    audio_sound_stop(s);
+    return 0;
+}
+
+static int luai_audio_sound_stop_looping(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    audio_sound_stop_looping(s);
+    return 0;
+}
+
+static int luai_audio_sound_seek(lua_State * L) {
+    Sound * s = luai_audio_sound_check(L);
+    double seconds = luaL_checknumber(L, 2);
+    int rate = (s->flags & AUDIO_STREAMING) ? s->stream->sample_rate : s->data->sample_rate;
+    audio_sound_seek(s, seconds > 0 ? (unsigned) (seconds * rate) : 0);
+    return 0;
+}
+
 void luai_load_audio() {
     const luaL_Reg methods [] = {
         {"play", luai_audio_sound_play},
+        {"loop", luai_audio_sound_loop},
+        {"stop", luai_audio_sound_stop},
+        {"stopLooping", luai_audio_sound_stop_looping},
+        {"seek", luai_audio_sound_seek},
+        {"isLoaded", luai_audio_sound_isloaded},
+        {"isVirtual", luai_audio_sound_isvirtual},
+        {"setPosition", luai_audio_sound_set_position},
+        {"setGain", luai_audio_sound_set_gain},
+        {"setPriority", luai_audio_sound_set_priority},
         {"destory", luai_audio_sound_delete},
         {NULL, NULL}
     };
@@ -47,8 +278,26 @@ void luai_load_audio() {
     };
     const luaL_Reg module [] = {
         {"loadOgg", luai_audio_sound_make},
+        {"streamOgg", luai_audio_sound_stream},
+        {"cacheStats", luai_audio_cache_stats},
+        {"setCacheBudget", luai_audio_cache_set_budget},
+        {"setListener", luai_audio_set_listener},
+        {"voiceStats", luai_audio_voice_stats},
+        {"loadClip", luai_audio_clip_load},
+        {"setVoice", luai_audio_voice_set},
+        {"stopVoice", luai_audio_voice_stop},
+        {"mixerVoices", luai_audio_mixer_voices},
+        {NULL, NULL}
+    };
+    const luaL_Reg clipmethods [] = {
+        {"play", luai_audio_clip_play},
+        {NULL, NULL}
+    };
+    const luaL_Reg clipmetamethods [] = {
+        {"__gc", luai_audio_clip_delete},
         {NULL, NULL}
     };
     luai_newclass("ldoom.Sound", methods, metamethods);
+    luai_newclass("ldoom.Clip", clipmethods, clipmetamethods);
     luai_addsubmodule("audio", module);
 }
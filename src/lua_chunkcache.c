@@ -0,0 +1,211 @@
+#include "lua_interop.h"
+#include "util.h"
+#include "memtrack.h"
+#include "trace.h"
+#include <luajit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+// Compiled chunks are dumped to the cache directory, one file per script named
+// by a hash of the chunk name. The header holds a hash of the chunk name, the
+// source and the VM version, so editing a script or upgrading LuaJIT misses
+// and the new chunk replaces the old one; the cache never holds more than one
+// entry per script. Hits are memory mapped and handed to luaL_loadbuffer.
+// Chunks keep their debug info, so errors still point at the source lines.
+
+#define LUAI_CHUNKCACHE_VERSION 2
+#define LUAI_CHUNKCACHE_PATHLEN 1024
+#define LUAI_CHUNK_HASH_SEED 14695981039346656037ULL
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    char vm[32];
+} LuaChunkHeader;
+
+static struct {
+    char dir[LUAI_CHUNKCACHE_PATHLEN];
+    int enabled;
+    LuaChunkCacheStats stats;
+} luai_chunkcache;
+
+// FNV-1a
+static uint64_t luai_chunk_hash(uint64_t h, const char * data, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) data[i]) * 1099511628211ULL;
+    return h;
+}
+
+static int luai_chunk_cache_file(const char * chunkname, char * buf, size_t buflen) {
+    uint64_t name_hash = luai_chunk_hash(LUAI_CHUNK_HASH_SEED, chunkname, strlen(chunkname));
+    int n = snprintf(buf, buflen, "%s/%016llx.luac", luai_chunkcache.dir, (unsigned long long) name_hash);
+    return n > 0 && (size_t) n < buflen;
+}
+
+static int luai_chunk_read(lua_State * L, const char * file, uint64_t hash, size_t source_size,
+        const char * chunkname) {
+    const void * map;
+    size_t size;
+    if (!util_map(file, &map, &size))
+        return 0;
+    if (size <= sizeof(LuaChunkHeader)) {
+        util_unmap(map, size);
+        return 0;
+    }
+    const LuaChunkHeader * h = map;
+    int ok = memcmp(h->magic, "LDLC", 4) == 0 &&
+        h->version == LUAI_CHUNKCACHE_VERSION &&
+        h->source_hash == hash &&
+        h->source_size == source_size &&
+        strncmp(h->vm, LUAJIT_VERSION, sizeof(h->vm)) == 0;
+    if (ok && luaL_loadbuffer(L, (const char *) map + sizeof(LuaChunkHeader),
+                size - sizeof(LuaChunkHeader), chunkname)) {
+        // A corrupt entry; drop the message and compile the source instead.
+        lua_pop(L, 1);
+        ok = 0;
+    }
+    util_unmap(map, size);
+    return ok;
+}
+
+typedef struct {
+    char * data;
+    size_t len;
+    size_t capacity;
+} LuaChunkBuffer;
+
+static int luai_chunk_writer(lua_State * L, const void * p, size_t sz, void * ud) {
+    LuaChunkBuffer * b = ud;
+    if (b->len + sz > b->capacity) {
+        b->capacity = (b->len + sz) * 2;
+        b->data = trealloc(MEM_TAG_SCRIPT, b->data, b->capacity);
+    }
+    memcpy(b->data + b->len, p, sz);
+    b->len += sz;
+    return 0;
+}
+
+// Dumps the function on top of the stack over the script's entry. Writes to a
+// temporary file first, so a reader never sees a partial entry.
+static void luai_chunk_write(lua_State * L, const char * file, uint64_t hash, size_t source_size) {
+    char tmp[LUAI_CHUNKCACHE_PATHLEN + 32];
+    LuaChunkBuffer b = {NULL, 0, 0};
+    if (lua_dump(L, luai_chunk_writer, &b) || !b.len) {
+        tfree(b.data);
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%ld", file, (long) getpid());
+    FILE * f = fopen(tmp, "wb");
+    if (!f) {
+        tfree(b.data);
+        return;
+    }
+    LuaChunkHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "LDLC", 4);
+    h.version = LUAI_CHUNKCACHE_VERSION;
+    h.source_hash = hash;
+    h.source_size = source_size;
+    strncpy(h.vm, LUAJIT_VERSION, sizeof(h.vm));
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(b.data, 1, b.len, f) == b.len;
+    if (fclose(f) || !ok || !util_rename(tmp, file))
+        remove(tmp);
+    tfree(b.data);
+}
+
+int luai_loadfile_cached(lua_State * L, const char * path) {
+    TRACE_SCOPE("luai_loadfile");
+    double start = util_nsec();
+    const void * map;
+    size_t size;
+    if (!util_map(path, &map, &size)) {
+        lua_pushfstring(L, "cannot open %s", path);
+        return LUA_ERRFILE;
+    }
+    const char * source = map ? map : "";
+
+    lua_pushfstring(L, "@%s", path);
+    const char * chunkname = lua_tostring(L, -1);
+    // Like luaL_loadfile, skip a #! line but keep its newline for line numbers.
+    const char * code = source;
+    size_t code_size = size;
+    if (code_size && *code == '#') {
+        while (code_size && *code != '\n') {
+            code++;
+            code_size--;
+        }
+    }
+
+    int status = 0;
+    int hit = 0;
+    uint64_t hash = 0;
+    char file[LUAI_CHUNKCACHE_PATHLEN];
+    int cached = luai_chunkcache.enabled && luai_chunk_cache_file(chunkname, file, sizeof(file));
+    if (cached) {
+        hash = luai_chunk_hash(LUAI_CHUNK_HASH_SEED, LUAJIT_VERSION, strlen(LUAJIT_VERSION));
+        hash = luai_chunk_hash(hash, chunkname, strlen(chunkname) + 1);
+        hash = luai_chunk_hash(hash, code, code_size);
+        hit = luai_chunk_read(L, file, hash, code_size, chunkname);
+    }
+    if (!hit) {
+        status = luaL_loadbuffer(L, code, code_size, chunkname);
+        if (!status && cached)
+            luai_chunk_write(L, file, hash, code_size);
+    }
+    lua_remove(L, -2);
+    util_unmap(map, size);
+
+    unsigned long usec = (util_nsec() - start) / 1000;
+    if (hit) {
+        luai_chunkcache.stats.hits++;
+        luai_chunkcache.stats.hit_usec += usec;
+    } else if (!status) {
+        luai_chunkcache.stats.misses++;
+        luai_chunkcache.stats.miss_usec += usec;
+    }
+    return status;
+}
+
+void luai_chunkcache_init(const char * dir) {
+    char * out = luai_chunkcache.dir;
+    size_t len = sizeof(luai_chunkcache.dir);
+    int ok;
+    if (dir) {
+        int n = snprintf(out, len, "%s", dir);
+        ok = n > 0 && (size_t) n < len && util_mkdirs(out);
+    } else {
+        ok = util_cache_dir("luac", out, len);
+    }
+    if (!ok)
+        out[0] = 0;
+    luai_chunkcache.enabled = out[0] != 0;
+}
+
+int luai_chunkcache_remove(const char * path) {
+    char chunkname[LUAI_CHUNKCACHE_PATHLEN];
+    char file[LUAI_CHUNKCACHE_PATHLEN];
+    int n = snprintf(chunkname, sizeof(chunkname), "@%s", path);
+    if (!luai_chunkcache.dir[0] || n <= 0 || (size_t) n >= sizeof(chunkname) ||
+            !luai_chunk_cache_file(chunkname, file, sizeof(file)))
+        return 0;
+    return !remove(file);
+}
+
+void luai_chunkcache_set_enabled(int enabled) {
+    luai_chunkcache.enabled = enabled && luai_chunkcache.dir[0];
+}
+
+void luai_chunkcache_stats(LuaChunkCacheStats * stats) {
+    *stats = luai_chunkcache.stats;
+}
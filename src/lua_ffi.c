@@ -0,0 +1,120 @@
+#include "lua_interop.h"
+#include "lua_modules.h"
+#include "console.h"
+#include "scene.h"
+#include "mesh.h"
+#include <stddef.h>
+#include <string.h>
+
+// LuaJIT FFI views over engine data. Scripts read and write mobs in place
+// instead of going through a C function per field. The views themselves are
+// read only: view[i].position[0] = x writes a mob, but nothing can replace
+// the engine's pointers. Vertex is exported for mesh bindings. The cdefs
+// below must match the C structs; the layout table passed in from C is
+// checked against them when the module loads, and the views are left out if
+// anything disagrees.
+
+static const char * luai_ffi_source =
+"local ffi = require('ffi')\n"
+"local layout, getMobs = ...\n"
+"ffi.cdef[[\n"
+"typedef float vec2[2];\n"
+"typedef float vec3[3];\n"
+"typedef float vec4[4];\n"
+"typedef float quat[4];\n"
+"typedef float mat4[16];\n"
+"typedef struct {\n"
+"    float position[3];\n"
+"    float normal[3];\n"
+"    float texcoords[2];\n"
+"} Vertex;\n"
+"typedef struct {\n"
+"    float starting_health, speed, inv_mass, height, radius, jump, walk_accel;\n"
+"    float restitution, friction;\n"
+"    unsigned flags;\n"
+"    float agression_radius, aggression;\n"
+"    void * model;\n"
+"    void * user;\n"
+"} MobDef;\n"
+"typedef struct {\n"
+"    unsigned flags;\n"
+"    MobDef * type;\n"
+"    vec3 position, velocity, _position_penalty, _acceleration, facing;\n"
+"    float friction, walk_acccel, health, speed, jump;\n"
+"    unsigned sceneIndex;\n"
+"} Mob;\n"
+"]]\n"
+"for k, v in pairs(layout) do\n"
+"    local t, f = k:match('^(%w+)%.?(.*)$')\n"
+"    local got = f == '' and ffi.sizeof(t) or ffi.offsetof(t, f)\n"
+"    if got ~= v then error(k .. ' is ' .. v .. ' bytes in C but ' .. tostring(got) .. ' in the cdef') end\n"
+"end\n"
+"local M = {}\n"
+"M.vec2, M.vec3, M.vec4 = ffi.typeof('vec2'), ffi.typeof('vec3'), ffi.typeof('vec4')\n"
+"M.quat, M.mat4 = ffi.typeof('quat'), ffi.typeof('mat4')\n"
+"M.Vertex = ffi.typeof('Vertex')\n"
+"local MobPP = ffi.typeof('Mob **')\n"
+"-- Bounds checked, zero based view of a C array. ptr and n can be used\n"
+"-- directly in hot loops.\n"
+"local View = {}\n"
+"View.__index = function(view, i)\n"
+"    if type(i) ~= 'number' then return View[i] end\n"
+"    if i < 0 or i >= view.n then error('index ' .. i .. ' out of range [0, ' .. view.n .. ')', 2) end\n"
+"    return view.ptr[i]\n"
+"end\n"
+"View.__newindex = function(view, i, v)\n"
+"    error('views are read only; write through the element, as in view[i].field = v', 2)\n"
+"end\n"
+"-- The scene's mobs. The array moves when mobs are added, so get a new view\n"
+"-- every frame.\n"
+"function M.mobs()\n"
+"    local ptr, n = getMobs()\n"
+"    return setmetatable({ ptr = ffi.cast(MobPP, ptr), n = n }, View)\n"
+"end\n"
+"return M\n";
+
+static int luai_ffi_getMobs(lua_State * L) {
+    unsigned count;
+    Mob ** mobs = scene_get_mobs(&count);
+    lua_pushlightuserdata(L, mobs);
+    lua_pushinteger(L, count);
+    return 2;
+}
+
+#define LUAI_FFI_SIZE(T) \
+    lua_pushinteger(L, sizeof(T)); \
+    lua_setfield(L, -2, #T);
+
+#define LUAI_FFI_OFFSET(T, F) \
+    lua_pushinteger(L, offsetof(T, F)); \
+    lua_setfield(L, -2, #T "." #F);
+
+void luai_load_ffi() {
+    lua_State * L = globalLuaState;
+    if (luaL_loadbuffer(L, luai_ffi_source, strlen(luai_ffi_source), "=ldoom.ffi")) {
+        console_log("FFI views unavailable: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return;
+    }
+    lua_newtable(L);
+    LUAI_FFI_SIZE(Vertex);
+    LUAI_FFI_OFFSET(Vertex, normal);
+    LUAI_FFI_OFFSET(Vertex, texcoords);
+    LUAI_FFI_SIZE(MobDef);
+    LUAI_FFI_OFFSET(MobDef, model);
+    LUAI_FFI_SIZE(Mob);
+    LUAI_FFI_OFFSET(Mob, type);
+    LUAI_FFI_OFFSET(Mob, position);
+    LUAI_FFI_OFFSET(Mob, facing);
+    LUAI_FFI_OFFSET(Mob, sceneIndex);
+    lua_pushcfunction(L, luai_ffi_getMobs);
+    if (lua_pcall(L, 2, 1, 0)) {
+        console_log("FFI views unavailable: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return;
+    }
+    lua_getglobal(L, "ldoom");
+    lua_insert(L, -2);
+    lua_setfield(L, -2, "ffi");
+    lua_pop(L, 1);
+}
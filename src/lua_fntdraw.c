@@ -64,6 +64,9 @@ static int luai_fnt_maketext(lua_State * L) {
     return 0;
 }
 
+LUAI_SETTER1N(FontDef, setPageBudget, fnt_set_page_budget(t, v1 < 0 ? 0 : (size_t) v1))
+LUAI_GETTER1N(FontDef, getPageBudget, t->pagebudget)
+
 LUAI_MAKECHECKER(Text)
 static Text * luai_text_check(lua_State * L) {
     void * ud = luaL_checkudata(L, 1, "ldoom.Text");
@@ -159,6 +162,8 @@ void luai_load_fntdraw() {
     };
     const luaL_Reg fontmethods[] = {
         {"newText", luai_fnt_maketext},
+        {"setPageBudget", LUAI_F(FontDef, setPageBudget)},
+        {"getPageBudget", LUAI_F(FontDef, getPageBudget)},
         {NULL, NULL}
     };
     const luaL_Reg fontmetamethods[] = {
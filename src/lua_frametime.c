@@ -0,0 +1,187 @@
+#include "lua_interop.h"
+#include "lua_modules.h"
+#include "frametime.h"
+#include "glstats.h"
+#include "memtrack.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void luai_frametime_pushstats(lua_State * L, int phase) {
+    FrameTimeStats s;
+    frametime_stats(phase, &s);
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, s.count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, s.mean);
+    lua_setfield(L, -2, "mean");
+    lua_pushnumber(L, s.p50);
+    lua_setfield(L, -2, "p50");
+    lua_pushnumber(L, s.p95);
+    lua_setfield(L, -2, "p95");
+    lua_pushnumber(L, s.p99);
+    lua_setfield(L, -2, "p99");
+    lua_pushnumber(L, s.max);
+    lua_setfield(L, -2, "max");
+}
+
+// ldoom.frametime.stats() returns { frame = {...}, swap = {...}, ... } in
+// milliseconds. ldoom.frametime.stats(phase) returns a single phase.
+static int luai_frametime_stats(lua_State * L) {
+    if (!lua_isnoneornil(L, 1)) {
+        const char * name = luaL_checkstring(L, 1);
+        for (int p = 0; p < FRAMETIME_PHASES; p++) {
+            if (!strcmp(name, frametime_phase_name(p))) {
+                luai_frametime_pushstats(L, p);
+                return 1;
+            }
+        }
+        return luaL_argerror(L, 1, "unknown phase");
+    }
+    lua_createtable(L, 0, FRAMETIME_PHASES);
+    for (int p = 0; p < FRAMETIME_PHASES; p++) {
+        luai_frametime_pushstats(L, p);
+        lua_setfield(L, -2, frametime_phase_name(p));
+    }
+    return 1;
+}
+
+static int luai_frametime_reset(lua_State * L) {
+    frametime_reset();
+    return 0;
+}
+
+// ldoom.frametime.recent([n]) returns the last n frames, oldest first, as
+// { index = n, frame = ms, swap = ms, ... } tables.
+static int luai_frametime_recent(lua_State * L) {
+    int max = luaL_optinteger(L, 1, 120);
+    luaL_argcheck(L, max > 0 && max <= FRAMETIME_RING, 1, "out of range");
+    ArenaMark mark = arena_mark();
+    FrameTimeSample * samples = arena_alloc(max * sizeof(FrameTimeSample));
+    unsigned n = frametime_recent(samples, max);
+    lua_createtable(L, n, 0);
+    for (unsigned i = 0; i < n; i++) {
+        lua_createtable(L, 0, FRAMETIME_PHASES + 1);
+        for (int p = 0; p < FRAMETIME_PHASES; p++) {
+            lua_pushnumber(L, samples[i].msec[p]);
+            lua_setfield(L, -2, frametime_phase_name(p));
+        }
+        lua_pushnumber(L, samples[i].frame);
+        lua_setfield(L, -2, "index");
+        lua_rawseti(L, -2, i + 1);
+    }
+    arena_reset(mark);
+    return 1;
+}
+
+static int luai_frametime_log(lua_State * L) {
+    frametime_log();
+    return 0;
+}
+
+// ldoom.frametime.gl() returns the GL call counts of the last frame:
+// { frame, calls, draws, state, redundant, upload, functions = { glX = n } }.
+// Everything is zero unless the build has LDOOMC_GLSTATS.
+static int luai_frametime_gl(lua_State * L) {
+    GLFrameStats s;
+    glstats_last(&s);
+    lua_createtable(L, 0, 7);
+    lua_pushnumber(L, s.frame);
+    lua_setfield(L, -2, "frame");
+    lua_pushnumber(L, s.calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushnumber(L, s.draws);
+    lua_setfield(L, -2, "draws");
+    lua_pushnumber(L, s.state_changes);
+    lua_setfield(L, -2, "state");
+    lua_pushnumber(L, s.redundant_binds);
+    lua_setfield(L, -2, "redundant");
+    lua_pushnumber(L, s.upload_bytes);
+    lua_setfield(L, -2, "upload");
+    lua_newtable(L);
+    for (unsigned i = 0; i < glstats_function_count(); i++) {
+        if (!s.function_calls[i]) continue;
+        lua_pushnumber(L, s.function_calls[i]);
+        lua_setfield(L, -2, glstats_function_name(i));
+    }
+    lua_setfield(L, -2, "functions");
+    return 1;
+}
+
+// ldoom.frametime.glOverlay([visible]) shows or hides the GL counts on screen
+// and returns whether they are shown.
+static int luai_frametime_gloverlay(lua_State * L) {
+    if (!lua_isnoneornil(L, 1))
+        glstats_set_overlay(lua_toboolean(L, 1));
+    lua_pushboolean(L, glstats_get_overlay());
+    return 1;
+}
+
+// ldoom.frametime.memory() returns the heap counters per subsystem:
+// { mesh = { live, peak, count, allocs, frameAllocs, frameBytes, vram, vramPeak }, ... }
+// in bytes. vram is an estimate of what the subsystem uploaded to the GPU.
+static int luai_frametime_memory(lua_State * L) {
+    lua_createtable(L, 0, MEM_TAGS);
+    for (int t = 0; t < MEM_TAGS; t++) {
+        MemTagStats s;
+        memtrack_stats(t, &s);
+        lua_createtable(L, 0, 8);
+        lua_pushnumber(L, s.live_bytes);
+        lua_setfield(L, -2, "live");
+        lua_pushnumber(L, s.peak_bytes);
+        lua_setfield(L, -2, "peak");
+        lua_pushnumber(L, s.live_count);
+        lua_setfield(L, -2, "count");
+        lua_pushnumber(L, s.total_count);
+        lua_setfield(L, -2, "allocs");
+        lua_pushnumber(L, s.frame_count);
+        lua_setfield(L, -2, "frameAllocs");
+        lua_pushnumber(L, s.frame_bytes);
+        lua_setfield(L, -2, "frameBytes");
+        lua_pushnumber(L, s.vram_bytes);
+        lua_setfield(L, -2, "vram");
+        lua_pushnumber(L, s.vram_peak);
+        lua_setfield(L, -2, "vramPeak");
+        lua_setfield(L, -2, memtrack_tag_name(t));
+    }
+    return 1;
+}
+
+static int luai_frametime_memorylog(lua_State * L) {
+    memtrack_log();
+    return 0;
+}
+
+// ldoom.frametime.arena() returns the scratch arena's high water marks in
+// bytes: { frame, peak, reserved, threads }. frame is the main thread's for
+// the last complete frame; peak is the highest of any thread.
+static int luai_frametime_arena(lua_State * L) {
+    ArenaStats s;
+    arena_stats(&s);
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, s.frame);
+    lua_setfield(L, -2, "frame");
+    lua_pushnumber(L, s.peak);
+    lua_setfield(L, -2, "peak");
+    lua_pushnumber(L, s.reserved);
+    lua_setfield(L, -2, "reserved");
+    lua_pushnumber(L, s.threads);
+    lua_setfield(L, -2, "threads");
+    return 1;
+}
+
+void luai_load_frametime() {
+    const luaL_Reg module[] = {
+        {"stats", luai_frametime_stats},
+        {"reset", luai_frametime_reset},
+        {"recent", luai_frametime_recent},
+        {"log", luai_frametime_log},
+        {"gl", luai_frametime_gl},
+        {"glOverlay", luai_frametime_gloverlay},
+        {"memory", luai_frametime_memory},
+        {"memoryLog", luai_frametime_memorylog},
+        {"arena", luai_frametime_arena},
+        {NULL, NULL}
+    };
+    luai_addsubmodule("frametime", module);
+}
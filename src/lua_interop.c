@@ -2,86 +2,294 @@
 #include "platform.h"
 #include "util.h"
 #include "console.h"
+#include "trace.h"
+#include <string.h>
 
 lua_State * globalLuaState;
 
-// Event signatures
-
 // CODE EXECUTION
 
 int luai_load(const char * file) {
-    return luaL_loadfile(globalLuaState, file);
+    return luai_loadfile_cached(globalLuaState, file);
 }
 
 int luai_do(const char * file) {
-    return luaL_dofile(globalLuaState, file);
+    return luai_loadfile_cached(globalLuaState, file) ||
+        lua_pcall(globalLuaState, 0, LUA_MULTRET, 0);
 }
 
 int luai_loadresource(const char * resource) {
-    return luaL_loadfile(globalLuaState, platform_res2file_ez(resource));
+    return luai_load(platform_res2file_ez(resource));
 }
 
 int luai_doresource(const char * resource) {
-    return luaL_dofile(globalLuaState, platform_res2file_ez(resource));
+    return luai_do(platform_res2file_ez(resource));
 }
 
 // EVENTS
 
-void luai_event(const LuaEventSignature * les, ...) {
-    va_list args;
-    va_start(args, les);
-    lua_getglobal(globalLuaState, "levent");
-    int type = lua_type(globalLuaState, -1);
-    if (type != LUA_TTABLE) {
-        return;
+// Handlers live in a hidden table behind the levent proxy. Every write to
+// levent, and every reassignment of the global itself, bumps the generation,
+// so luai_event only looks a handler up again after something changed.
+static int luai_event_store;
+static unsigned luai_event_generation = 1;
+// Refs cached before this generation belong to a closed Lua state.
+static unsigned luai_event_state_generation;
+
+// Reads go through the current store, which is replaced when levent is
+// assigned.
+static int luai_levent_index(lua_State * L) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_event_store);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+// __pairs iterates the store; upvalue 1 is next.
+static int luai_levent_pairs(lua_State * L) {
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_event_store);
+    lua_pushnil(L);
+    return 3;
+}
+
+// LuaJIT only honours __pairs when built with Lua 5.2 compatibility, so
+// pairs is replaced by one that does. Upvalue 1 is next.
+static int luai_pairs(lua_State * L) {
+    if (luaL_getmetafield(L, 1, "__pairs")) {
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 3);
+        return 3;
     }
-    lua_pushstring(globalLuaState, les->name);
-    lua_gettable(globalLuaState, -2);
-    if (lua_type(globalLuaState, -1) != LUA_TFUNCTION) {
-        lua_settop(globalLuaState, 0);
-        return;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+static int luai_levent_newindex(lua_State * L) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_event_store);
+    lua_replace(L, 1);
+    lua_rawset(L, 1);
+    luai_event_generation++;
+    return 0;
+}
+
+// levent is kept out of the globals table, so assigning it goes through here.
+static int luai_globals_newindex(lua_State * L) {
+    if (lua_type(L, 2) != LUA_TSTRING || strcmp(lua_tostring(L, 2), "levent")) {
+        lua_rawset(L, 1);
+        return 0;
+    }
+    lua_newtable(L);
+    if (lua_type(L, 3) == LUA_TTABLE) {
+        lua_pushnil(L);
+        while (lua_next(L, 3)) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -4);
+        }
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, luai_event_store);
+    luai_event_store = luaL_ref(L, LUA_REGISTRYINDEX);
+    luai_event_generation++;
+    return 0;
+}
+
+static int luai_globals_index(lua_State * L) {
+    if (lua_type(L, 2) == LUA_TSTRING && !strcmp(lua_tostring(L, 2), "levent")) {
+        lua_pushvalue(L, lua_upvalueindex(1));
+        return 1;
     }
+    return 0;
+}
+
+static void luai_event_setup(lua_State * L) {
+    lua_newtable(L);
+    luai_event_store = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newtable(L); // levent = {}
+    lua_newtable(L); // mt = {}
+    lua_pushcfunction(L, luai_levent_index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, luai_levent_newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_getglobal(L, "next");
+    lua_pushcclosure(L, luai_levent_pairs, 1);
+    lua_setfield(L, -2, "__pairs");
+    lua_setmetatable(L, -2);
+    lua_getglobal(L, "next");
+    lua_pushcclosure(L, luai_pairs, 1);
+    lua_setglobal(L, "pairs");
+    lua_newtable(L); // globals mt = {}
+    lua_insert(L, -2);
+    lua_pushcclosure(L, luai_globals_index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, luai_globals_newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_setmetatable(L, LUA_GLOBALSINDEX);
+    luai_event_state_generation = ++luai_event_generation;
+}
+
+static int luai_event_noop(lua_State * L) {
+    return 0;
+}
+
+int luai_event_push(LuaEventSignature * les) {
+    lua_State * L = globalLuaState;
+    if (les->generation != luai_event_generation) {
+        if (les->generation >= luai_event_state_generation)
+            luaL_unref(L, LUA_REGISTRYINDEX, les->ref);
+        else
+            les->profile = NULL;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, luai_event_store);
+        lua_getfield(L, -1, les->name);
+        if (lua_type(L, -1) == LUA_TFUNCTION) {
+            les->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        } else {
+            lua_pop(L, 1);
+            les->ref = LUA_NOREF;
+        }
+        lua_pop(L, 1);
+        les->generation = luai_event_generation;
+    }
+    if (les->ref > 0) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, les->ref);
+        return 1;
+    }
+    // Tasks waiting for the event still need its arguments.
+    if (luai_scheduler_waiting(les->name)) {
+        lua_pushcfunction(L, luai_event_noop);
+        return 1;
+    }
+    return 0;
+}
+
+void luai_event_call(LuaEventSignature * les, int nargs) {
+    TRACE_SCOPE(les->name);
+    lua_State * L = globalLuaState;
+    int failed;
+    if (luai_scheduler_waiting(les->name))
+        luai_scheduler_signal(L, les->name, nargs);
+    if (luai_profiler_active) {
+        if (!les->profile)
+            les->profile = luai_profiler_entry("levent", les->name);
+        double start = luai_profiler_nsec();
+        failed = lua_pcall(L, nargs, 0, 0);
+        luai_profiler_record(les->profile, luai_profiler_nsec() - start);
+    } else {
+        failed = lua_pcall(L, nargs, 0, 0);
+    }
+    if (failed) {
+        console_log("Lua Event \"%s\" failed: %s", les->name, lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+void luai_event(LuaEventSignature * les, ...) {
+    lua_State * L = globalLuaState;
+    if (!luai_event_push(les))
+        return;
+    va_list args;
+    va_start(args, les);
     for (int i = 0; i < les->num_args; i++) {
         int argtype = les->arg_types[i];
         switch (argtype) {
             case LUA_TSTRING:
-                lua_pushstring(globalLuaState, va_arg(args, const char *));
+                lua_pushstring(L, va_arg(args, const char *));
                 break;
             case LUA_TNUMBER:
-                lua_pushnumber(globalLuaState, va_arg(args, double));
+                lua_pushnumber(L, va_arg(args, double));
                 break;
             case LUA_TBOOLEAN:
-                lua_pushboolean(globalLuaState, va_arg(args, int));
+                lua_pushboolean(L, va_arg(args, int));
                 break;
             case LUA_TUSERDATA:
-                lua_pushlightuserdata(globalLuaState, va_arg(args, void *));
+                lua_pushlightuserdata(L, va_arg(args, void *));
                 break;
             default:
-                lua_pushnil(globalLuaState);
+                lua_pushnil(L);
                 break;
         }
     }
     va_end(args);
-    if(lua_pcall(globalLuaState, les->num_args, 0, 0)) {
-        console_log("Lua Event \"%s\" failed: %s", les->name, lua_tostring(globalLuaState, -1));
+    luai_event_call(les, les->num_args);
+}
+
+void luai_event0(LuaEventSignature * les) {
+    if (luai_event_push(les))
+        luai_event_call(les, 0);
+}
+
+void luai_event1n(LuaEventSignature * les, double x) {
+    if (luai_event_push(les)) {
+        lua_pushnumber(globalLuaState, x);
+        luai_event_call(les, 1);
+    }
+}
+
+static double luai_bench_nsec() {
+    return util_nsec();
+}
+
+static int luai_bench_empty(lua_State * L) {
+    return 0;
+}
+
+void luai_event_bench(unsigned iterations, LuaEventBench * result) {
+    static const int args[] = { LUA_TNUMBER };
+    LuaEventSignature les = LUAI_EVENT("__bench", 1, args);
+    lua_State * L = globalLuaState;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_event_store);
+    lua_pushcfunction(L, luai_bench_empty);
+    lua_setfield(L, -2, les.name);
+    lua_pop(L, 1);
+    luai_event_generation++;
+
+    // Looking the handler up through levent on every call, as before.
+    double t = luai_bench_nsec();
+    for (unsigned i = 0; i < iterations; i++) {
+        lua_getglobal(L, "levent");
+        lua_getfield(L, -1, les.name);
+        lua_pushnumber(L, i);
+        lua_pcall(L, 1, 0, 0);
+        lua_pop(L, 1);
     }
-    return;
+    result->lookup_nsec = (luai_bench_nsec() - t) / iterations;
+
+    t = luai_bench_nsec();
+    for (unsigned i = 0; i < iterations; i++)
+        luai_event(&les, (double) i);
+    result->vararg_nsec = (luai_bench_nsec() - t) / iterations;
+
+    t = luai_bench_nsec();
+    for (unsigned i = 0; i < iterations; i++)
+        luai_event1n(&les, i);
+    result->typed_nsec = (luai_bench_nsec() - t) / iterations;
+
+    luaL_unref(L, LUA_REGISTRYINDEX, les.ref);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_event_store);
+    lua_pushnil(L);
+    lua_setfield(L, -2, les.name);
+    lua_pop(L, 1);
+    luai_event_generation++;
 }
 
 // LUA OBJECT UTILS
 
+// Names the functions registered by luai_pushreg in profiler reports.
+static const char * luai_reg_prefix = "ldoom";
+
 void luai_pushreg(const luaL_Reg * regs) {
     lua_State * L = globalLuaState;
-    for (const luaL_Reg * r = regs; r->name != NULL; r++) {
-        lua_pushstring(L, r->name);
-        lua_pushcfunction(L, r->func);
-        lua_rawset(L, -3); // mt[name] = func
-    }
+    for (const luaL_Reg * r = regs; r->name != NULL; r++)
+        luai_profiler_setcfunction(L, -1, r->func, luai_reg_prefix, r->name); // mt[name] = func
 }
 
 void luai_newclass(const char * name, const luaL_Reg * methods, const luaL_Reg * metamethods) {
     lua_State * L = globalLuaState;
     luaL_newmetatable(L, name); // mt = {}, register metatable
+    luai_reg_prefix = name;
     if (metamethods != NULL) {
         luai_pushreg(metamethods);
     }
@@ -94,6 +302,7 @@ void luai_newclass(const char * name, const luaL_Reg * methods, const luaL_Reg *
     lua_rawset(L, -4); // mt['__index'] = index
     if (methods != NULL)
         luai_pushreg(methods);
+    luai_reg_prefix = "ldoom";
     lua_pop(L, 2);
 }
 
@@ -105,8 +314,12 @@ void luai_addsubmodule(const char * name, const luaL_Reg * regs) {
     lua_pushvalue(L, -3);
     lua_rawset(L, -3);
     lua_pop(L, 1);
+    lua_pushfstring(L, "ldoom.%s", name);
+    luai_reg_prefix = lua_tostring(L, -1);
+    lua_insert(L, -2);
     luai_pushreg(regs);
-    lua_pop(L, 1);
+    luai_reg_prefix = "ldoom";
+    lua_pop(L, 2);
 }
 
 void luai_addtomainmodule(const luaL_Reg * regs) {
@@ -116,19 +329,96 @@ void luai_addtomainmodule(const luaL_Reg * regs) {
     lua_pop(L, 1);
 }
 
+// GARBAGE COLLECTION
+
+// The collector never runs on its own. luai_gc_step does the work at the end of
+// each frame, in slices that fit what is left of the frame.
+static struct {
+    double min_budget;
+    double max_budget;
+    double emergency_kb;
+    double baseline_kb;
+    LuaGCStats stats;
+    LuaProfileEntry * profile;
+} luai_gc;
+
+static double luai_gc_count(lua_State * L) {
+    return lua_gc(L, LUA_GCCOUNT, 0) + lua_gc(L, LUA_GCCOUNTB, 0) / 1024.0;
+}
+
+void luai_gc_step(double budget) {
+    lua_State * L = globalLuaState;
+    LuaGCStats * stats = &luai_gc.stats;
+    double start = luai_profiler_nsec();
+    if (budget > luai_gc.max_budget)
+        budget = luai_gc.max_budget;
+    if (budget < luai_gc.min_budget)
+        budget = luai_gc.min_budget;
+    double deadline = start + budget * 1e9;
+    double kb = luai_gc_count(L);
+    // If stepping can't keep up with allocation, collect everything at once.
+    double emergency = luai_gc.baseline_kb * LUAI_GC_EMERGENCY_RATIO;
+    if (emergency < luai_gc.emergency_kb)
+        emergency = luai_gc.emergency_kb;
+    stats->steps = 0;
+    if (kb > emergency) {
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        stats->full_collections++;
+        luai_gc.baseline_kb = luai_gc_count(L);
+    } else {
+        do {
+            stats->steps++;
+            if (lua_gc(L, LUA_GCSTEP, 0)) {
+                stats->cycles++;
+                luai_gc.baseline_kb = luai_gc_count(L);
+                break;
+            }
+        } while (luai_profiler_nsec() < deadline);
+    }
+    // Collecting re-arms the automatic collector.
+    lua_gc(L, LUA_GCSTOP, 0);
+    double nsec = luai_profiler_nsec() - start;
+    if (luai_profiler_active) {
+        if (!luai_gc.profile)
+            luai_gc.profile = luai_profiler_entry("lua", "gc");
+        luai_profiler_record(luai_gc.profile, nsec);
+    }
+    stats->last_msec = nsec / 1e6;
+    stats->total_msec += stats->last_msec;
+    if (stats->last_msec > stats->max_msec)
+        stats->max_msec = stats->last_msec;
+    stats->kb = luai_gc_count(L);
+    if (kb > stats->peak_kb)
+        stats->peak_kb = kb;
+}
+
+void luai_gc_set_budget(double min_budget, double max_budget, double emergency_kb) {
+    luai_gc.min_budget = min_budget;
+    luai_gc.max_budget = max_budget > min_budget ? max_budget : min_budget;
+    luai_gc.emergency_kb = emergency_kb;
+}
+
+void luai_gc_stats(LuaGCStats * stats) {
+    *stats = luai_gc.stats;
+}
+
 // INITIALIZE
 
 void luai_init() {
     lua_State * L = luaL_newstate();
     globalLuaState = L;
     luaL_openlibs(L);
-    lua_newtable(L);
-    lua_setglobal(L, "levent");
+    luai_event_setup(L);
     lua_newtable(L);
     lua_setglobal(L, "ldoom");
     lua_settop(L, 0);
+    memset(&luai_gc, 0, sizeof(luai_gc));
+    luai_gc_set_budget(LUAI_GC_MIN_BUDGET, LUAI_GC_MAX_BUDGET, LUAI_GC_EMERGENCY_KB);
+    lua_gc(L, LUA_GCSTOP, 0);
 }
 
 void luai_deinit() {
+    luai_scheduler_deinit();
     lua_close(globalLuaState);
+    luai_profiler_deinit();
 }
@@ -8,12 +8,29 @@
 
 extern lua_State * globalLuaState;
 
+typedef struct LuaProfileEntry LuaProfileEntry;
+
+// Signatures cache their handler, so they must not be const. Declare them with
+// LUAI_EVENT.
 typedef struct {
     const char * name;
     int num_args;
     const int * arg_types;
+    int ref;
+    unsigned generation;
+    LuaProfileEntry * profile;
 } LuaEventSignature;
 
+#define LUAI_EVENT(NAME, NUM_ARGS, ARG_TYPES) { NAME, NUM_ARGS, ARG_TYPES, 0, 0, NULL }
+
+// Nanoseconds per dispatch of an empty handler.
+typedef struct {
+    double lookup_nsec;
+    double vararg_nsec;
+    double typed_nsec;
+} LuaEventBench;
+
+// The luai_load and luai_do functions go through the bytecode cache.
 int luai_load(const char * file);
 
 int luai_do(const char * file);
@@ -26,10 +43,126 @@ void luai_init();
 
 void luai_deinit();
 
-void luai_event(const LuaEventSignature * les, ...);
+void luai_event(LuaEventSignature * les, ...);
+
+// Typed versions of luai_event for the per frame events.
+void luai_event0(LuaEventSignature * les);
+
+void luai_event1n(LuaEventSignature * les, double x);
+
+// For arguments luai_event can't push. If luai_event_push returns 1, push the
+// arguments and finish with luai_event_call.
+int luai_event_push(LuaEventSignature * les);
+
+void luai_event_call(LuaEventSignature * les, int nargs);
+
+void luai_event_bench(unsigned iterations, LuaEventBench * result);
 
 void luai_pushreg(const luaL_Reg * regs);
 
+// BYTECODE CACHE
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long hit_usec;
+    unsigned long miss_usec;
+} LuaChunkCacheStats;
+
+// Sets the cache directory, creating it if needed. NULL picks the user's cache
+// directory. Until this is called, or if the directory can't be used, chunks
+// are compiled from source every time.
+void luai_chunkcache_init(const char * dir);
+
+void luai_chunkcache_set_enabled(int enabled);
+
+// Deletes the cached chunk for a script path. Returns 1 if there was one.
+int luai_chunkcache_remove(const char * path);
+
+// Like luaL_loadfile, but loads the compiled chunk from the cache when the
+// source hasn't changed.
+int luai_loadfile_cached(lua_State * L, const char * path);
+
+void luai_chunkcache_stats(LuaChunkCacheStats * stats);
+
+// GARBAGE COLLECTION
+
+#define LUAI_GC_MIN_BUDGET 0.0001
+#define LUAI_GC_MAX_BUDGET 0.002
+#define LUAI_GC_EMERGENCY_KB (64 * 1024)
+#define LUAI_GC_EMERGENCY_RATIO 4
+
+typedef struct {
+    double last_msec; // Time spent collecting last frame
+    double max_msec;
+    double total_msec;
+    unsigned steps; // Steps taken last frame
+    unsigned long cycles;
+    unsigned long full_collections;
+    double kb;
+    double peak_kb;
+} LuaGCStats;
+
+// Runs incremental collection for about budget seconds, clamped to the minimum
+// and maximum set with luai_gc_set_budget. If memory has grown past the
+// emergency threshold (the larger of emergency_kb and four times the heap
+// after the last cycle), it does a full collection instead.
+void luai_gc_step(double budget);
+
+void luai_gc_set_budget(double min_budget, double max_budget, double emergency_kb);
+
+void luai_gc_stats(LuaGCStats * stats);
+
+// SCHEDULER
+
+typedef struct {
+    unsigned resumed; // Tasks resumed last frame
+    unsigned tasks;
+} LuaSchedulerStats;
+
+// Resumes the tasks that are due. Called once per frame after levent.update.
+void luai_scheduler_update(double dt);
+
+void luai_scheduler_stats(LuaSchedulerStats * stats);
+
+// Frees every task. Called by luai_deinit before the state is closed.
+void luai_scheduler_deinit();
+
+// Whether any task is waiting for the named event.
+int luai_scheduler_waiting(const char * name);
+
+// Wakes the tasks waiting for an event, passing them copies of the nargs values
+// on top of L's stack.
+void luai_scheduler_signal(lua_State * L, const char * name, int nargs);
+
+// PROFILER
+
+// Set while the profiler runs; checked before timing events and GC steps.
+extern int luai_profiler_active;
+
+// Samples Lua stacks every sample_interval VM instructions, or not at all if
+// it is 0. Event, C function and GC timing is always on while profiling.
+void luai_profiler_start(int sample_interval);
+
+void luai_profiler_stop();
+
+void luai_profiler_reset();
+
+// Writes sampled stacks in the folded format used by flamegraph.pl.
+int luai_profiler_dump(const char * path);
+
+void luai_profiler_deinit();
+
+double luai_profiler_nsec();
+
+LuaProfileEntry * luai_profiler_entry(const char * prefix, const char * name);
+
+void luai_profiler_record(LuaProfileEntry * entry, double nsec);
+
+// Sets t[name] = func for the table t at index. While profiling, t[name] is
+// a wrapper that times the calls.
+void luai_profiler_setcfunction(lua_State * L, int index, lua_CFunction func, const char * prefix, const char * name);
+
 void luai_newclass(const char * name, const luaL_Reg * methods, const luaL_Reg * metamethods);
 
 void luai_addsubmodule(const char * name, const luaL_Reg * regs);
@@ -1,7 +1,656 @@
 #include "lua_interop.h"
 #include "lua_modules.h"
 #include "ldmath.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Vectors, quaternions and matrices are userdata holding the ldmath arrays, so a
+// vec3 costs 12 bytes instead of a table. Vec3Array holds many points for the
+// batch operations, which run in C.
+
+// Userdata of size n floats with the class metatable.
+static float * luai_math_new(lua_State * L, const char * class, size_t n) {
+    float * f = lua_newuserdata(L, n * sizeof(float));
+    luaL_getmetatable(L, class);
+    lua_setmetatable(L, -2);
+    return f;
+}
+
+static float * luai_math_check(lua_State * L, int index, const char * class) {
+    return luaL_checkudata(L, index, class);
+}
+
+static int luai_math_is(lua_State * L, int index, const char * class) {
+    if (!lua_getmetatable(L, index))
+        return 0;
+    luaL_getmetatable(L, class);
+    int is = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return is;
+}
+
+// Replaces the class's __index table with a function that also resolves
+// component names ("x", "y", ...) to numbers.
+static void luai_math_components(lua_State * L, const char * class, lua_CFunction index, lua_CFunction newindex) {
+    luaL_getmetatable(L, class);
+    lua_getfield(L, -1, "__index");
+    lua_pushcclosure(L, index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_pop(L, 1);
+}
+
+static int luai_math_component(lua_State * L, int n) {
+    size_t len;
+    const char * key = lua_tolstring(L, 2, &len);
+    if (lua_type(L, 2) == LUA_TSTRING && len == 1) {
+        int i = key[0] == 'w' ? 3 : key[0] - 'x';
+        if (i >= 0 && i < n)
+            return i;
+    }
+    return -1;
+}
+
+// VECTORS
+
+#define LUAI_DEF_VEC(n) \
+static float * luai_vec##n##_new(lua_State * L) { \
+    return luai_math_new(L, "ldoom.vec" #n, n); \
+} \
+static float * luai_vec##n##_check(lua_State * L, int index) { \
+    return luai_math_check(L, index, "ldoom.vec" #n); \
+} \
+static int luai_vec##n##_create(lua_State * L) { \
+    vec##n v; \
+    for (int i = 0; i < n; i++) \
+        v[i] = luaL_optnumber(L, i + 1, 0); \
+    vec##n##_assign(luai_vec##n##_new(L), v); \
+    return 1; \
+} \
+static int luai_vec##n##_index(lua_State * L) { \
+    int i = luai_math_component(L, n); \
+    if (i >= 0) { \
+        lua_pushnumber(L, luai_vec##n##_check(L, 1)[i]); \
+    } else { \
+        lua_pushvalue(L, 2); \
+        lua_gettable(L, lua_upvalueindex(1)); \
+    } \
+    return 1; \
+} \
+static int luai_vec##n##_newindex(lua_State * L) { \
+    int i = luai_math_component(L, n); \
+    luaL_argcheck(L, i >= 0, 2, "not a component"); \
+    luai_vec##n##_check(L, 1)[i] = luaL_checknumber(L, 3); \
+    return 0; \
+} \
+static int luai_vec##n##_add(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    float * b = luai_vec##n##_check(L, 2); \
+    vec##n##_add(luai_vec##n##_new(L), a, b); \
+    return 1; \
+} \
+static int luai_vec##n##_sub(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    float * b = luai_vec##n##_check(L, 2); \
+    vec##n##_sub(luai_vec##n##_new(L), a, b); \
+    return 1; \
+} \
+static int luai_vec##n##_mul(lua_State * L) { \
+    if (lua_isnumber(L, 1)) \
+        lua_insert(L, 1); \
+    float * a = luai_vec##n##_check(L, 1); \
+    float s = luaL_checknumber(L, 2); \
+    vec##n##_scale(luai_vec##n##_new(L), a, s); \
+    return 1; \
+} \
+static int luai_vec##n##_unm(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    vec##n##_scale(luai_vec##n##_new(L), a, -1); \
+    return 1; \
+} \
+static int luai_vec##n##_eq(lua_State * L) { \
+    lua_pushboolean(L, vec##n##_equal(luai_vec##n##_check(L, 1), luai_vec##n##_check(L, 2))); \
+    return 1; \
+} \
+static int luai_vec##n##_dot(lua_State * L) { \
+    lua_pushnumber(L, vec##n##_dot(luai_vec##n##_check(L, 1), luai_vec##n##_check(L, 2))); \
+    return 1; \
+} \
+static int luai_vec##n##_len(lua_State * L) { \
+    lua_pushnumber(L, vec##n##_len(luai_vec##n##_check(L, 1))); \
+    return 1; \
+} \
+static int luai_vec##n##_len2(lua_State * L) { \
+    lua_pushnumber(L, vec##n##_len2(luai_vec##n##_check(L, 1))); \
+    return 1; \
+} \
+static int luai_vec##n##_dist(lua_State * L) { \
+    vec##n d; \
+    vec##n##_sub(d, luai_vec##n##_check(L, 1), luai_vec##n##_check(L, 2)); \
+    lua_pushnumber(L, vec##n##_len(d)); \
+    return 1; \
+} \
+static int luai_vec##n##_norm(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    vec##n##_norm(luai_vec##n##_new(L), a); \
+    return 1; \
+} \
+static int luai_vec##n##_lerp(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    float * b = luai_vec##n##_check(L, 2); \
+    float t = luaL_checknumber(L, 3); \
+    float * out = luai_vec##n##_new(L); \
+    for (int i = 0; i < n; i++) \
+        out[i] = ldm_lerp(a[i], b[i], t); \
+    return 1; \
+} \
+static int luai_vec##n##_clone(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    vec##n##_assign(luai_vec##n##_new(L), a); \
+    return 1; \
+} \
+static int luai_vec##n##_set(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    for (int i = 0; i < n; i++) \
+        a[i] = luaL_optnumber(L, i + 2, a[i]); \
+    lua_settop(L, 1); \
+    return 1; \
+} \
+static int luai_vec##n##_unpack(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    for (int i = 0; i < n; i++) \
+        lua_pushnumber(L, a[i]); \
+    return n; \
+} \
+static int luai_vec##n##_tostring(lua_State * L) { \
+    float * a = luai_vec##n##_check(L, 1); \
+    lua_pushstring(L, "vec" #n "("); \
+    for (int i = 0; i < n; i++) { \
+        lua_pushnumber(L, a[i]); \
+        lua_pushstring(L, i == n - 1 ? ")" : ", "); \
+    } \
+    lua_concat(L, 2 * n + 1); \
+    return 1; \
+}
+LUAI_DEF_VEC(2)
+LUAI_DEF_VEC(3)
+LUAI_DEF_VEC(4)
+#undef LUAI_DEF_VEC
+
+#define LUAI_VEC_METHODS(n) \
+    {"add", luai_vec##n##_add}, \
+    {"sub", luai_vec##n##_sub}, \
+    {"scale", luai_vec##n##_mul}, \
+    {"dot", luai_vec##n##_dot}, \
+    {"len", luai_vec##n##_len}, \
+    {"len2", luai_vec##n##_len2}, \
+    {"dist", luai_vec##n##_dist}, \
+    {"norm", luai_vec##n##_norm}, \
+    {"lerp", luai_vec##n##_lerp}, \
+    {"clone", luai_vec##n##_clone}, \
+    {"set", luai_vec##n##_set}, \
+    {"unpack", luai_vec##n##_unpack}
+
+#define LUAI_VEC_METAMETHODS(n) \
+    {"__add", luai_vec##n##_add}, \
+    {"__sub", luai_vec##n##_sub}, \
+    {"__mul", luai_vec##n##_mul}, \
+    {"__unm", luai_vec##n##_unm}, \
+    {"__eq", luai_vec##n##_eq}, \
+    {"__tostring", luai_vec##n##_tostring}, \
+    {NULL, NULL}
+
+static int luai_vec3_cross(lua_State * L) {
+    float * a = luai_vec3_check(L, 1);
+    float * b = luai_vec3_check(L, 2);
+    vec3_cross(luai_vec3_new(L), a, b);
+    return 1;
+}
+
+// QUATERNIONS
+
+static float * luai_quat_new(lua_State * L) {
+    return luai_math_new(L, "ldoom.quat", 4);
+}
+
+static float * luai_quat_check(lua_State * L, int index) {
+    return luai_math_check(L, index, "ldoom.quat");
+}
+
+// quat() is the identity, quat(x, y, z, w) sets the components.
+static int luai_quat_create(lua_State * L) {
+    quat q;
+    quat_identity(q);
+    for (int i = 0; i < 4; i++)
+        q[i] = luaL_optnumber(L, i + 1, q[i]);
+    memcpy(luai_quat_new(L), q, sizeof(quat));
+    return 1;
+}
+
+static int luai_quat_rotation(lua_State * L) {
+    float * axis = luai_vec3_check(L, 1);
+    float angle = luaL_checknumber(L, 2);
+    quat_rot(luai_quat_new(L), axis, angle);
+    return 1;
+}
+
+static int luai_quat_index(lua_State * L) {
+    int i = luai_math_component(L, 4);
+    if (i >= 0) {
+        lua_pushnumber(L, luai_quat_check(L, 1)[i]);
+    } else {
+        lua_pushvalue(L, 2);
+        lua_gettable(L, lua_upvalueindex(1));
+    }
+    return 1;
+}
+
+static int luai_quat_newindex(lua_State * L) {
+    int i = luai_math_component(L, 4);
+    luaL_argcheck(L, i >= 0, 2, "not a component");
+    luai_quat_check(L, 1)[i] = luaL_checknumber(L, 3);
+    return 0;
+}
+
+// q * r composes rotations, q * v rotates a vec3.
+static int luai_quat_mul(lua_State * L) {
+    float * q = luai_quat_check(L, 1);
+    if (luai_math_is(L, 2, "ldoom.vec3")) {
+        float * v = lua_touserdata(L, 2);
+        quat_mul_vec3(luai_vec3_new(L), q, v);
+    } else {
+        float * r = luai_quat_check(L, 2);
+        quat_mul(luai_quat_new(L), q, r);
+    }
+    return 1;
+}
+
+static int luai_quat_norm(lua_State * L) {
+    float * q = luai_quat_check(L, 1);
+    float * out = luai_quat_new(L);
+    memcpy(out, q, sizeof(quat));
+    quat_norm(out);
+    return 1;
+}
+
+static int luai_quat_conj(lua_State * L) {
+    float * q = luai_quat_check(L, 1);
+    quat_conj(luai_quat_new(L), q);
+    return 1;
+}
+
+static int luai_quat_dot(lua_State * L) {
+    lua_pushnumber(L, quat_inner_product(luai_quat_check(L, 1), luai_quat_check(L, 2)));
+    return 1;
+}
+
+static int luai_quat_unpack(lua_State * L) {
+    float * q = luai_quat_check(L, 1);
+    for (int i = 0; i < 4; i++)
+        lua_pushnumber(L, q[i]);
+    return 4;
+}
+
+static int luai_quat_tomat4(lua_State * L);
+
+// MATRICES
+
+static float * luai_mat4_new(lua_State * L) {
+    return luai_math_new(L, "ldoom.mat4", 16);
+}
+
+static float * luai_mat4_check(lua_State * L, int index) {
+    return luai_math_check(L, index, "ldoom.mat4");
+}
+
+static int luai_quat_tomat4(lua_State * L) {
+    float * q = luai_quat_check(L, 1);
+    quat_2mat4(q, luai_mat4_new(L));
+    return 1;
+}
+
+// mat4() is the identity, mat4(...) takes 16 numbers in column major order.
+static int luai_mat4_create(lua_State * L) {
+    mat4 m;
+    mat4_identity(m);
+    if (lua_gettop(L) > 0)
+        for (int i = 0; i < 16; i++)
+            m[i] = luaL_checknumber(L, i + 1);
+    mat4_fill(luai_mat4_new(L), m);
+    return 1;
+}
+
+static int luai_mat4_translation(lua_State * L) {
+    float x = luaL_checknumber(L, 1), y = luaL_checknumber(L, 2), z = luaL_checknumber(L, 3);
+    mat4_translation(luai_mat4_new(L), x, y, z);
+    return 1;
+}
+
+static int luai_mat4_scaling(lua_State * L) {
+    float x = luaL_checknumber(L, 1);
+    float y = luaL_optnumber(L, 2, x), z = luaL_optnumber(L, 3, x);
+    mat4_scaling(luai_mat4_new(L), x, y, z);
+    return 1;
+}
+
+static int luai_mat4_rotationX(lua_State * L) {
+    float r = luaL_checknumber(L, 1);
+    mat4_rot_x(luai_mat4_new(L), r);
+    return 1;
+}
+
+static int luai_mat4_rotationY(lua_State * L) {
+    float r = luaL_checknumber(L, 1);
+    mat4_rot_y(luai_mat4_new(L), r);
+    return 1;
+}
+
+static int luai_mat4_rotationZ(lua_State * L) {
+    float r = luaL_checknumber(L, 1);
+    mat4_rot_z(luai_mat4_new(L), r);
+    return 1;
+}
+
+static int luai_mat4_perspective(lua_State * L) {
+    float fovY = luaL_checknumber(L, 1), aspect = luaL_checknumber(L, 2);
+    float zNear = luaL_checknumber(L, 3), zFar = luaL_checknumber(L, 4);
+    float * m = luai_mat4_new(L);
+    mat4_identity(m);
+    mat4_proj_perspective(m, fovY, aspect, zNear, zFar);
+    return 1;
+}
+
+static int luai_mat4_ortho(lua_State * L) {
+    float v[6];
+    for (int i = 0; i < 6; i++)
+        v[i] = luaL_checknumber(L, i + 1);
+    mat4_proj_ortho(luai_mat4_new(L), v[0], v[1], v[2], v[3], v[4], v[5]);
+    return 1;
+}
+
+static int luai_mat4_lookAt(lua_State * L) {
+    float * eye = luai_vec3_check(L, 1);
+    float * dir = luai_vec3_check(L, 2);
+    float * up = luai_vec3_check(L, 3);
+    mat4_look_vec(luai_mat4_new(L), eye, dir, up);
+    return 1;
+}
+
+static void luai_mat4_transform(float * out, const float * m, const float * v, float w) {
+    for (int r = 0; r < 4; r++)
+        out[r] = m[r] * v[0] + m[4 + r] * v[1] + m[8 + r] * v[2] + m[12 + r] * w;
+}
+
+// m * n multiplies matrices, m * v transforms a vec3 point or a vec4.
+static int luai_mat4_mul(lua_State * L) {
+    float * m = luai_mat4_check(L, 1);
+    if (luai_math_is(L, 2, "ldoom.vec3")) {
+        float out[4];
+        luai_mat4_transform(out, m, lua_touserdata(L, 2), 1);
+        memcpy(luai_vec3_new(L), out, sizeof(vec3));
+    } else if (luai_math_is(L, 2, "ldoom.vec4")) {
+        float * v = lua_touserdata(L, 2);
+        luai_mat4_transform(luai_vec4_new(L), m, v, v[3]);
+    } else {
+        float * n = luai_mat4_check(L, 2);
+        mat4_mul(luai_mat4_new(L), n, m);
+    }
+    return 1;
+}
+
+static int luai_mat4_transpose(lua_State * L) {
+    float * m = luai_mat4_check(L, 1);
+    mat4_transpose(luai_mat4_new(L), m);
+    return 1;
+}
+
+// Rows and columns start at 1.
+static int luai_mat4_get(lua_State * L) {
+    float * m = luai_mat4_check(L, 1);
+    int row = luaL_checkinteger(L, 2), col = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, row >= 1 && row <= 4, 2, "row out of range");
+    luaL_argcheck(L, col >= 1 && col <= 4, 3, "column out of range");
+    lua_pushnumber(L, mat4_get(m, row - 1, col - 1));
+    return 1;
+}
+
+static int luai_mat4_unpack(lua_State * L) {
+    float * m = luai_mat4_check(L, 1);
+    for (int i = 0; i < 16; i++)
+        lua_pushnumber(L, m[i]);
+    return 16;
+}
+
+// POINT ARRAYS
+
+// Points are stored with a stride of four floats, 16 byte aligned, so each one
+// is a single SSE load. The fourth float is padding.
+typedef struct {
+    unsigned count;
+    float * points;
+} Vec3Array;
+
+static Vec3Array * luai_vec3array_check(lua_State * L, int index) {
+    return luaL_checkudata(L, index, "ldoom.vec3array");
+}
+
+static int luai_vec3array_create(lua_State * L) {
+    int count = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, count >= 0, 1, "negative size");
+    Vec3Array * a = lua_newuserdata(L, sizeof(Vec3Array) + 15 + count * 4 * sizeof(float));
+    a->count = count;
+    a->points = (float *) (((uintptr_t) (a + 1) + 15) & ~(uintptr_t) 15);
+    memset(a->points, 0, count * 4 * sizeof(float));
+    luaL_getmetatable(L, "ldoom.vec3array");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static unsigned luai_vec3array_index(lua_State * L, Vec3Array * a, int arg) {
+    int i = luaL_checkinteger(L, arg);
+    luaL_argcheck(L, i >= 1 && (unsigned) i <= a->count, arg, "index out of range");
+    return i - 1;
+}
+
+static int luai_vec3array_size(lua_State * L) {
+    lua_pushinteger(L, luai_vec3array_check(L, 1)->count);
+    return 1;
+}
+
+static int luai_vec3array_get(lua_State * L) {
+    Vec3Array * a = luai_vec3array_check(L, 1);
+    float * p = a->points + 4 * luai_vec3array_index(L, a, 2);
+    lua_pushnumber(L, p[0]);
+    lua_pushnumber(L, p[1]);
+    lua_pushnumber(L, p[2]);
+    return 3;
+}
+
+// a:set(i, x, y, z) or a:set(i, v)
+static int luai_vec3array_set(lua_State * L) {
+    Vec3Array * a = luai_vec3array_check(L, 1);
+    float * p = a->points + 4 * luai_vec3array_index(L, a, 2);
+    if (lua_isuserdata(L, 3)) {
+        memcpy(p, luai_vec3_check(L, 3), sizeof(vec3));
+    } else {
+        p[0] = luaL_checknumber(L, 3);
+        p[1] = luaL_checknumber(L, 4);
+        p[2] = luaL_checknumber(L, 5);
+    }
+    return 0;
+}
+
+static void luai_transform_points(float * dst, const float * src, const float * m, unsigned count) {
+#ifdef __SSE2__
+    __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4);
+    __m128 c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+    for (unsigned i = 0; i < count; i++) {
+        __m128 p = _mm_load_ps(src + 4 * i);
+        __m128 r = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_shuffle_ps(p, p, 0x00)));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(p, p, 0x55)));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(p, p, 0xAA)));
+        _mm_store_ps(dst + 4 * i, r);
+    }
+#else
+    for (unsigned i = 0; i < count; i++) {
+        float out[4];
+        luai_mat4_transform(out, m, src + 4 * i, 1);
+        memcpy(dst + 4 * i, out, sizeof(out));
+    }
+#endif
+}
+
+// m:transformPoints(src[, dst]) transforms every point as a position. dst can
+// be src. Returns dst.
+static int luai_mat4_transformPoints(lua_State * L) {
+    float * m = luai_mat4_check(L, 1);
+    Vec3Array * src = luai_vec3array_check(L, 2);
+    Vec3Array * dst = lua_isnoneornil(L, 3) ? src : luai_vec3array_check(L, 3);
+    luaL_argcheck(L, dst->count >= src->count, 3, "destination too small");
+    luai_transform_points(dst->points, src->points, m, src->count);
+    lua_settop(L, lua_isnoneornil(L, 3) ? 2 : 3);
+    return 1;
+}
+
+// a:within(center, radius[, out]) counts the points within radius of center.
+// If out is given, their indices are written to out[1..count]; entries after
+// count are left alone so the table can be reused.
+static int luai_vec3array_within(lua_State * L) {
+    Vec3Array * a = luai_vec3array_check(L, 1);
+    float * c = luai_vec3_check(L, 2);
+    float r = luaL_checknumber(L, 3);
+    int out = lua_istable(L, 4);
+    float r2 = r * r;
+    unsigned count = 0;
+#ifdef __SSE2__
+    __m128 center = _mm_set_ps(0, c[2], c[1], c[0]);
+    __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+#endif
+    for (unsigned i = 0; i < a->count; i++) {
+        const float * p = a->points + 4 * i;
+#ifdef __SSE2__
+        __m128 d = _mm_and_ps(_mm_sub_ps(_mm_load_ps(p), center), mask);
+        d = _mm_mul_ps(d, d);
+        d = _mm_add_ps(d, _mm_movehl_ps(d, d));
+        d = _mm_add_ss(d, _mm_shuffle_ps(d, d, 0x55));
+        float d2 = _mm_cvtss_f32(d);
+#else
+        float dx = p[0] - c[0], dy = p[1] - c[1], dz = p[2] - c[2];
+        float d2 = dx * dx + dy * dy + dz * dz;
+#endif
+        if (d2 <= r2) {
+            count++;
+            if (out) {
+                lua_pushinteger(L, i + 1);
+                lua_rawseti(L, 4, count);
+            }
+        }
+    }
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+// dst:lerp(a, b, t) sets every point of dst between a and b.
+static int luai_vec3array_lerp(lua_State * L) {
+    Vec3Array * dst = luai_vec3array_check(L, 1);
+    Vec3Array * a = luai_vec3array_check(L, 2);
+    Vec3Array * b = luai_vec3array_check(L, 3);
+    float t = luaL_checknumber(L, 4);
+    luaL_argcheck(L, a->count == dst->count && b->count == dst->count, 1, "sizes differ");
+    unsigned n = 4 * dst->count;
+    unsigned i = 0;
+#ifdef __SSE2__
+    __m128 vt = _mm_set1_ps(t);
+    for (; i < n; i += 4) {
+        __m128 va = _mm_load_ps(a->points + i);
+        __m128 vb = _mm_load_ps(b->points + i);
+        _mm_store_ps(dst->points + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+    }
+#endif
+    for (; i < n; i++)
+        dst->points[i] = a->points[i] + (b->points[i] - a->points[i]) * t;
+    lua_settop(L, 1);
+    return 1;
+}
 
 void luai_load_math() {
+    const luaL_Reg vec2_methods[] = { LUAI_VEC_METHODS(2), {NULL, NULL} };
+    const luaL_Reg vec2_metamethods[] = { LUAI_VEC_METAMETHODS(2) };
+    const luaL_Reg vec3_methods[] = { LUAI_VEC_METHODS(3), {"cross", luai_vec3_cross}, {NULL, NULL} };
+    const luaL_Reg vec3_metamethods[] = { LUAI_VEC_METAMETHODS(3) };
+    const luaL_Reg vec4_methods[] = { LUAI_VEC_METHODS(4), {NULL, NULL} };
+    const luaL_Reg vec4_metamethods[] = { LUAI_VEC_METAMETHODS(4) };
+    luai_newclass("ldoom.vec2", vec2_methods, vec2_metamethods);
+    luai_newclass("ldoom.vec3", vec3_methods, vec3_metamethods);
+    luai_newclass("ldoom.vec4", vec4_methods, vec4_metamethods);
+
+    const luaL_Reg quat_methods[] = {
+        {"mul", luai_quat_mul},
+        {"norm", luai_quat_norm},
+        {"conj", luai_quat_conj},
+        {"dot", luai_quat_dot},
+        {"toMat4", luai_quat_tomat4},
+        {"unpack", luai_quat_unpack},
+        {NULL, NULL}
+    };
+    const luaL_Reg quat_metamethods[] = {
+        {"__mul", luai_quat_mul},
+        {NULL, NULL}
+    };
+    luai_newclass("ldoom.quat", quat_methods, quat_metamethods);
+
+    const luaL_Reg mat4_methods[] = {
+        {"mul", luai_mat4_mul},
+        {"transpose", luai_mat4_transpose},
+        {"get", luai_mat4_get},
+        {"unpack", luai_mat4_unpack},
+        {"transformPoints", luai_mat4_transformPoints},
+        {NULL, NULL}
+    };
+    const luaL_Reg mat4_metamethods[] = {
+        {"__mul", luai_mat4_mul},
+        {NULL, NULL}
+    };
+    luai_newclass("ldoom.mat4", mat4_methods, mat4_metamethods);
+
+    const luaL_Reg vec3array_methods[] = {
+        {"size", luai_vec3array_size},
+        {"get", luai_vec3array_get},
+        {"set", luai_vec3array_set},
+        {"within", luai_vec3array_within},
+        {"lerp", luai_vec3array_lerp},
+        {NULL, NULL}
+    };
+    luai_newclass("ldoom.vec3array", vec3array_methods, NULL);
+
+    lua_State * L = globalLuaState;
+    luai_math_components(L, "ldoom.vec2", luai_vec2_index, luai_vec2_newindex);
+    luai_math_components(L, "ldoom.vec3", luai_vec3_index, luai_vec3_newindex);
+    luai_math_components(L, "ldoom.vec4", luai_vec4_index, luai_vec4_newindex);
+    luai_math_components(L, "ldoom.quat", luai_quat_index, luai_quat_newindex);
 
+    const luaL_Reg module[] = {
+        {"vec2", luai_vec2_create},
+        {"vec3", luai_vec3_create},
+        {"vec4", luai_vec4_create},
+        {"quat", luai_quat_create},
+        {"rotation", luai_quat_rotation},
+        {"mat4", luai_mat4_create},
+        {"translation", luai_mat4_translation},
+        {"scaling", luai_mat4_scaling},
+        {"rotationX", luai_mat4_rotationX},
+        {"rotationY", luai_mat4_rotationY},
+        {"rotationZ", luai_mat4_rotationZ},
+        {"perspective", luai_mat4_perspective},
+        {"ortho", luai_mat4_ortho},
+        {"lookAt", luai_mat4_lookAt},
+        {"vec3array", luai_vec3array_create},
+        {NULL, NULL}
+    };
+    luai_addsubmodule("math", module);
 }
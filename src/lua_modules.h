@@ -1,8 +1,10 @@
 #ifndef LUA_MODULES_H_2TGLUHF1
 #define LUA_MODULES_H_2TGLUHF1
 
+void luai_load_ai();
 void luai_load_audio();
 void luai_load_fntdraw();
+void luai_load_frametime();
 void luai_load_quickdraw();
 void luai_load_console();
 void luai_load_platform();
@@ -11,5 +13,16 @@ void luai_load_model();
 void luai_load_camera();
 void luai_load_shader();
 void luai_load_texture();
+void luai_load_ffi();
+void luai_load_profiler();
+void luai_load_scheduler();
+void luai_load_trace();
+
+// Hands the input queued this frame to levent.input, keyboard and mouse.
+void luai_dispatch_input();
+
+// Runs think(i, dt) for every mob on the AI states and applies their commands.
+void luai_ai_update(double dt);
+void luai_ai_deinit();
 
 #endif /* end of include guard: LUA_MODULES_H_2TGLUHF1 */
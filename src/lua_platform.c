@@ -1,12 +1,36 @@
 #include "lua_interop.h"
 #include "lua_modules.h"
 #include "platform.h"
+#include "glfw.h"
+#include <string.h>
+
+static const int les_mouse_args[] = { LUA_TNUMBER, LUA_TSTRING, LUA_TNUMBER, LUA_TNUMBER };
+static LuaEventSignature les_mouse = LUAI_EVENT("mouse", 4, les_mouse_args);
+
+static const int les_keyboard_args[] = { LUA_TSTRING, LUA_TSTRING, LUA_TNUMBER, LUA_TNUMBER };
+static LuaEventSignature les_keyboard = LUAI_EVENT("keyboard", 4, les_keyboard_args);
+
+static LuaEventSignature les_input = LUAI_EVENT("input", 2, NULL);
+
+// Registry refs. Names are pushed from these tables instead of being hashed
+// again for every event.
+static int luai_key_names;
+static int luai_key_codes;
+static int luai_action_names;
+static int luai_type_names;
+// Event tables are reused every frame, so handlers must copy what they keep.
+static int luai_input_batch;
 
 static int luai_platform_quit(lua_State * L) {
     platform_exit();
     return 0;
 }
 
+static int luai_platform_isHeadless(lua_State * L) {
+    lua_pushboolean(L, platform_headless());
+    return 1;
+}
+
 static int luai_platform_getFPS(lua_State * L) {
     lua_pushnumber(L, platform_fps());
     return 1;
@@ -17,12 +41,264 @@ static int luai_platform_getDelta(lua_State * L) {
     return 1;
 }
 
+static int luai_platform_benchEvents(lua_State * L) {
+    LuaEventBench bench;
+    luai_event_bench(luaL_optinteger(L, 1, 1000000), &bench);
+    lua_pushnumber(L, bench.lookup_nsec);
+    lua_pushnumber(L, bench.vararg_nsec);
+    lua_pushnumber(L, bench.typed_nsec);
+    return 3;
+}
+
+static int luai_platform_isKeyDown(lua_State * L) {
+    int key;
+    if (lua_type(L, 1) == LUA_TNUMBER) {
+        key = lua_tointeger(L, 1);
+    } else {
+        luaL_checkstring(L, 1);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, luai_key_codes);
+        lua_pushvalue(L, 1);
+        lua_rawget(L, -2);
+        key = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : -1;
+    }
+    lua_pushboolean(L, platform_key_down(key));
+    return 1;
+}
+
+static int luai_platform_isMouseDown(lua_State * L) {
+    lua_pushboolean(L, platform_mouse_down(luaL_checkinteger(L, 1)));
+    return 1;
+}
+
+static int luai_platform_getCursor(lua_State * L) {
+    double x, y;
+    platform_cursor(&x, &y);
+    lua_pushnumber(L, x);
+    lua_pushnumber(L, y);
+    return 2;
+}
+
+static int luai_platform_gcStats(lua_State * L) {
+    LuaGCStats stats;
+    luai_gc_stats(&stats);
+    lua_createtable(L, 0, 8);
+    lua_pushnumber(L, stats.last_msec);
+    lua_setfield(L, -2, "ms");
+    lua_pushnumber(L, stats.max_msec);
+    lua_setfield(L, -2, "maxMs");
+    lua_pushnumber(L, stats.total_msec);
+    lua_setfield(L, -2, "totalMs");
+    lua_pushnumber(L, stats.steps);
+    lua_setfield(L, -2, "steps");
+    lua_pushnumber(L, stats.cycles);
+    lua_setfield(L, -2, "cycles");
+    lua_pushnumber(L, stats.full_collections);
+    lua_setfield(L, -2, "fullCollections");
+    lua_pushnumber(L, stats.kb);
+    lua_setfield(L, -2, "kb");
+    lua_pushnumber(L, stats.peak_kb);
+    lua_setfield(L, -2, "peakKb");
+    return 1;
+}
+
+// ldoom.setGCBudget(minMs, maxMs[, emergencyMb])
+static int luai_platform_setGCBudget(lua_State * L) {
+    double min = luaL_checknumber(L, 1) / 1000;
+    double max = luaL_checknumber(L, 2) / 1000;
+    double emergency = luaL_optnumber(L, 3, LUAI_GC_EMERGENCY_KB / 1024) * 1024;
+    luai_gc_set_budget(min, max, emergency);
+    return 0;
+}
+
+// ldoom.loadScript(path) is loadfile through the bytecode cache.
+static int luai_platform_loadScript(lua_State * L) {
+    if (luai_loadfile_cached(L, luaL_checkstring(L, 1))) {
+        lua_pushnil(L);
+        lua_insert(L, -2);
+        return 2;
+    }
+    return 1;
+}
+
+// ldoom.dropScriptCache(path) deletes the cached chunk for path.
+static int luai_platform_dropScriptCache(lua_State * L) {
+    lua_pushboolean(L, luai_chunkcache_remove(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+static int luai_platform_scriptCacheStats(lua_State * L) {
+    LuaChunkCacheStats stats;
+    luai_chunkcache_stats(&stats);
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, stats.hit_usec / 1000.0);
+    lua_setfield(L, -2, "hitMs");
+    lua_pushnumber(L, stats.miss_usec / 1000.0);
+    lua_setfield(L, -2, "missMs");
+    return 1;
+}
+
+static void luai_input_setname(lua_State * L, int names, int code, const char * field) {
+    lua_rawgeti(L, names, code);
+    lua_setfield(L, -2, field);
+}
+
+static void luai_input_setnumber(lua_State * L, double x, const char * field) {
+    lua_pushnumber(L, x);
+    lua_setfield(L, -2, field);
+}
+
+static void luai_input_setnil(lua_State * L, const char * field) {
+    lua_pushnil(L);
+    lua_setfield(L, -2, field);
+}
+
+static void luai_input_batch_fill(lua_State * L, const PlatformInputEvent * events, unsigned count) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_input_batch);
+    int batch = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_key_names);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_action_names);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_type_names);
+    int keys = batch + 1, actions = batch + 2, types = batch + 3;
+    for (unsigned i = 0; i < count; i++) {
+        const PlatformInputEvent * e = events + i;
+        lua_rawgeti(L, batch, i + 1);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            lua_createtable(L, 0, 11);
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, batch, i + 1);
+        }
+        luai_input_setname(L, types, e->type, "type");
+        luai_input_setnumber(L, e->time, "time");
+        luai_input_setnumber(L, e->x, "x");
+        luai_input_setnumber(L, e->y, "y");
+        luai_input_setnumber(L, e->dx, "dx");
+        luai_input_setnumber(L, e->dy, "dy");
+        luai_input_setnumber(L, e->mods, "mods");
+        if (e->type == PLATFORM_INPUT_KEY) {
+            luai_input_setname(L, keys, e->code, "key");
+            luai_input_setnumber(L, e->scancode, "scancode");
+        } else {
+            luai_input_setnil(L, "key");
+            luai_input_setnil(L, "scancode");
+        }
+        if (e->type == PLATFORM_INPUT_MOUSE)
+            luai_input_setnumber(L, e->code, "button");
+        else
+            luai_input_setnil(L, "button");
+        if (e->type == PLATFORM_INPUT_KEY || e->type == PLATFORM_INPUT_MOUSE)
+            luai_input_setname(L, actions, e->action, "action");
+        else
+            luai_input_setnil(L, "action");
+        lua_pop(L, 1);
+    }
+    lua_settop(L, batch);
+}
+
+// Pushes the interned name of code from the table at index names. Codes
+// without an entry get the name at fallback.
+static void luai_input_pushname(lua_State * L, int names, int code, int fallback) {
+    lua_rawgeti(L, names, code);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_rawgeti(L, names, fallback);
+    }
+}
+
+void luai_dispatch_input() {
+    const PlatformInputEvent * events;
+    unsigned count = platform_input_events(&events);
+    if (!count)
+        return;
+    lua_State * L = globalLuaState;
+    int top = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_key_names);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_action_names);
+    int keys = top + 1, actions = top + 2;
+    for (unsigned i = 0; i < count; i++) {
+        const PlatformInputEvent * e = events + i;
+        if (e->type == PLATFORM_INPUT_KEY) {
+            if (!luai_event_push(&les_keyboard))
+                continue;
+            luai_input_pushname(L, keys, e->code, GLFW_KEY_UNKNOWN);
+            lua_rawgeti(L, actions, e->action);
+            lua_pushnumber(L, e->scancode);
+            lua_pushnumber(L, e->mods);
+            luai_event_call(&les_keyboard, 4);
+        } else if (e->type == PLATFORM_INPUT_MOUSE) {
+            if (!luai_event_push(&les_mouse))
+                continue;
+            lua_pushnumber(L, e->code);
+            lua_rawgeti(L, actions, e->action);
+            lua_pushnumber(L, e->x);
+            lua_pushnumber(L, e->y);
+            luai_event_call(&les_mouse, 4);
+        }
+    }
+    lua_settop(L, top);
+    if (luai_event_push(&les_input)) {
+        luai_input_batch_fill(L, events, count);
+        lua_pushinteger(L, count);
+        luai_event_call(&les_input, 2);
+    }
+}
+
+static void luai_input_tables(lua_State * L) {
+    lua_newtable(L);
+    lua_newtable(L);
+    for (int key = GLFW_KEY_UNKNOWN; key <= GLFW_KEY_LAST; key++) {
+        const char * name = platform_get_key(key);
+        lua_pushstring(L, name);
+        lua_rawseti(L, -3, key);
+        if (key != GLFW_KEY_UNKNOWN && !strcmp(name, "unknown"))
+            continue;
+        lua_pushinteger(L, key);
+        lua_setfield(L, -2, name);
+    }
+    luai_key_codes = luaL_ref(L, LUA_REGISTRYINDEX);
+    luai_key_names = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_newtable(L);
+    const int actions[] = { GLFW_PRESS, GLFW_RELEASE, GLFW_REPEAT };
+    for (int i = 0; i < 3; i++) {
+        lua_pushstring(L, platform_get_action(actions[i]));
+        lua_rawseti(L, -2, actions[i]);
+    }
+    luai_action_names = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_newtable(L);
+    const char * types[] = { "key", "mouse", "cursor", "scroll" };
+    for (int i = 0; i < 4; i++) {
+        lua_pushstring(L, types[i]);
+        lua_rawseti(L, -2, i);
+    }
+    luai_type_names = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_createtable(L, PLATFORM_INPUT_QUEUE, 0);
+    luai_input_batch = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
 void luai_load_platform() {
     const luaL_Reg module[] = {
         {"quit", luai_platform_quit},
         {"getDelta", luai_platform_getDelta},
         {"getFPS", luai_platform_getFPS},
+        {"isHeadless", luai_platform_isHeadless},
+        {"benchEvents", luai_platform_benchEvents},
+        {"isKeyDown", luai_platform_isKeyDown},
+        {"isMouseDown", luai_platform_isMouseDown},
+        {"getCursor", luai_platform_getCursor},
+        {"gcStats", luai_platform_gcStats},
+        {"setGCBudget", luai_platform_setGCBudget},
+        {"loadScript", luai_platform_loadScript},
+        {"dropScriptCache", luai_platform_dropScriptCache},
+        {"scriptCacheStats", luai_platform_scriptCacheStats},
         {NULL, NULL}
     };
     luai_addtomainmodule(module);
+    luai_input_tables(globalLuaState);
 }
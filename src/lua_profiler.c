@@ -0,0 +1,316 @@
+#include "lua_interop.h"
+#include "lua_modules.h"
+#include "arena.h"
+#include "util.h"
+#include "memtrack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lua profiler. Event dispatches, bound C functions and GC steps are timed
+// exactly, and a count hook samples Lua stacks for flame graphs. Bound
+// functions are only wrapped while the profiler runs: starting it swaps a
+// timing closure into every table a function was registered in, and stopping
+// it puts the plain function back. When the profiler is off, bindings cost
+// nothing extra and events and GC steps pay a flag check.
+//
+// A script that keeps its own reference to a binding keeps whichever version
+// it was given. Copies taken while the profiler is off are never timed.
+//
+// LuaJIT doesn't run hooks inside compiled traces, so samples favour code
+// running in the interpreter. The instrumented timings are unaffected.
+
+#define LUAI_PROFILER_BUCKETS 1024
+#define LUAI_PROFILER_DEPTH 64
+#define LUAI_PROFILER_STACK 2048
+
+struct LuaProfileEntry {
+    char * name;
+    lua_CFunction func;
+    // Where func was registered: a registry ref to the table, and the key,
+    // which points into name.
+    int table;
+    const char * key;
+    unsigned long calls;
+    double total_nsec;
+    double max_nsec;
+};
+
+typedef struct LuaProfileSample {
+    unsigned long hash;
+    unsigned long count;
+    struct LuaProfileSample * next;
+    char stack[];
+} LuaProfileSample;
+
+int luai_profiler_active;
+
+static struct {
+    LuaProfileEntry ** entries;
+    unsigned entry_count;
+    unsigned entry_capacity;
+    LuaProfileSample * samples[LUAI_PROFILER_BUCKETS];
+    unsigned long sample_count;
+    int sample_interval;
+} luai_profiler;
+
+double luai_profiler_nsec() {
+    return util_nsec();
+}
+
+LuaProfileEntry * luai_profiler_entry(const char * prefix, const char * name) {
+    LuaProfileEntry * e = tcalloc(MEM_TAG_TOOLS, 1, sizeof(LuaProfileEntry));
+    size_t len = strlen(prefix) + strlen(name) + 2;
+    e->name = tmalloc(MEM_TAG_TOOLS, len);
+    snprintf(e->name, len, "%s.%s", prefix, name);
+    e->table = LUA_NOREF;
+    if (luai_profiler.entry_count == luai_profiler.entry_capacity) {
+        luai_profiler.entry_capacity = luai_profiler.entry_capacity * 2 + 64;
+        luai_profiler.entries = trealloc(MEM_TAG_TOOLS, luai_profiler.entries,
+                luai_profiler.entry_capacity * sizeof(LuaProfileEntry *));
+    }
+    luai_profiler.entries[luai_profiler.entry_count++] = e;
+    return e;
+}
+
+void luai_profiler_record(LuaProfileEntry * e, double nsec) {
+    e->calls++;
+    e->total_nsec += nsec;
+    if (nsec > e->max_nsec)
+        e->max_nsec = nsec;
+}
+
+static int luai_profiled_cfunction(lua_State * L) {
+    LuaProfileEntry * e = lua_touserdata(L, lua_upvalueindex(1));
+    if (!luai_profiler_active)
+        return e->func(L);
+    double start = luai_profiler_nsec();
+    int results = e->func(L);
+    luai_profiler_record(e, luai_profiler_nsec() - start);
+    return results;
+}
+
+void luai_profiler_setcfunction(lua_State * L, int index, lua_CFunction func, const char * prefix, const char * name) {
+    if (index < 0 && index > LUA_REGISTRYINDEX)
+        index = lua_gettop(L) + index + 1;
+    LuaProfileEntry * e = luai_profiler_entry(prefix, name);
+    e->func = func;
+    e->key = e->name + strlen(prefix) + 1;
+    lua_pushvalue(L, index);
+    e->table = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushstring(L, name);
+    lua_pushcfunction(L, func);
+    lua_rawset(L, index);
+}
+
+// Swaps the timing closures in or out. A key that a script has since set to
+// something else is left alone.
+static void luai_profiler_wrap(lua_State * L, int wrap) {
+    for (unsigned i = 0; i < luai_profiler.entry_count; i++) {
+        LuaProfileEntry * e = luai_profiler.entries[i];
+        if (e->table == LUA_NOREF)
+            continue;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, e->table);
+        lua_pushstring(L, e->key);
+        lua_rawget(L, -2);
+        lua_CFunction current = lua_tocfunction(L, -1);
+        lua_pop(L, 1);
+        if (current == (wrap ? e->func : luai_profiled_cfunction)) {
+            lua_pushstring(L, e->key);
+            if (wrap) {
+                lua_pushlightuserdata(L, e);
+                lua_pushcclosure(L, luai_profiled_cfunction, 1);
+            } else {
+                lua_pushcfunction(L, e->func);
+            }
+            lua_rawset(L, -3);
+        }
+        lua_pop(L, 1);
+    }
+}
+
+// SAMPLING
+
+static size_t luai_profiler_frame(lua_State * L, lua_Debug * ar, char * buf, size_t len) {
+    lua_getinfo(L, "Sn", ar);
+    const char * name = ar->name ? ar->name : "?";
+    int n;
+    if (*ar->what == 'C')
+        n = snprintf(buf, len, "[C] %s", name);
+    else if (*ar->what == 'm')
+        n = snprintf(buf, len, "%s", ar->short_src);
+    else
+        n = snprintf(buf, len, "%s %s:%d", name, ar->short_src, ar->linedefined);
+    if (n < 0)
+        return 0;
+    if ((size_t) n >= len)
+        n = len - 1;
+    // Semicolons separate frames in the folded format.
+    for (int i = 0; i < n; i++)
+        if (buf[i] == ';')
+            buf[i] = ':';
+    return n;
+}
+
+static void luai_profiler_hook(lua_State * L, lua_Debug * hookar) {
+    lua_Debug frames[LUAI_PROFILER_DEPTH];
+    int depth = 0;
+    while (depth < LUAI_PROFILER_DEPTH && lua_getstack(L, depth, frames + depth))
+        depth++;
+    char stack[LUAI_PROFILER_STACK];
+    size_t len = 0;
+    for (int i = depth - 1; i >= 0 && len + 2 < sizeof(stack); i--) {
+        if (len)
+            stack[len++] = ';';
+        len += luai_profiler_frame(L, frames + i, stack + len, sizeof(stack) - len);
+    }
+    stack[len] = 0;
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < len; i++)
+        hash = hash * 33 + (unsigned char) stack[i];
+    LuaProfileSample ** bucket = luai_profiler.samples + hash % LUAI_PROFILER_BUCKETS;
+    for (LuaProfileSample * s = *bucket; s; s = s->next) {
+        if (s->hash == hash && !strcmp(s->stack, stack)) {
+            s->count++;
+            luai_profiler.sample_count++;
+            return;
+        }
+    }
+    LuaProfileSample * s = tmalloc(MEM_TAG_TOOLS, sizeof(LuaProfileSample) + len + 1);
+    s->hash = hash;
+    s->count = 1;
+    memcpy(s->stack, stack, len + 1);
+    s->next = *bucket;
+    *bucket = s;
+    luai_profiler.sample_count++;
+}
+
+// CONTROL
+
+void luai_profiler_start(int sample_interval) {
+    if (!luai_profiler_active)
+        luai_profiler_wrap(globalLuaState, 1);
+    luai_profiler_active = 1;
+    luai_profiler.sample_interval = sample_interval;
+    if (sample_interval > 0)
+        lua_sethook(globalLuaState, luai_profiler_hook, LUA_MASKCOUNT, sample_interval);
+}
+
+void luai_profiler_stop() {
+    if (luai_profiler_active)
+        luai_profiler_wrap(globalLuaState, 0);
+    luai_profiler_active = 0;
+    lua_sethook(globalLuaState, NULL, 0, 0);
+}
+
+void luai_profiler_reset() {
+    for (unsigned i = 0; i < luai_profiler.entry_count; i++) {
+        LuaProfileEntry * e = luai_profiler.entries[i];
+        e->calls = 0;
+        e->total_nsec = e->max_nsec = 0;
+    }
+    for (int i = 0; i < LUAI_PROFILER_BUCKETS; i++) {
+        LuaProfileSample * s = luai_profiler.samples[i];
+        while (s) {
+            LuaProfileSample * next = s->next;
+            tfree(s);
+            s = next;
+        }
+        luai_profiler.samples[i] = NULL;
+    }
+    luai_profiler.sample_count = 0;
+}
+
+int luai_profiler_dump(const char * path) {
+    FILE * f = fopen(path, "w");
+    if (!f)
+        return 0;
+    for (int i = 0; i < LUAI_PROFILER_BUCKETS; i++)
+        for (LuaProfileSample * s = luai_profiler.samples[i]; s; s = s->next)
+            fprintf(f, "%s %lu\n", s->stack, s->count);
+    return fclose(f) == 0;
+}
+
+void luai_profiler_deinit() {
+    luai_profiler_active = 0;
+    luai_profiler_reset();
+    for (unsigned i = 0; i < luai_profiler.entry_count; i++) {
+        tfree(luai_profiler.entries[i]->name);
+        tfree(luai_profiler.entries[i]);
+    }
+    tfree(luai_profiler.entries);
+    luai_profiler.entries = NULL;
+    luai_profiler.entry_count = luai_profiler.entry_capacity = 0;
+}
+
+// LUA API
+
+static int luai_profiler_compare(const void * a, const void * b) {
+    const LuaProfileEntry * ea = *(const LuaProfileEntry **) a;
+    const LuaProfileEntry * eb = *(const LuaProfileEntry **) b;
+    return (ea->total_nsec < eb->total_nsec) - (ea->total_nsec > eb->total_nsec);
+}
+
+static int luai_profiler_lstart(lua_State * L) {
+    luai_profiler_start(luaL_optinteger(L, 1, 1000));
+    return 0;
+}
+
+static int luai_profiler_lstop(lua_State * L) {
+    luai_profiler_stop();
+    return 0;
+}
+
+static int luai_profiler_lreset(lua_State * L) {
+    luai_profiler_reset();
+    return 0;
+}
+
+// Returns { samples = n, { name, calls, ms, maxMs }, ... } sorted by total time.
+static int luai_profiler_lreport(lua_State * L) {
+    unsigned n = luai_profiler.entry_count;
+    // The arena is reclaimed at the end of the frame even if a Lua error
+    // skips the reset.
+    ArenaMark mark = arena_mark();
+    LuaProfileEntry ** sorted = arena_alloc((n + 1) * sizeof(LuaProfileEntry *));
+    memcpy(sorted, luai_profiler.entries, n * sizeof(LuaProfileEntry *));
+    qsort(sorted, n, sizeof(LuaProfileEntry *), luai_profiler_compare);
+    lua_newtable(L);
+    lua_pushnumber(L, luai_profiler.sample_count);
+    lua_setfield(L, -2, "samples");
+    int row = 1;
+    for (unsigned i = 0; i < n; i++) {
+        LuaProfileEntry * e = sorted[i];
+        if (!e->calls)
+            continue;
+        lua_createtable(L, 0, 4);
+        lua_pushstring(L, e->name);
+        lua_setfield(L, -2, "name");
+        lua_pushnumber(L, e->calls);
+        lua_setfield(L, -2, "calls");
+        lua_pushnumber(L, e->total_nsec / 1e6);
+        lua_setfield(L, -2, "ms");
+        lua_pushnumber(L, e->max_nsec / 1e6);
+        lua_setfield(L, -2, "maxMs");
+        lua_rawseti(L, -2, row++);
+    }
+    arena_reset(mark);
+    return 1;
+}
+
+static int luai_profiler_ldump(lua_State * L) {
+    lua_pushboolean(L, luai_profiler_dump(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+void luai_load_profiler() {
+    const luaL_Reg module[] = {
+        {"start", luai_profiler_lstart},
+        {"stop", luai_profiler_lstop},
+        {"reset", luai_profiler_lreset},
+        {"report", luai_profiler_lreport},
+        {"dump", luai_profiler_ldump},
+        {NULL, NULL}
+    };
+    luai_addsubmodule("profiler", module);
+}
@@ -0,0 +1,435 @@
+#include "lua_interop.h"
+#include "lua_modules.h"
+#include "console.h"
+#include "memtrack.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Coroutine scheduler. Scripts spawn functions as tasks, which can sleep for a
+// time or a number of frames, wait for an event, or await a callback. Sleeping
+// tasks sit in two level timer wheels. The first level holds the next 256
+// ticks, and the second holds later tasks in slots of 256 ticks each, which
+// are moved down as the first level comes around to them. A task only costs
+// anything when it is due or its second level slot is reached, which for the
+// time wheel is every 256 * 256 * 4 ms, about 4.4 minutes. Tasks run between
+// levent.update and levent.draw.
+
+#define LUAI_WHEEL_SIZE 256
+#define LUAI_SCHED_TICK 0.004
+
+enum {
+    LUAI_TASK_READY,
+    LUAI_TASK_TIME,
+    LUAI_TASK_FRAMES,
+    LUAI_TASK_EVENT,
+    LUAI_TASK_AWAIT,
+    LUAI_TASK_RUNNING
+};
+
+typedef struct LuaTask {
+    lua_State * thread;
+    int ref;
+    int state;
+    int cancelled;
+    unsigned nargs;
+    unsigned long due;
+    unsigned long await_id;
+    int results; // Registry ref to the values an await resolved with
+    char * event;
+    struct LuaTask * next;
+} LuaTask;
+
+typedef struct {
+    LuaTask * slots[LUAI_WHEEL_SIZE]; // By due tick
+    LuaTask * overflow[LUAI_WHEEL_SIZE]; // By due tick / LUAI_WHEEL_SIZE
+    unsigned long tick;
+} LuaTimerWheel;
+
+typedef struct {
+    LuaTask * head;
+    LuaTask * tail;
+} LuaTaskList;
+
+static struct {
+    LuaTimerWheel time_wheel;
+    LuaTimerWheel frame_wheel;
+    double time;
+    LuaTaskList ready;
+    LuaTask * event_waiters;
+    unsigned event_waiter_count;
+    LuaTask * current;
+    unsigned long next_await_id;
+    int tasks; // Registry ref to thread -> task lightuserdata
+    LuaSchedulerStats stats;
+} luai_sched;
+
+static void luai_tasklist_push(LuaTaskList * list, LuaTask * task) {
+    task->next = NULL;
+    if (list->tail)
+        list->tail->next = task;
+    else
+        list->head = task;
+    list->tail = task;
+}
+
+static void luai_wheel_file(LuaTimerWheel * w, LuaTask * task) {
+    LuaTask ** slot = task->due - w->tick < LUAI_WHEEL_SIZE ?
+        w->slots + task->due % LUAI_WHEEL_SIZE :
+        w->overflow + task->due / LUAI_WHEEL_SIZE % LUAI_WHEEL_SIZE;
+    task->next = *slot;
+    *slot = task;
+}
+
+static void luai_wheel_insert(LuaTimerWheel * w, LuaTask * task, unsigned long ticks) {
+    task->due = w->tick + (ticks ? ticks : 1);
+    luai_wheel_file(w, task);
+}
+
+// Moves every task due by tick to the ready list. Each slot only holds the
+// tasks hashed to it, so a tick touches few tasks no matter how many sleep.
+static void luai_wheel_advance(LuaTimerWheel * w, unsigned long tick) {
+    while (w->tick < tick) {
+        w->tick++;
+        // Entering a new revolution, so bring its second level slot down.
+        // Tasks more than a full second level revolution away go back up.
+        if (w->tick % LUAI_WHEEL_SIZE == 0) {
+            LuaTask ** slot = w->overflow + w->tick / LUAI_WHEEL_SIZE % LUAI_WHEEL_SIZE;
+            LuaTask * task = *slot;
+            *slot = NULL;
+            while (task) {
+                LuaTask * next = task->next;
+                luai_wheel_file(w, task);
+                task = next;
+            }
+        }
+        LuaTask ** link = w->slots + w->tick % LUAI_WHEEL_SIZE;
+        while (*link) {
+            LuaTask * task = *link;
+            if (task->due <= w->tick) {
+                *link = task->next;
+                task->state = LUAI_TASK_READY;
+                luai_tasklist_push(&luai_sched.ready, task);
+            } else {
+                link = &task->next;
+            }
+        }
+    }
+}
+
+static void luai_task_free(lua_State * L, LuaTask * task) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_sched.tasks);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, task->ref);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, task->ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, task->results);
+    tfree(task->event);
+    tfree(task);
+    luai_sched.stats.tasks--;
+}
+
+static LuaTask * luai_task_find(lua_State * L, int index) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_sched.tasks);
+    lua_pushvalue(L, index);
+    lua_rawget(L, -2);
+    LuaTask * task = lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    return task;
+}
+
+// The task running L, or an error if L isn't a task.
+static LuaTask * luai_task_current(lua_State * L) {
+    LuaTask * task = luai_sched.current;
+    if (!task || task->thread != L)
+        luaL_error(L, "not called from a task started with ldoom.spawn");
+    return task;
+}
+
+// Files a task that just yielded according to what it is waiting for.
+static void luai_task_park(LuaTask * task) {
+    switch (task->state) {
+        case LUAI_TASK_TIME:
+        case LUAI_TASK_FRAMES:
+            luai_wheel_insert(task->state == LUAI_TASK_TIME ?
+                    &luai_sched.time_wheel : &luai_sched.frame_wheel, task, task->due);
+            break;
+        case LUAI_TASK_EVENT:
+            task->next = luai_sched.event_waiters;
+            luai_sched.event_waiters = task;
+            luai_sched.event_waiter_count++;
+            break;
+        case LUAI_TASK_AWAIT:
+            break;
+        default: // A plain coroutine.yield waits a frame.
+            task->state = LUAI_TASK_FRAMES;
+            luai_wheel_insert(&luai_sched.frame_wheel, task, 1);
+            break;
+    }
+}
+
+static void luai_task_resume(lua_State * L, LuaTask * task) {
+    lua_State * T = task->thread;
+    if (task->results != LUA_NOREF) {
+        lua_rawgeti(T, LUA_REGISTRYINDEX, task->results);
+        int n = lua_objlen(T, -1);
+        for (int i = 1; i <= n; i++)
+            lua_rawgeti(T, -i, i);
+        lua_remove(T, -n - 1);
+        task->nargs += n;
+        luaL_unref(L, LUA_REGISTRYINDEX, task->results);
+        task->results = LUA_NOREF;
+    }
+    task->state = LUAI_TASK_RUNNING;
+    luai_sched.current = task;
+    int status = lua_resume(T, task->nargs);
+    luai_sched.current = NULL;
+    task->nargs = 0;
+    luai_sched.stats.resumed++;
+    if (status == LUA_YIELD && !task->cancelled) {
+        lua_settop(T, 0);
+        luai_task_park(task);
+        return;
+    }
+    if (status && status != LUA_YIELD)
+        console_log("Task failed: %s", lua_tostring(T, -1));
+    luai_task_free(L, task);
+}
+
+void luai_scheduler_update(double dt) {
+    lua_State * L = globalLuaState;
+    luai_sched.stats.resumed = 0;
+    luai_sched.time += dt;
+    luai_wheel_advance(&luai_sched.time_wheel, (unsigned long) (luai_sched.time / LUAI_SCHED_TICK));
+    luai_wheel_advance(&luai_sched.frame_wheel, luai_sched.frame_wheel.tick + 1);
+    // Tasks made ready while this runs wait for the next frame.
+    LuaTask * task = luai_sched.ready.head;
+    luai_sched.ready.head = luai_sched.ready.tail = NULL;
+    while (task) {
+        LuaTask * next = task->next;
+        if (task->cancelled)
+            luai_task_free(L, task);
+        else
+            luai_task_resume(L, task);
+        task = next;
+    }
+}
+
+void luai_scheduler_stats(LuaSchedulerStats * stats) {
+    *stats = luai_sched.stats;
+}
+
+// EVENTS
+
+int luai_scheduler_waiting(const char * name) {
+    if (!luai_sched.event_waiter_count)
+        return 0;
+    for (LuaTask * t = luai_sched.event_waiters; t; t = t->next)
+        if (!strcmp(t->event, name))
+            return 1;
+    return 0;
+}
+
+// Wakes the tasks waiting for an event with the nargs values on top of L.
+void luai_scheduler_signal(lua_State * L, const char * name, int nargs) {
+    int first = lua_gettop(L) - nargs + 1;
+    LuaTask ** link = &luai_sched.event_waiters;
+    while (*link) {
+        LuaTask * task = *link;
+        if (strcmp(task->event, name)) {
+            link = &task->next;
+            continue;
+        }
+        *link = task->next;
+        luai_sched.event_waiter_count--;
+        for (int i = 0; i < nargs; i++)
+            lua_pushvalue(L, first + i);
+        lua_xmove(L, task->thread, nargs);
+        task->nargs = nargs;
+        task->state = LUAI_TASK_READY;
+        luai_tasklist_push(&luai_sched.ready, task);
+    }
+}
+
+// LUA API
+
+// ldoom.spawn(f, ...) runs f as a task, starting this frame. Returns its thread.
+static int luai_sched_spawn(lua_State * L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int nargs = lua_gettop(L);
+    lua_State * T = lua_newthread(L);
+    LuaTask * task = tcalloc(MEM_TAG_MISC, 1, sizeof(LuaTask));
+    if (!task)
+        return luaL_error(L, "could not allocate a task");
+    task->thread = T;
+    task->results = LUA_NOREF;
+    lua_pushvalue(L, -1);
+    task->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_sched.tasks);
+    lua_pushvalue(L, -2);
+    lua_pushlightuserdata(L, task);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_insert(L, 1); // thread, f, ...
+    for (int i = 2; i <= nargs + 1; i++)
+        lua_pushvalue(L, i);
+    lua_xmove(L, T, nargs);
+    task->nargs = nargs - 1;
+    task->state = LUAI_TASK_READY;
+    luai_tasklist_push(&luai_sched.ready, task);
+    luai_sched.stats.tasks++;
+    lua_settop(L, 1);
+    return 1;
+}
+
+// ldoom.wait(seconds)
+static int luai_sched_wait(lua_State * L) {
+    LuaTask * task = luai_task_current(L);
+    double seconds = luaL_checknumber(L, 1);
+    // Due time is counted from the current tick, so round up.
+    task->due = seconds > 0 ? (unsigned long) (seconds / LUAI_SCHED_TICK) + 1 : 1;
+    task->state = LUAI_TASK_TIME;
+    return lua_yield(L, 0);
+}
+
+// ldoom.waitFrames([n]) resumes after n frames, one by default.
+static int luai_sched_waitFrames(lua_State * L) {
+    LuaTask * task = luai_task_current(L);
+    int frames = luaL_optinteger(L, 1, 1);
+    task->due = frames > 0 ? frames : 1;
+    task->state = LUAI_TASK_FRAMES;
+    return lua_yield(L, 0);
+}
+
+// ldoom.waitEvent(name) returns the arguments of the next levent dispatch or
+// ldoom.signal of that name.
+static int luai_sched_waitEvent(lua_State * L) {
+    LuaTask * task = luai_task_current(L);
+    const char * name = luaL_checkstring(L, 1);
+    tfree(task->event);
+    task->event = tstrdup(MEM_TAG_MISC, name);
+    if (!task->event)
+        return luaL_error(L, "could not allocate a task");
+    task->state = LUAI_TASK_EVENT;
+    return lua_yield(L, 0);
+}
+
+// ldoom.signal(name, ...)
+static int luai_sched_signal(lua_State * L) {
+    const char * name = luaL_checkstring(L, 1);
+    if (luai_scheduler_waiting(name))
+        luai_scheduler_signal(L, name, lua_gettop(L) - 1);
+    return 0;
+}
+
+static int luai_sched_resolve(lua_State * L) {
+    LuaTask * task = luai_task_find(L, lua_upvalueindex(1));
+    unsigned long id = lua_tointeger(L, lua_upvalueindex(2));
+    if (!task || task->await_id != id || task->results != LUA_NOREF)
+        return 0;
+    int n = lua_gettop(L);
+    lua_createtable(L, n, 0);
+    for (int i = 1; i <= n; i++) {
+        lua_pushvalue(L, i);
+        lua_rawseti(L, -2, i);
+    }
+    task->results = luaL_ref(L, LUA_REGISTRYINDEX);
+    // If the callback runs before await yields, await returns directly.
+    if (task->state == LUAI_TASK_AWAIT) {
+        task->state = LUAI_TASK_READY;
+        luai_tasklist_push(&luai_sched.ready, task);
+    }
+    return 0;
+}
+
+// ldoom.await(start) calls start(resolve) and returns the arguments resolve is
+// eventually called with. For example:
+//     local sound = ldoom.await(function(done) ldoom.audio.loadOgg("a.ogg", done) end)
+static int luai_sched_await(lua_State * L) {
+    LuaTask * task = luai_task_current(L);
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    task->await_id = ++luai_sched.next_await_id;
+    lua_pushvalue(L, 1);
+    lua_pushthread(L);
+    lua_pushinteger(L, task->await_id);
+    lua_pushcclosure(L, luai_sched_resolve, 2);
+    lua_call(L, 1, 0);
+    if (task->results != LUA_NOREF) {
+        lua_settop(L, 0);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, task->results);
+        int n = lua_objlen(L, 1);
+        for (int i = 1; i <= n; i++)
+            lua_rawgeti(L, 1, i);
+        luaL_unref(L, LUA_REGISTRYINDEX, task->results);
+        task->results = LUA_NOREF;
+        return n;
+    }
+    task->state = LUAI_TASK_AWAIT;
+    return lua_yield(L, 0);
+}
+
+// ldoom.cancel(thread) stops a task for good.
+static int luai_sched_cancel(lua_State * L) {
+    luaL_checktype(L, 1, LUA_TTHREAD);
+    LuaTask * task = luai_task_find(L, 1);
+    if (!task || task->cancelled)
+        return 0;
+    task->cancelled = 1;
+    if (task->state == LUAI_TASK_EVENT) {
+        LuaTask ** link = &luai_sched.event_waiters;
+        while (*link != task)
+            link = &(*link)->next;
+        *link = task->next;
+        luai_sched.event_waiter_count--;
+        luai_task_free(L, task);
+    } else if (task->state == LUAI_TASK_AWAIT) {
+        luai_task_free(L, task);
+    }
+    // Anything else is freed when it comes up in a wheel or the ready list.
+    return 0;
+}
+
+static int luai_sched_stats(lua_State * L) {
+    lua_createtable(L, 0, 2);
+    lua_pushnumber(L, luai_sched.stats.resumed);
+    lua_setfield(L, -2, "resumed");
+    lua_pushnumber(L, luai_sched.stats.tasks);
+    lua_setfield(L, -2, "tasks");
+    return 1;
+}
+
+void luai_load_scheduler() {
+    lua_State * L = globalLuaState;
+    memset(&luai_sched, 0, sizeof(luai_sched));
+    lua_newtable(L);
+    luai_sched.tasks = luaL_ref(L, LUA_REGISTRYINDEX);
+    const luaL_Reg module[] = {
+        {"spawn", luai_sched_spawn},
+        {"wait", luai_sched_wait},
+        {"waitFrames", luai_sched_waitFrames},
+        {"waitEvent", luai_sched_waitEvent},
+        {"signal", luai_sched_signal},
+        {"await", luai_sched_await},
+        {"cancel", luai_sched_cancel},
+        {"taskStats", luai_sched_stats},
+        {NULL, NULL}
+    };
+    luai_addtomainmodule(module);
+}
+
+// Frees every task, whatever it is waiting for. Every task is in the tasks
+// table until it is freed, including those only reachable from a callback.
+void luai_scheduler_deinit() {
+    lua_State * L = globalLuaState;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, luai_sched.tasks);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        LuaTask * task = lua_touserdata(L, -1);
+        tfree(task->event);
+        tfree(task);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, luai_sched.tasks);
+    memset(&luai_sched, 0, sizeof(luai_sched));
+}
@@ -0,0 +1,29 @@
+#include "lua_interop.h"
+#include "lua_modules.h"
+#include "trace.h"
+
+static int luai_trace_start(lua_State * L) {
+    trace_start();
+    return 0;
+}
+
+static int luai_trace_stop(lua_State * L) {
+    trace_stop();
+    return 0;
+}
+
+// ldoom.trace.save(path) writes the capture as Chrome trace JSON.
+static int luai_trace_save(lua_State * L) {
+    lua_pushboolean(L, trace_write(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+void luai_load_trace() {
+    const luaL_Reg module[] = {
+        {"start", luai_trace_start},
+        {"stop", luai_trace_stop},
+        {"save", luai_trace_save},
+        {NULL, NULL}
+    };
+    luai_addsubmodule("trace", module);
+}
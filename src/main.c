@@ -1,8 +1,11 @@
 #include "platform.h"
 
-int main() {
+int main(int argc, char ** argv) {
 
-	platform_init();
+    PlatformOptions options;
+    platform_parse_options(&options, argc, argv);
+
+	platform_init(&options);
 	platform_mainloop();
 	platform_deinit();
 
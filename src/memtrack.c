@@ -0,0 +1,263 @@
+#include "memtrack.h"
+#include "console.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// Shown by memtrack_report; the rest are summed into one line.
+#define MEMTRACK_REPORT_SITES 32
+
+typedef struct MemHeader {
+    struct MemHeader * prev;
+    struct MemHeader * next;
+    size_t size;
+    const char * file;
+    int line;
+    int tag;
+} MemHeader;
+
+// Keeps the returned pointer aligned for any type.
+#define MEMTRACK_HEADER_SIZE ((sizeof(MemHeader) + 15) & ~(size_t) 15)
+
+#define HEADER(ptr) ((MemHeader *) ((char *) (ptr) - MEMTRACK_HEADER_SIZE))
+#define DATA(h) ((void *) ((char *) (h) + MEMTRACK_HEADER_SIZE))
+
+typedef struct {
+    const char * file;
+    int line;
+    int tag;
+    unsigned long count;
+    size_t bytes;
+} MemSite;
+
+// The counters are updated with atomics so threads allocating in parallel
+// don't serialize on a lock. Only debug builds keep the list of live blocks
+// that memtrack_report groups by callsite; the lock guards just that list.
+static struct {
+    pthread_mutex_t lock;
+    MemHeader * live; // Most recent first
+    MemTagStats tags[MEM_TAGS];
+    unsigned long frame_count[MEM_TAGS];
+    size_t frame_bytes[MEM_TAGS];
+} memtrack = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static const char * memtrack_names[MEM_TAGS] = {
+    "misc", "mesh", "model", "text", "console", "audio", "scratch", "quickdraw", "texture",
+    "script", "tools"
+};
+
+static void memtrack_link(MemHeader * h, int tag, size_t size, const char * file, int line) {
+    if (tag < 0 || tag >= MEM_TAGS)
+        tag = MEM_TAG_MISC;
+    h->size = size;
+    h->file = file;
+    h->line = line;
+    h->tag = tag;
+#ifdef DEBUG
+    pthread_mutex_lock(&memtrack.lock);
+    h->prev = NULL;
+    h->next = memtrack.live;
+    if (memtrack.live)
+        memtrack.live->prev = h;
+    memtrack.live = h;
+    pthread_mutex_unlock(&memtrack.lock);
+#endif
+
+    MemTagStats * s = memtrack.tags + tag;
+    size_t live = __atomic_add_fetch(&s->live_bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&s->peak_bytes, &peak, live,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&s->live_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->total_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memtrack.frame_count[tag], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memtrack.frame_bytes[tag], size, __ATOMIC_RELAXED);
+}
+
+static void memtrack_unlink(MemHeader * h) {
+#ifdef DEBUG
+    pthread_mutex_lock(&memtrack.lock);
+    if (h->prev)
+        h->prev->next = h->next;
+    else
+        memtrack.live = h->next;
+    if (h->next)
+        h->next->prev = h->prev;
+    pthread_mutex_unlock(&memtrack.lock);
+#endif
+    MemTagStats * s = memtrack.tags + h->tag;
+    __atomic_sub_fetch(&s->live_bytes, h->size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&s->live_count, 1, __ATOMIC_RELAXED);
+}
+
+void * memtrack_malloc(int tag, size_t size, const char * file, int line) {
+    MemHeader * h = malloc(MEMTRACK_HEADER_SIZE + size);
+    if (!h)
+        return NULL;
+    memtrack_link(h, tag, size, file, line);
+    return DATA(h);
+}
+
+void * memtrack_calloc(int tag, size_t n, size_t size, const char * file, int line) {
+    if (size && n > SIZE_MAX / size)
+        return NULL;
+    void * ptr = memtrack_malloc(tag, n * size, file, line);
+    if (ptr)
+        memset(ptr, 0, n * size);
+    return ptr;
+}
+
+void * memtrack_realloc(int tag, void * ptr, size_t size, const char * file, int line) {
+    if (!ptr)
+        return memtrack_malloc(tag, size, file, line);
+    MemHeader * h = HEADER(ptr);
+    // The block is unlinked while realloc may move it, and relinked at the
+    // new callsite. If realloc fails the old block is still valid.
+    memtrack_unlink(h);
+    tag = h->tag;
+    MemHeader * nh = realloc(h, MEMTRACK_HEADER_SIZE + size);
+    if (nh)
+        memtrack_link(nh, tag, size, file, line);
+    else
+        memtrack_link(h, tag, h->size, h->file, h->line);
+    return nh ? DATA(nh) : NULL;
+}
+
+char * memtrack_strdup(int tag, const char * str, const char * file, int line) {
+    size_t len = strlen(str) + 1;
+    char * copy = memtrack_malloc(tag, len, file, line);
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+void memtrack_free(void * ptr) {
+    if (!ptr)
+        return;
+    MemHeader * h = HEADER(ptr);
+    memtrack_unlink(h);
+    free(h);
+}
+
+void memtrack_vram(int tag, long long bytes) {
+    if (tag < 0 || tag >= MEM_TAGS)
+        tag = MEM_TAG_MISC;
+    MemTagStats * s = memtrack.tags + tag;
+    long long vram = __atomic_add_fetch(&s->vram_bytes, bytes, __ATOMIC_RELAXED);
+    long long peak = __atomic_load_n(&s->vram_peak, __ATOMIC_RELAXED);
+    while (vram > peak && !__atomic_compare_exchange_n(&s->vram_peak, &peak, vram,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void memtrack_frame() {
+    for (int t = 0; t < MEM_TAGS; t++) {
+        __atomic_store_n(&memtrack.tags[t].frame_count,
+                __atomic_exchange_n(&memtrack.frame_count[t], 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&memtrack.tags[t].frame_bytes,
+                __atomic_exchange_n(&memtrack.frame_bytes[t], 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+// Each counter is read atomically, but not all at the same instant.
+static void memtrack_load(int tag, MemTagStats * stats) {
+    const MemTagStats * s = memtrack.tags + tag;
+    stats->live_bytes = __atomic_load_n(&s->live_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+    stats->live_count = __atomic_load_n(&s->live_count, __ATOMIC_RELAXED);
+    stats->total_count = __atomic_load_n(&s->total_count, __ATOMIC_RELAXED);
+    stats->frame_count = __atomic_load_n(&s->frame_count, __ATOMIC_RELAXED);
+    stats->frame_bytes = __atomic_load_n(&s->frame_bytes, __ATOMIC_RELAXED);
+    stats->vram_bytes = __atomic_load_n(&s->vram_bytes, __ATOMIC_RELAXED);
+    stats->vram_peak = __atomic_load_n(&s->vram_peak, __ATOMIC_RELAXED);
+}
+
+void memtrack_stats(int tag, MemTagStats * stats) {
+    if (tag < 0 || tag >= MEM_TAGS) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    memtrack_load(tag, stats);
+}
+
+const char * memtrack_tag_name(int tag) {
+    if (tag < 0 || tag >= MEM_TAGS)
+        return NULL;
+    return memtrack_names[tag];
+}
+
+void memtrack_log() {
+    // Logging allocates, so take a copy first.
+    MemTagStats stats[MEM_TAGS];
+    for (int t = 0; t < MEM_TAGS; t++)
+        memtrack_load(t, stats + t);
+    console_log("tag        live KB   peak KB  allocs  frame  vram KB");
+    for (int t = 0; t < MEM_TAGS; t++) {
+        MemTagStats * s = stats + t;
+        console_log("%-9s %8.1f  %8.1f  %6lu  %5lu  %7.1f", memtrack_names[t],
+                s->live_bytes / 1024.0, s->peak_bytes / 1024.0, s->live_count,
+                s->frame_count, s->vram_bytes / 1024.0);
+    }
+}
+
+#ifdef DEBUG
+static int memtrack_site_compare(const void * a, const void * b) {
+    const MemSite * x = a, * y = b;
+    if (x->bytes != y->bytes)
+        return x->bytes < y->bytes ? 1 : -1;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+#endif
+
+unsigned long memtrack_report() {
+    MemTagStats stats[MEM_TAGS];
+    unsigned long count = 0;
+    for (int t = 0; t < MEM_TAGS; t++) {
+        memtrack_load(t, stats + t);
+        count += stats[t].live_count;
+    }
+    if (!count)
+        return 0;
+    fprintf(stderr, "Memory still allocated at exit:\n");
+    for (int t = 0; t < MEM_TAGS; t++) {
+        if (stats[t].live_count)
+            fprintf(stderr, "  %-9s %lu bytes in %lu allocations\n", memtrack_names[t],
+                    (unsigned long) stats[t].live_bytes, stats[t].live_count);
+    }
+#ifdef DEBUG
+    pthread_mutex_lock(&memtrack.lock);
+    unsigned long listed = 0;
+    for (MemHeader * h = memtrack.live; h; h = h->next)
+        listed++;
+    // The sites are allocated untracked so they don't show up in the report.
+    MemSite * sites = listed ? malloc(listed * sizeof(MemSite)) : NULL;
+    unsigned long nsites = 0;
+    if (sites) {
+        for (MemHeader * h = memtrack.live; h; h = h->next) {
+            unsigned long i;
+            for (i = 0; i < nsites; i++)
+                if (sites[i].line == h->line && sites[i].tag == h->tag && !strcmp(sites[i].file, h->file))
+                    break;
+            if (i == nsites)
+                sites[nsites++] = (MemSite) {h->file, h->line, h->tag, 0, 0};
+            sites[i].count++;
+            sites[i].bytes += h->size;
+        }
+    }
+    pthread_mutex_unlock(&memtrack.lock);
+    if (sites) {
+        qsort(sites, nsites, sizeof(MemSite), memtrack_site_compare);
+        unsigned long shown = nsites < MEMTRACK_REPORT_SITES ? nsites : MEMTRACK_REPORT_SITES;
+        for (unsigned long i = 0; i < shown; i++)
+            fprintf(stderr, "  %s:%d (%s) %lu bytes in %lu allocations\n", sites[i].file, sites[i].line,
+                    memtrack_names[sites[i].tag], (unsigned long) sites[i].bytes, sites[i].count);
+        if (nsites > shown)
+            fprintf(stderr, "  ... and %lu more callsites\n", nsites - shown);
+        free(sites);
+    }
+#endif
+    return count;
+}
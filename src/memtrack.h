@@ -0,0 +1,74 @@
+#ifndef MEMTRACK_H_F7QX2LBN
+#define MEMTRACK_H_F7QX2LBN
+
+#include <stddef.h>
+
+// Tagged heap allocations. Engine code allocates through tmalloc and friends
+// with the subsystem that owns the memory, and each block carries a small
+// header with its tag, size and callsite. Live and peak bytes are kept per
+// tag along with the allocations made in the last frame, and whatever is
+// still live at shutdown is reported. Debug builds also keep a list of live
+// blocks so the report can group them by callsite. Memory from a tagged
+// allocator must go back through tfree or trealloc, never plain free.
+//
+// GPU memory isn't visible to the engine, so the mesh, texture and text
+// wrappers add an estimate of what they upload with memtrack_vram.
+
+#define MEM_TAG_MISC 0
+#define MEM_TAG_MESH 1
+#define MEM_TAG_MODEL 2
+#define MEM_TAG_TEXT 3 // Fonts and text layout
+#define MEM_TAG_CONSOLE 4
+#define MEM_TAG_AUDIO 5
+#define MEM_TAG_SCRATCH 6 // Scratch arena blocks
+#define MEM_TAG_QUICKDRAW 7
+#define MEM_TAG_TEXTURE 8
+#define MEM_TAG_SCRIPT 9 // Engine buffers owned by Lua modules
+#define MEM_TAG_TOOLS 10 // Traces, profiles and frame time logs
+#define MEM_TAGS 11
+
+#define tmalloc(tag, size) memtrack_malloc((tag), (size), __FILE__, __LINE__)
+#define tcalloc(tag, n, size) memtrack_calloc((tag), (n), (size), __FILE__, __LINE__)
+#define trealloc(tag, ptr, size) memtrack_realloc((tag), (ptr), (size), __FILE__, __LINE__)
+#define tstrdup(tag, str) memtrack_strdup((tag), (str), __FILE__, __LINE__)
+#define tfree(ptr) memtrack_free(ptr)
+
+typedef struct {
+    size_t live_bytes;
+    size_t peak_bytes;
+    unsigned long live_count;
+    unsigned long total_count;
+    unsigned long frame_count; // Allocations in the last complete frame
+    size_t frame_bytes;
+    long long vram_bytes; // Estimated
+    long long vram_peak;
+} MemTagStats;
+
+void * memtrack_malloc(int tag, size_t size, const char * file, int line);
+void * memtrack_calloc(int tag, size_t n, size_t size, const char * file, int line);
+// A block keeps its tag across a realloc; tag is used when ptr is NULL.
+void * memtrack_realloc(int tag, void * ptr, size_t size, const char * file, int line);
+char * memtrack_strdup(int tag, const char * str, const char * file, int line);
+void memtrack_free(void * ptr);
+
+// Adds bytes of GPU memory to a tag's estimate. Pass a negative count when
+// the object is deleted.
+void memtrack_vram(int tag, long long bytes);
+
+// Ends the current frame's allocation counts. Call once per frame.
+void memtrack_frame();
+
+// Copies a tag's counters. The frame counts are those of the last complete
+// frame. Safe to call from any thread.
+void memtrack_stats(int tag, MemTagStats * stats);
+
+const char * memtrack_tag_name(int tag);
+
+// Writes the counters of every tag to the console.
+void memtrack_log();
+
+// Writes every live allocation, grouped by callsite, to stderr. Returns the
+// number of live allocations.
+unsigned long memtrack_report();
+
+#endif /* end of include guard: MEMTRACK_H_F7QX2LBN */
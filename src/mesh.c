@@ -1,4 +1,6 @@
 #include "mesh.h"
+#include "trace.h"
+#include "memtrack.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,6 +28,13 @@ static size_t get_size(MeshType t) {
     }
 }
 
+/*
+ * Bytes of GPU memory the mesh's buffers hold.
+ */
+static long long vram_size(Mesh * m) {
+    return (long long) get_size(m->mesh_type) * m->vcount + sizeof(GLushort) * m->icount;
+}
+
 /*
  * Generate a Vertex Buffer Object, an Element Buffer Object, and a Vertex Array Object.
  */
@@ -41,6 +50,8 @@ static void generate_buffers(Mesh * m) {
 
     glBindBuffer(GL_ARRAY_BUFFER, m->VBO);
     glBufferData(GL_ARRAY_BUFFER, get_size(m->mesh_type) * m->vcount, m->vertices.v, m->draw_type);
+
+    memtrack_vram(MEM_TAG_MESH, vram_size(m));
 }
 
 /*
@@ -109,7 +120,7 @@ Mesh * mesh_init(Mesh * m,
 
     m->vcount = vertex_count;
     m->icount = index_count;
-    void * ptr = malloc(vsize + isize);
+    void * ptr = tmalloc(MEM_TAG_MESH, vsize + isize);
     m->vertices.v = ptr + isize;
     m->indices = ptr;
 
@@ -139,7 +150,7 @@ Mesh * mesh_init_floats(Mesh * m,
 
     m->vcount = vsize / get_size(mesh_type);
     m->icount = index_count;
-    void * ptr = malloc(vsize + isize);
+    void * ptr = tmalloc(MEM_TAG_MESH, vsize + isize);
     m->vertices.v = ptr + isize;
     m->indices = ptr;
 
@@ -233,6 +244,7 @@ void mesh_unload(Mesh * m) {
     glDeleteVertexArrays(1, &m->VAO);
     glDeleteBuffers(1, &m->VBO);
     glDeleteBuffers(1, &m->EBO);
+    memtrack_vram(MEM_TAG_MESH, -vram_size(m));
     m->flags &= ~ACTIVE_BIT;
 }
 
@@ -240,9 +252,9 @@ void mesh_clearcpumem(Mesh * m) {
     if (!(m->flags & MEMINITED_BIT))
         return;
     if (m->flags & OWNS_VERTMEM_BIT)
-        free(m->vertices.floats);
+        tfree(m->vertices.floats);
     if (m->flags & OWNS_ELMEM_BIT)
-        free(m->indices);
+        tfree(m->indices);
     m->flags &= ~(MEMINITED_BIT | OWNS_ELMEM_BIT | OWNS_VERTMEM_BIT);
 }
 
@@ -252,6 +264,7 @@ void mesh_deinit(Mesh * m) {
 }
 
 void mesh_draw(Mesh * m) {
+    TRACE_SCOPE("mesh_draw");
     glBindVertexArray(m->VAO);
     glBindBuffer(GL_ARRAY_BUFFER, m->VBO);
     glDrawElements(m->primitive_type, m->icount, GL_UNSIGNED_SHORT, 0);
@@ -422,7 +435,7 @@ Mesh * mesh_init_cylinder(Mesh * m, float height, float radius, int subdivisions
     size_t vsize = sizeof(Vertex) * numverts;
     size_t isize = sizeof(GLushort) * numindices;
 
-    void * ptr = malloc(vsize + isize);
+    void * ptr = tmalloc(MEM_TAG_MESH, vsize + isize);
     GLushort * is = m->indices = ptr;
     GLfloat * fs = m->vertices.floats = ptr + isize;
 
@@ -488,8 +501,7 @@ Mesh * mesh_init_cylinder(Mesh * m, float height, float radius, int subdivisions
     }
 
     mesh_init_nocopy(m, MESHTYPE_3D, GL_STATIC_DRAW, numverts * 8, fs, numindices, is);
-
-    mesh_load(m);
+    m->flags |= OWNS_ELMEM_BIT; // The block starts at the indices
 
     return m;
 }
@@ -86,7 +86,8 @@ Mesh * mesh_init_floats(Mesh * m,
 
 /*
  * Initializes a mesh from arrays of floats, but does not copy the arrays.
- *
+ * Arrays the mesh owns are freed with tfree, so allocate them with tmalloc,
+ * tagged MEM_TAG_MESH.
  */
 Mesh * mesh_init_mem(Mesh * m,
         MeshType mesh_type,
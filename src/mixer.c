@@ -0,0 +1,400 @@
+#include "mixer.h"
+#include "audio.h"
+#include "platform.h"
+#include "util.h"
+#include "pcmcache.h"
+#include "trace.h"
+#include "memtrack.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// How long the worker sleeps between checks for processed buffers.
+#define MIXER_POLL_USEC 2000
+
+typedef enum {
+    MIXER_CMD_PLAY,
+    MIXER_CMD_SET,
+    MIXER_CMD_STOP
+} MixerCommandType;
+
+typedef struct {
+    MixerCommandType type;
+    unsigned voice;
+    MixerClip * clip;
+    float gain;
+    float pitch;
+    float pan;
+} MixerCommand;
+
+typedef struct {
+    MixerClip * clip;
+    unsigned id;
+    double position;
+    double step;
+    float gain_left;
+    float gain_right;
+} MixerVoice;
+
+static struct {
+    int sample_rate;
+    int threaded;
+    // Single producer, single consumer ring. Only the game thread writes head
+    // and next_id, and only the mixer writes tail.
+    MixerCommand queue[MIXER_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+    unsigned next_id;
+    // Owned by the mixer.
+    MixerVoice voices[MIXER_MAX_VOICES];
+    unsigned voice_count;
+    // Copy of voice_count for the game thread.
+    unsigned voices_mixed;
+    float * accum;
+    short * block;
+    // AL output, only used when threaded.
+    ALuint source;
+    ALuint buffers[MIXER_BUFFERS];
+    pthread_t thread;
+    int running;
+} mixer_globals;
+
+// CLIPS
+
+MixerClip * mixer_clip_load(const char * resource) {
+    PcmData pcm;
+    if (!pcm_load(platform_res2file_ez(resource), &pcm)) {
+        uerr("Could not decode ogg file.");
+    }
+    pcm_log_load(resource, &pcm);
+    int frames = pcm.samples;
+    int channels = pcm.channels;
+    MixerClip * clip = tmalloc(MEM_TAG_AUDIO, sizeof(MixerClip));
+    // Anything beyond stereo keeps its first two channels.
+    clip->channels = channels > 1 ? 2 : 1;
+    clip->frames = frames;
+    clip->sample_rate = pcm.sample_rate;
+    clip->refcount = 1;
+    clip->samples = tmalloc(MEM_TAG_AUDIO, (size_t) frames * clip->channels * sizeof(float));
+    for (int i = 0; i < frames; i++)
+        for (int c = 0; c < clip->channels; c++)
+            clip->samples[i * clip->channels + c] = pcm.pcm[i * channels + c] * (1.0f / 32768.0f);
+    pcm_free(&pcm);
+    return clip;
+}
+
+static void mixer_clip_retain(MixerClip * clip) {
+    __atomic_add_fetch(&clip->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void mixer_clip_release(MixerClip * clip) {
+    if (__atomic_sub_fetch(&clip->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        tfree(clip->samples);
+        tfree(clip);
+    }
+}
+
+// COMMANDS
+
+static int mixer_push(const MixerCommand * cmd) {
+    unsigned head = mixer_globals.head;
+    unsigned tail = __atomic_load_n(&mixer_globals.tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= MIXER_QUEUE_SIZE)
+        return 0;
+    mixer_globals.queue[head & (MIXER_QUEUE_SIZE - 1)] = *cmd;
+    __atomic_store_n(&mixer_globals.head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+unsigned mixer_play(MixerClip * clip, float gain, float pitch, float pan) {
+    MixerCommand cmd;
+    cmd.type = MIXER_CMD_PLAY;
+    cmd.voice = ++mixer_globals.next_id;
+    if (!cmd.voice)
+        cmd.voice = ++mixer_globals.next_id;
+    cmd.clip = clip;
+    cmd.gain = gain;
+    cmd.pitch = pitch;
+    cmd.pan = pan;
+    mixer_clip_retain(clip);
+    if (!mixer_push(&cmd)) {
+        mixer_clip_release(clip);
+        return 0;
+    }
+    return cmd.voice;
+}
+
+void mixer_set(unsigned voice, float gain, float pitch, float pan) {
+    MixerCommand cmd;
+    cmd.type = MIXER_CMD_SET;
+    cmd.voice = voice;
+    cmd.clip = NULL;
+    cmd.gain = gain;
+    cmd.pitch = pitch;
+    cmd.pan = pan;
+    mixer_push(&cmd);
+}
+
+void mixer_stop(unsigned voice) {
+    MixerCommand cmd;
+    cmd.type = MIXER_CMD_STOP;
+    cmd.voice = voice;
+    cmd.clip = NULL;
+    mixer_push(&cmd);
+}
+
+unsigned mixer_voice_count() {
+    return __atomic_load_n(&mixer_globals.voices_mixed, __ATOMIC_RELAXED);
+}
+
+static void mixer_voice_setup(MixerVoice * v, float gain, float pitch, float pan) {
+    // Constant power panning.
+    float angle = (ldm_clamp(pan, -1, 1) + 1) * (LD_PI / 4);
+    v->gain_left = gain * cosf(angle);
+    v->gain_right = gain * sinf(angle);
+    v->step = (double) pitch * v->clip->sample_rate / mixer_globals.sample_rate;
+    if (v->step <= 0)
+        v->step = 1;
+}
+
+static MixerVoice * mixer_find_voice(unsigned id) {
+    for (unsigned i = 0; i < mixer_globals.voice_count; i++)
+        if (mixer_globals.voices[i].id == id)
+            return mixer_globals.voices + i;
+    return NULL;
+}
+
+static void mixer_remove_voice(MixerVoice * v) {
+    mixer_clip_release(v->clip);
+    *v = mixer_globals.voices[--mixer_globals.voice_count];
+}
+
+static void mixer_apply_commands() {
+    unsigned tail = mixer_globals.tail;
+    unsigned head = __atomic_load_n(&mixer_globals.head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++) {
+        MixerCommand * cmd = mixer_globals.queue + (tail & (MIXER_QUEUE_SIZE - 1));
+        MixerVoice * v;
+        switch (cmd->type) {
+            case MIXER_CMD_PLAY:
+                if (mixer_globals.voice_count >= MIXER_MAX_VOICES) {
+                    mixer_clip_release(cmd->clip);
+                    break;
+                }
+                v = mixer_globals.voices + mixer_globals.voice_count++;
+                v->clip = cmd->clip;
+                v->id = cmd->voice;
+                v->position = 0;
+                mixer_voice_setup(v, cmd->gain, cmd->pitch, cmd->pan);
+                break;
+            case MIXER_CMD_SET:
+                if ((v = mixer_find_voice(cmd->voice)))
+                    mixer_voice_setup(v, cmd->gain, cmd->pitch, cmd->pan);
+                break;
+            case MIXER_CMD_STOP:
+                if ((v = mixer_find_voice(cmd->voice)))
+                    mixer_remove_voice(v);
+                break;
+        }
+    }
+    __atomic_store_n(&mixer_globals.tail, tail, __ATOMIC_RELEASE);
+}
+
+// KERNELS
+
+// Adds n frames of a clip played at its own rate into the stereo accumulator.
+static void mix_unity(float * acc, const MixerClip * clip, unsigned start, unsigned n, float gl, float gr) {
+    unsigned i = 0;
+    if (clip->channels == 1) {
+        const float * src = clip->samples + start;
+#ifdef __SSE2__
+        __m128 g = _mm_setr_ps(gl, gr, gl, gr);
+        for (; i + 4 <= n; i += 4) {
+            __m128 s = _mm_loadu_ps(src + i);
+            __m128 lo = _mm_unpacklo_ps(s, s);
+            __m128 hi = _mm_unpackhi_ps(s, s);
+            _mm_storeu_ps(acc + 2 * i, _mm_add_ps(_mm_loadu_ps(acc + 2 * i), _mm_mul_ps(lo, g)));
+            _mm_storeu_ps(acc + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(acc + 2 * i + 4), _mm_mul_ps(hi, g)));
+        }
+#endif
+        for (; i < n; i++) {
+            acc[2 * i] += src[i] * gl;
+            acc[2 * i + 1] += src[i] * gr;
+        }
+    } else {
+        const float * src = clip->samples + 2 * start;
+#ifdef __SSE2__
+        __m128 g = _mm_setr_ps(gl, gr, gl, gr);
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_ps(acc + 2 * i, _mm_add_ps(_mm_loadu_ps(acc + 2 * i), _mm_mul_ps(_mm_loadu_ps(src + 2 * i), g)));
+#endif
+        for (; i < n; i++) {
+            acc[2 * i] += src[2 * i] * gl;
+            acc[2 * i + 1] += src[2 * i + 1] * gr;
+        }
+    }
+}
+
+// Adds up to n frames of a clip resampled with linear interpolation. Returns
+// the number of frames written.
+static unsigned mix_resample(float * acc, const MixerClip * clip, double * position, double step, unsigned n, float gl, float gr) {
+    double pos = *position;
+    const float * src = clip->samples;
+    double end = clip->frames - 1;
+    unsigned i = 0;
+    // Interpolate while both neighbouring frames are inside the clip.
+    if (clip->channels == 1) {
+        for (; i < n && pos < end; i++, pos += step) {
+            unsigned j = (unsigned) pos;
+            float t = (float) (pos - j);
+            float s = src[j] + (src[j + 1] - src[j]) * t;
+            acc[2 * i] += s * gl;
+            acc[2 * i + 1] += s * gr;
+        }
+    } else {
+        for (; i < n && pos < end; i++, pos += step) {
+            unsigned j = (unsigned) pos;
+            float t = (float) (pos - j);
+            const float * f = src + 2 * j;
+            acc[2 * i] += (f[0] + (f[2] - f[0]) * t) * gl;
+            acc[2 * i + 1] += (f[1] + (f[3] - f[1]) * t) * gr;
+        }
+    }
+    // The last frame fades towards silence.
+    for (; i < n && pos < clip->frames; i++, pos += step) {
+        const float * f = src + clip->channels * (clip->frames - 1);
+        float t = 1 - (float) (pos - end);
+        acc[2 * i] += f[0] * t * gl;
+        acc[2 * i + 1] += f[clip->channels - 1] * t * gr;
+    }
+    *position = pos;
+    return i;
+}
+
+// Converts the accumulator to 16 bit samples, saturating on overflow.
+static void mix_convert(short * out, const float * acc, unsigned samples) {
+    unsigned i = 0;
+#ifdef __SSE2__
+    __m128 scale = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= samples; i += 8) {
+        __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(acc + i), scale));
+        __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(acc + i + 4), scale));
+        _mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; i < samples; i++) {
+        float s = acc[i] * 32767.0f;
+        out[i] = s > 32767.0f ? 32767 : s < -32768.0f ? -32768 : (short) lrintf(s);
+    }
+}
+
+static void mixer_mix_block(short * out, unsigned frames) {
+    float * acc = mixer_globals.accum;
+    memset(acc, 0, 2 * frames * sizeof(float));
+    for (unsigned v = 0; v < mixer_globals.voice_count;) {
+        MixerVoice * voice = mixer_globals.voices + v;
+        const MixerClip * clip = voice->clip;
+        if (voice->step == 1.0) {
+            unsigned start = (unsigned) voice->position;
+            unsigned n = clip->frames - start < frames ? clip->frames - start : frames;
+            mix_unity(acc, clip, start, n, voice->gain_left, voice->gain_right);
+            voice->position += n;
+        } else {
+            mix_resample(acc, clip, &voice->position, voice->step, frames, voice->gain_left, voice->gain_right);
+        }
+        if (voice->position >= clip->frames)
+            mixer_remove_voice(voice);
+        else
+            v++;
+    }
+    mix_convert(out, acc, 2 * frames);
+}
+
+void mixer_render(short * out, unsigned frames) {
+    TRACE_SCOPE("mixer_render");
+    mixer_apply_commands();
+    while (frames) {
+        unsigned n = frames < MIXER_BLOCK_FRAMES ? frames : MIXER_BLOCK_FRAMES;
+        mixer_mix_block(out, n);
+        out += 2 * n;
+        frames -= n;
+    }
+    __atomic_store_n(&mixer_globals.voices_mixed, mixer_globals.voice_count, __ATOMIC_RELAXED);
+}
+
+// WORKER
+
+static void mixer_fill(ALuint buffer) {
+    mixer_render(mixer_globals.block, MIXER_BLOCK_FRAMES);
+    alBufferData(buffer, AL_FORMAT_STEREO16, mixer_globals.block,
+            2 * MIXER_BLOCK_FRAMES * sizeof(short), mixer_globals.sample_rate);
+}
+
+// OpenAL implementations are thread safe, so the worker drives its source
+// directly rather than going through the game thread.
+static void * mixer_worker(void * arg) {
+    trace_thread_name("mixer");
+    while (__atomic_load_n(&mixer_globals.running, __ATOMIC_ACQUIRE)) {
+        ALint processed, state;
+        alGetSourcei(mixer_globals.source, AL_BUFFERS_PROCESSED, &processed);
+        while (processed-- > 0) {
+            ALuint buffer;
+            alSourceUnqueueBuffers(mixer_globals.source, 1, &buffer);
+            mixer_fill(buffer);
+            alSourceQueueBuffers(mixer_globals.source, 1, &buffer);
+        }
+        alGetSourcei(mixer_globals.source, AL_SOURCE_STATE, &state);
+        if (state != AL_PLAYING)
+            alSourcePlay(mixer_globals.source);
+        util_sleep_usec(MIXER_POLL_USEC);
+    }
+    return NULL;
+}
+
+// INITIALIZATION / DEINITIALIZATION
+
+void mixer_init(int sample_rate, int threaded) {
+    mixer_globals.sample_rate = sample_rate;
+    mixer_globals.threaded = threaded;
+    mixer_globals.head = mixer_globals.tail = 0;
+    mixer_globals.voice_count = 0;
+    mixer_globals.voices_mixed = 0;
+    mixer_globals.accum = malloc(2 * MIXER_BLOCK_FRAMES * sizeof(float));
+    mixer_globals.block = malloc(2 * MIXER_BLOCK_FRAMES * sizeof(short));
+    if (!threaded)
+        return;
+    alGenSources(1, &mixer_globals.source);
+    alSourcei(mixer_globals.source, AL_SOURCE_RELATIVE, AL_TRUE);
+    alSource3f(mixer_globals.source, AL_POSITION, 0, 0, 0);
+    alGenBuffers(MIXER_BUFFERS, mixer_globals.buffers);
+    for (int i = 0; i < MIXER_BUFFERS; i++)
+        mixer_fill(mixer_globals.buffers[i]);
+    alSourceQueueBuffers(mixer_globals.source, MIXER_BUFFERS, mixer_globals.buffers);
+    alSourcePlay(mixer_globals.source);
+    mixer_globals.running = 1;
+    if (pthread_create(&mixer_globals.thread, NULL, mixer_worker, NULL)) {
+        uerr("Could not start mixer thread.");
+    }
+}
+
+void mixer_deinit() {
+    if (mixer_globals.threaded) {
+        __atomic_store_n(&mixer_globals.running, 0, __ATOMIC_RELEASE);
+        pthread_join(mixer_globals.thread, NULL);
+        alSourceStop(mixer_globals.source);
+        alSourcei(mixer_globals.source, AL_BUFFER, 0);
+        alDeleteSources(1, &mixer_globals.source);
+        alDeleteBuffers(MIXER_BUFFERS, mixer_globals.buffers);
+    }
+    mixer_apply_commands();
+    while (mixer_globals.voice_count)
+        mixer_remove_voice(mixer_globals.voices);
+    free(mixer_globals.accum);
+    free(mixer_globals.block);
+    mixer_globals.accum = NULL;
+    mixer_globals.block = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef MIXER_H_R8T2WNCE
+#define MIXER_H_R8T2WNCE
+
+// Software mixer for short one-shot effects. Clips are summed into a single
+// streaming AL source by a worker thread, so playing a clip costs no AL source
+// and hundreds of them can overlap. The game thread talks to the worker through
+// a lock-free command queue.
+
+#define MIXER_MAX_VOICES 512
+#define MIXER_QUEUE_SIZE 1024
+#define MIXER_BUFFERS 4
+#define MIXER_BLOCK_FRAMES 512
+
+typedef struct {
+    float * samples;
+    unsigned frames;
+    int channels;
+    int sample_rate;
+    int refcount;
+} MixerClip;
+
+// Decodes an ogg resource into a clip with a reference count of one.
+MixerClip * mixer_clip_load(const char * resource);
+
+// Drops a reference. Voices playing the clip hold their own references, so a
+// clip can be released while it is still playing.
+void mixer_clip_release(MixerClip * clip);
+
+// Starts the mixer. If threaded is zero, no AL source or worker is created and
+// the caller drives the mixer with mixer_render.
+void mixer_init(int sample_rate, int threaded);
+
+void mixer_deinit();
+
+// Plays a clip and returns a voice handle, or 0 if the command queue is full.
+// Pitch scales playback speed, and pan goes from -1 (left) to 1 (right).
+unsigned mixer_play(MixerClip * clip, float gain, float pitch, float pan);
+
+void mixer_set(unsigned voice, float gain, float pitch, float pan);
+
+void mixer_stop(unsigned voice);
+
+// Number of voices mixed in the last block.
+unsigned mixer_voice_count();
+
+// Applies queued commands and mixes the next frames of stereo 16 bit output.
+// Only call this when the mixer was started without a thread.
+void mixer_render(short * out, unsigned frames);
+
+#endif /* end of include guard: MIXER_H_R8T2WNCE */
@@ -2,11 +2,14 @@
 #include "iqm.h"
 #include "util.h"
 #include "platform.h"
+#include "trace.h"
+#include "memtrack.h"
 #include "ldmath.h"
 #include <string.h>
 
 int model_loadfile(Model * model, const char * file) {
 
+    TRACE_SCOPE("model_loadfile");
     long flen;
     char * data = util_slurp(file, &flen);
 
@@ -40,7 +43,7 @@ int model_loadfile(Model * model, const char * file) {
     size_t asize = sizeof(ModelAnimation) * numa;
     size_t psize = sizeof(ModelBonePose) * nump;
     size_t msize = sizeof(ModelMesh) * numm;
-    void * memory = malloc(vsize + tsize + bsize + asize + psize + msize + ssize);
+    void * memory = tmalloc(MEM_TAG_MODEL, vsize + tsize + bsize + asize + psize + msize + ssize);
     ModelVertex * verts = (ModelVertex *) memory;
     ModelTriangle * triangles = (ModelTriangle *) (memory + vsize);
     ModelBone * bones = (ModelBone *) ((void *) triangles + tsize);
@@ -49,11 +52,11 @@ int model_loadfile(Model * model, const char * file) {
     ModelMesh * meshes = (ModelMesh *) ((void *) poses + psize);
     uint8_t * textdata = (uint8_t *) ((void *) meshes + msize);
 
-#define BAILOUT do { free(memory); free(data); return 1;} while(0)
+#define BAILOUT do { tfree(memory); free(data); return 1;} while(0)
 
     // Construct Vertex Arrays
     struct iqmvertexarray * va_first = (struct iqmvertexarray *) (data + header->ofs_vertexarrays);
-    for (uint32_t i = 0; i < numv; i++) {
+    for (uint32_t i = 0; i < header->num_vertexarrays; i++) {
 
        struct iqmvertexarray * va = va_first + i;
        float * fp;
@@ -83,28 +86,28 @@ int model_loadfile(Model * model, const char * file) {
                if (va->format != IQM_FLOAT)
                    BAILOUT;
                for (; j < numv; fp += 2, j++) {
-                   memcpy(verts[i].texcoord, fp, sizeof(float) * 2);
+                   memcpy(verts[j].texcoord, fp, sizeof(float) * 2);
                }
                break;
            case IQM_NORMAL:
                if (va->format != IQM_FLOAT)
                    BAILOUT;
                for (; j < numv; fp += 3, j++) {
-                   memcpy(verts[i].normal, fp, sizeof(float) * 3);
+                   memcpy(verts[j].normal, fp, sizeof(float) * 3);
                }
                break;
            case IQM_BLENDINDEXES:
                if (va->format != IQM_UBYTE)
                    BAILOUT;
                for (; j < numv; up += 4, j++) {
-                   memcpy(verts[i].boneIndicies, up, 4 * sizeof(uint8_t));
+                   memcpy(verts[j].boneIndicies, up, 4 * sizeof(uint8_t));
                }
                break;
            case IQM_BLENDWEIGHTS:
                if (va->format != IQM_UBYTE)
                    BAILOUT;
                for (; j < numv; up += 4, j++) {
-                   memcpy(verts[i].boneWeights, up, 4 * sizeof(uint8_t));
+                   memcpy(verts[j].boneWeights, up, 4 * sizeof(uint8_t));
                }
                break;
            case IQM_TANGENT:
@@ -161,25 +164,25 @@ int model_loadresource(Model * model, const char * resource) {
 
 void model_deinit(Model * model) {
     if (model->flags & MODEL_OWNS_VERTICIES_BIT) {
-        free(model->vertices);
+        tfree(model->vertices);
     }
     if (model->flags & MODEL_OWNS_TRIANGLES_BIT) {
-        free(model->triangles);
+        tfree(model->triangles);
     }
     if (model->flags & MODEL_OWNS_BONES_BIT) {
-        free(model->bones);
+        tfree(model->bones);
     }
     if (model->flags & MODEL_OWNS_ANIMATIONS_BIT) {
-        free(model->animations);
+        tfree(model->animations);
     }
     if (model->flags & MODEL_OWNS_MATERIALS_BIT) {
-        free(model->materials);
+        tfree(model->materials);
     }
     if (model->flags & MODEL_OWNS_TEXT_BIT) {
-        free(model->textData);
+        tfree(model->textData);
     }
     if (model->flags & MODEL_OWNS_MESHES_BIT) {
-        free(model->meshes);
+        tfree(model->meshes);
     }
 }
 
@@ -204,7 +207,7 @@ static void modeli_setmeshes(ModelInstance * instance) {
 ModelInstance * model_instance(Model * model, ModelInstance * instance) {
     instance->flags = 0;
     instance->model = model;
-    instance->meshes = malloc(sizeof(Mesh) * model->meshCount);
+    instance->meshes = tmalloc(MEM_TAG_MODEL, sizeof(Mesh) * model->meshCount);
     instance->frame = 0;
     instance->animation = -1;
     ModelVertex * verts = model->vertices;
@@ -213,7 +216,7 @@ ModelInstance * model_instance(Model * model, ModelInstance * instance) {
         Mesh * m = instance->meshes + i;
         size_t vsize = sizeof(Vertex) * mm->vertexCount;
         size_t esize = sizeof(GLushort) * mm->triangleCount * 3;
-        void * memory = malloc(vsize + esize);
+        void * memory = tmalloc(MEM_TAG_MESH, vsize + esize);
         Vertex * vs = memory;
         GLushort * es = memory + vsize;
         for (uint32_t j = 0; j < mm->vertexCount; j++) {
@@ -232,7 +235,9 @@ ModelInstance * model_instance(Model * model, ModelInstance * instance) {
 }
 
 void modeli_deinit(ModelInstance * instance) {
-    free(instance->meshes);
+    for (uint32_t i = 0; i < instance->model->meshCount; i++)
+        mesh_deinit(instance->meshes + i);
+    tfree(instance->meshes);
 }
 
 void modeli_set_animation(ModelInstance * instance) {
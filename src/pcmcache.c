@@ -0,0 +1,198 @@
+#include "pcmcache.h"
+#include "stb_vorbis.h"
+#include "util.h"
+#include "console.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#define PCMCACHE_VERSION 1
+#define PCMCACHE_PATHLEN 1024
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int64_t source_mtime;
+    uint64_t source_size;
+    uint32_t channels;
+    uint32_t sample_rate;
+    uint32_t samples;
+    uint32_t pathlen;
+} PcmCacheHeader;
+
+static struct {
+    char dir[PCMCACHE_PATHLEN];
+    int enabled;
+    PcmCacheStats stats;
+} pcmcache_globals;
+
+// Samples start at the first 16 byte boundary after the header and path.
+static size_t pcm_data_offset(size_t pathlen) {
+    return (sizeof(PcmCacheHeader) + pathlen + 15) & ~(size_t) 15;
+}
+
+static int pcm_cache_file(const char * path, char * buf, size_t buflen) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (const char * c = path; *c; c++)
+        h = (h ^ (unsigned char) *c) * 1099511628211ULL;
+    int n = snprintf(buf, buflen, "%s/%016llx.pcm", pcmcache_globals.dir, (unsigned long long) h);
+    return n > 0 && (size_t) n < buflen;
+}
+
+// The size of the entry a header describes. Fails if the header's counts
+// can't be right, so a corrupt entry can't overflow the size.
+static int pcm_cache_size(const PcmCacheHeader * h, size_t * size) {
+    // Vorbis has at most 255 channels.
+    if (!h->channels || h->channels > 255 || h->samples > INT_MAX || h->pathlen > PCMCACHE_PATHLEN)
+        return 0;
+    size_t offset = pcm_data_offset(h->pathlen);
+    size_t frame = (size_t) h->channels * sizeof(short);
+    if (h->samples > (SIZE_MAX - offset) / frame)
+        return 0;
+    *size = offset + h->samples * frame;
+    return 1;
+}
+
+static int pcm_cache_read(const char * path, const struct stat * src, PcmData * data) {
+    char file[PCMCACHE_PATHLEN];
+    if (!pcm_cache_file(path, file, sizeof(file)))
+        return 0;
+    const void * map;
+    size_t map_size;
+    if (!util_map(file, &map, &map_size))
+        return 0;
+    if (map_size < sizeof(PcmCacheHeader)) {
+        util_unmap(map, map_size);
+        return 0;
+    }
+    const PcmCacheHeader * h = map;
+    size_t pathlen = strlen(path);
+    size_t size;
+    int valid = memcmp(h->magic, "LDPC", 4) == 0 &&
+        h->version == PCMCACHE_VERSION &&
+        h->source_mtime == (int64_t) src->st_mtime &&
+        h->source_size == (uint64_t) src->st_size &&
+        h->pathlen == pathlen &&
+        pcm_cache_size(h, &size) &&
+        size == map_size &&
+        memcmp((const char *) map + sizeof(PcmCacheHeader), path, pathlen) == 0;
+    if (!valid) {
+        util_unmap(map, map_size);
+        return 0;
+    }
+    data->pcm = (short *) ((const char *) map + pcm_data_offset(pathlen));
+    data->samples = h->samples;
+    data->channels = h->channels;
+    data->sample_rate = h->sample_rate;
+    data->map = map;
+    data->map_size = map_size;
+    return 1;
+}
+
+// Writes to a temporary file first, so a reader never sees a partial entry even
+// when two threads decode the same file.
+static void pcm_cache_write(const char * path, const struct stat * src, const PcmData * data) {
+    char file[PCMCACHE_PATHLEN];
+    char tmp[PCMCACHE_PATHLEN + 32];
+    if (!pcm_cache_file(path, file, sizeof(file)))
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.%ld.%p", file, (long) getpid(), (const void *) data);
+    FILE * f = fopen(tmp, "wb");
+    if (!f)
+        return;
+    PcmCacheHeader h;
+    memcpy(h.magic, "LDPC", 4);
+    h.version = PCMCACHE_VERSION;
+    h.source_mtime = src->st_mtime;
+    h.source_size = src->st_size;
+    h.channels = data->channels;
+    h.sample_rate = data->sample_rate;
+    h.samples = data->samples;
+    h.pathlen = strlen(path);
+    static const char zeros[16] = {0};
+    size_t pad = pcm_data_offset(h.pathlen) - sizeof(h) - h.pathlen;
+    size_t bytes = (size_t) data->samples * data->channels * sizeof(short);
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(path, 1, h.pathlen, f) == h.pathlen &&
+        fwrite(zeros, 1, pad, f) == pad &&
+        fwrite(data->pcm, 1, bytes, f) == bytes;
+    if (fclose(f) || !ok || !util_rename(tmp, file))
+        remove(tmp);
+}
+
+int pcm_load(const char * path, PcmData * data) {
+    TRACE_SCOPE("pcm_load");
+    double start = util_nsec();
+    struct stat src;
+    int cache = pcmcache_globals.enabled && stat(path, &src) == 0;
+    if (cache && pcm_cache_read(path, &src, data)) {
+        data->cached = 1;
+        data->load_msec = (util_nsec() - start) / 1e6;
+        __atomic_add_fetch(&pcmcache_globals.stats.hits, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pcmcache_globals.stats.hit_usec, (unsigned long) (data->load_msec * 1000), __ATOMIC_RELAXED);
+        return 1;
+    }
+    data->map = NULL;
+    data->map_size = 0;
+    data->samples = stb_vorbis_decode_filename(path, &data->channels, &data->sample_rate, &data->pcm);
+    if (data->samples < 0)
+        return 0;
+    if (cache)
+        pcm_cache_write(path, &src, data);
+    data->cached = 0;
+    data->load_msec = (util_nsec() - start) / 1e6;
+    __atomic_add_fetch(&pcmcache_globals.stats.misses, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pcmcache_globals.stats.miss_usec, (unsigned long) (data->load_msec * 1000), __ATOMIC_RELAXED);
+    return 1;
+}
+
+void pcm_log_load(const char * name, const PcmData * data) {
+    console_log("Loaded %s in %.2f ms (%s)", name, data->load_msec, data->cached ? "cached" : "decoded");
+}
+
+void pcm_free(PcmData * data) {
+    if (data->map)
+        util_unmap(data->map, data->map_size);
+    else
+        free(data->pcm);
+    data->pcm = NULL;
+    data->map = NULL;
+}
+
+void pcmcache_stats(PcmCacheStats * stats) {
+    stats->hits = __atomic_load_n(&pcmcache_globals.stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&pcmcache_globals.stats.misses, __ATOMIC_RELAXED);
+    stats->hit_usec = __atomic_load_n(&pcmcache_globals.stats.hit_usec, __ATOMIC_RELAXED);
+    stats->miss_usec = __atomic_load_n(&pcmcache_globals.stats.miss_usec, __ATOMIC_RELAXED);
+}
+
+void pcmcache_set_enabled(int enabled) {
+    pcmcache_globals.enabled = enabled && pcmcache_globals.dir[0];
+}
+
+void pcmcache_init(const char * dir) {
+    char * out = pcmcache_globals.dir;
+    size_t len = sizeof(pcmcache_globals.dir);
+    int ok;
+    if (dir) {
+        int n = snprintf(out, len, "%s", dir);
+        ok = n > 0 && (size_t) n < len && util_mkdirs(out);
+    } else {
+        ok = util_cache_dir("pcm", out, len);
+    }
+    if (!ok)
+        out[0] = 0;
+    pcmcache_globals.enabled = out[0] != 0;
+}
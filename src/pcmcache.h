@@ -0,0 +1,46 @@
+#ifndef PCMCACHE_H_M4VJ7HQD
+#define PCMCACHE_H_M4VJ7HQD
+
+#include <stddef.h>
+
+// Decoded ogg files are cached on disk as raw 16 bit PCM, keyed by path and
+// validated against the source file's size and modification time. Cache hits
+// are memory mapped, so the samples can go straight to alBufferData.
+
+typedef struct {
+    short * pcm;
+    int samples;
+    int channels;
+    int sample_rate;
+    // Set when pcm points into a mapped cache file rather than the heap.
+    const void * map;
+    size_t map_size;
+    int cached;
+    double load_msec; // Reading the cache entry or decoding
+} PcmData;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long hit_usec;
+    unsigned long miss_usec;
+} PcmCacheStats;
+
+// Sets the cache directory, creating it if needed. NULL picks the user's
+// cache directory. If the directory can't be used, caching is turned off.
+void pcmcache_init(const char * dir);
+
+void pcmcache_set_enabled(int enabled);
+
+// Loads a decoded ogg file, from the cache if possible. Safe to call from
+// worker threads. Returns 0 if the file could not be decoded.
+int pcm_load(const char * path, PcmData * data);
+
+// Writes how long the load took to the console. Main thread only.
+void pcm_log_load(const char * name, const PcmData * data);
+
+void pcm_free(PcmData * data);
+
+void pcmcache_stats(PcmCacheStats * stats);
+
+#endif /* end of include guard: PCMCACHE_H_M4VJ7HQD */
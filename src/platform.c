@@ -9,37 +9,52 @@
 #include "fntdraw.h"
 #include "glfw.h"
 #include "audio.h"
+#include "jobs.h"
+#include "mixer.h"
+#include "pcmcache.h"
+#include "frametime.h"
+#include "glstats.h"
+#include "inputlog.h"
+#include "memtrack.h"
+#include "arena.h"
+#include "trace.h"
 #include <string.h>
 #include <ctype.h>
 
 // Set up Lua Interop
 
-static const LuaEventSignature les_tick = { "tick", 0, NULL };
-static const LuaEventSignature les_draw = { "draw", 0, NULL };
-static const LuaEventSignature les_load = { "load", 0, NULL };
-static const LuaEventSignature les_unload = { "unload", 0, NULL };
+static LuaEventSignature les_tick = LUAI_EVENT("tick", 0, NULL);
+static LuaEventSignature les_draw = LUAI_EVENT("draw", 0, NULL);
+static LuaEventSignature les_load = LUAI_EVENT("load", 0, NULL);
+static LuaEventSignature les_unload = LUAI_EVENT("unload", 0, NULL);
 
 static const int les_update_args[] = { LUA_TNUMBER };
-static const LuaEventSignature les_update = { "update", 1, les_update_args };
-
-static const int les_mouse_args[] = { LUA_TNUMBER, LUA_TSTRING, LUA_TNUMBER, LUA_TNUMBER };
-static const LuaEventSignature les_mouse = { "mouse", 4, les_mouse_args };
-
-static const int les_keyboard_args[] = { LUA_TSTRING, LUA_TSTRING, LUA_TNUMBER, LUA_TNUMBER };
-static const LuaEventSignature les_keyboard = { "keyboard", 4, les_keyboard_args };
+static LuaEventSignature les_update = LUAI_EVENT("update", 1, les_update_args);
 
 static const int les_error_args[] = { LUA_TSTRING };
-static const LuaEventSignature les_error = { "error", 1, les_error_args };
+static LuaEventSignature les_error = LUAI_EVENT("error", 1, les_error_args);
 
 static const int les_resize_args[] = { LUA_TNUMBER, LUA_TNUMBER };
-static const LuaEventSignature les_resize = { "resize", 2, les_resize_args };
+static LuaEventSignature les_resize = LUAI_EVENT("resize", 2, les_resize_args);
 
 // Platform stuff
 
 static double _platform_delta = 0.0;
 static double _platform_fps = 0.0;
+static double _platform_frame_target = 1.0 / 60;
 static int _platform_width = 0;
 static int _platform_height = 0;
+static PlatformOptions platform_options;
+
+// Time spent on each frame's work, excluding the wait in glfwSwapBuffers.
+static struct {
+    unsigned long frames;
+    double total;
+    double min;
+    double max;
+    double start;
+    double end;
+} platform_timing;
 
 double platform_delta() {
     return _platform_delta;
@@ -54,6 +69,10 @@ void platform_get_window(PlatformWindow * w) {
     w->height = _platform_height;
 }
 
+int platform_headless() {
+    return platform_options.headless;
+}
+
 int platform_width() {
     return _platform_width;
 }
@@ -122,9 +141,8 @@ int platform_res2file(const char * resource, char * pathbuf, unsigned bufsize) {
 }
 
 char * platform_res2file_ez(const char * resource) {
-    uqfree_if_needed();
     size_t slen = strlen(resource);
-    char * pathbuf = uqmalloc(slen + platform_buffer_predsize);
+    char * pathbuf = arena_alloc(slen + platform_buffer_predsize + 1);
     memcpy(pathbuf, platform_path_predicate, platform_buffer_predsize);
     strcpy(pathbuf + platform_buffer_predsize, resource);
     return pathbuf;
@@ -134,7 +152,7 @@ char * platform_res2file_ez(const char * resource) {
 
 static GLFWwindow * game_window;
 
-static const char * platform_get_action(int action) {
+const char * platform_get_action(int action) {
     switch (action) {
         case GLFW_PRESS: return "down";
         case GLFW_RELEASE: return "up";
@@ -143,7 +161,7 @@ static const char * platform_get_action(int action) {
     }
 }
 
-static const char * platform_get_key(int key) {
+const char * platform_get_key(int key) {
     switch(key) {
         case GLFW_KEY_SPACE: return " ";
         case GLFW_KEY_APOSTROPHE: return "'";
@@ -270,27 +288,112 @@ static const char * platform_get_key(int key) {
     }
 }
 
+static struct {
+    PlatformInputEvent queue[PLATFORM_INPUT_QUEUE];
+    unsigned count;
+    unsigned dropped;
+    unsigned char keys[GLFW_KEY_LAST + 1];
+    unsigned char buttons[GLFW_MOUSE_BUTTON_LAST + 1];
+    double x, y;
+} platform_input;
+
+static PlatformInputEvent * platform_input_push(int type) {
+    if (platform_input.count == PLATFORM_INPUT_QUEUE) {
+        platform_input.dropped++;
+        return NULL;
+    }
+    PlatformInputEvent * e = platform_input.queue + platform_input.count++;
+    e->type = type;
+    e->code = e->action = e->scancode = e->mods = 0;
+    e->x = platform_input.x;
+    e->y = platform_input.y;
+    e->dx = e->dy = 0;
+    e->time = glfwGetTime();
+    return e;
+}
+
+unsigned platform_input_events(const PlatformInputEvent ** events) {
+    *events = platform_input.queue;
+    return platform_input.count;
+}
+
+int platform_key_down(int key) {
+    return key >= 0 && key <= GLFW_KEY_LAST && platform_input.keys[key];
+}
+
+int platform_mouse_down(int button) {
+    return button >= 0 && button <= GLFW_MOUSE_BUTTON_LAST && platform_input.buttons[button];
+}
+
+void platform_cursor(double * x, double * y) {
+    *x = platform_input.x;
+    *y = platform_input.y;
+}
+
+static void platform_record(int type, int code, int scancode, int action, int mods, double x, double y) {
+    if (!platform_options.record) return;
+    InputLogEvent e = {type, code, scancode, action, mods, x, y};
+    inputlog_write_event(&e);
+}
+
 static void key_callback(GLFWwindow * window, int key, int scancode, int action, int mods) {
     if (window != game_window) return;
-    luai_event(&les_keyboard,
-            platform_get_key(key),
-            platform_get_action(action),
-            (double) scancode,
-            (double) mods);
+    platform_record(INPUTLOG_KEY, key, scancode, action, mods, 0, 0);
+    if (key >= 0 && key <= GLFW_KEY_LAST)
+        platform_input.keys[key] = action != GLFW_RELEASE;
+    PlatformInputEvent * e = platform_input_push(PLATFORM_INPUT_KEY);
+    if (e) {
+        e->code = key;
+        e->action = action;
+        e->scancode = scancode;
+        e->mods = mods;
+    }
 }
 
 static void mouse_button_callback(GLFWwindow * window, int button, int action, int mods) {
     if (window != game_window) return;
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
-    luai_event(&les_mouse,
-            (double) button,
-            platform_get_action(action),
-            xpos,
-            ypos);
+    platform_record(INPUTLOG_MOUSE, button, 0, action, mods, 0, 0);
+    if (button >= 0 && button <= GLFW_MOUSE_BUTTON_LAST)
+        platform_input.buttons[button] = action != GLFW_RELEASE;
+    PlatformInputEvent * e = platform_input_push(PLATFORM_INPUT_MOUSE);
+    if (e) {
+        e->code = button;
+        e->action = action;
+        e->mods = mods;
+    }
+}
+
+static void cursor_callback(GLFWwindow * window, double x, double y) {
+    if (window != game_window) return;
+    platform_record(INPUTLOG_CURSOR, 0, 0, 0, 0, x, y);
+    double dx = x - platform_input.x;
+    double dy = y - platform_input.y;
+    platform_input.x = x;
+    platform_input.y = y;
+    PlatformInputEvent * e = platform_input.count ? platform_input.queue + platform_input.count - 1 : NULL;
+    if (!e || e->type != PLATFORM_INPUT_CURSOR) {
+        e = platform_input_push(PLATFORM_INPUT_CURSOR);
+        if (!e) return;
+    }
+    e->x = x;
+    e->y = y;
+    e->dx += dx;
+    e->dy += dy;
+    e->time = glfwGetTime();
+}
+
+static void scroll_callback(GLFWwindow * window, double x, double y) {
+    if (window != game_window) return;
+    platform_record(INPUTLOG_SCROLL, 0, 0, 0, 0, x, y);
+    PlatformInputEvent * e = platform_input_push(PLATFORM_INPUT_SCROLL);
+    if (e) {
+        e->dx = x;
+        e->dy = y;
+    }
 }
 
 static void window_resize_callback(int width, int height) {
+    platform_record(INPUTLOG_RESIZE, 0, 0, 0, 0, width, height);
     glViewport(0, 0, width, height);
     _platform_width = width;
     _platform_height = height;
@@ -298,44 +401,201 @@ static void window_resize_callback(int width, int height) {
     luai_event(&les_resize, (double) width, (double) height);
 }
 
+// Feeds the next frame of the replay log through the input callbacks and
+// stores its delta. Returns 0 once the log is used up.
+static int platform_replay_frame(double * delta) {
+    InputLogEvent e;
+    int status;
+    while ((status = inputlog_read_event(&e, delta)) > 0) {
+        switch (e.type) {
+            case INPUTLOG_KEY:
+                key_callback(game_window, e.code, e.scancode, e.action, e.mods);
+                break;
+            case INPUTLOG_MOUSE:
+                mouse_button_callback(game_window, e.code, e.action, e.mods);
+                break;
+            case INPUTLOG_CURSOR:
+                cursor_callback(game_window, e.x, e.y);
+                break;
+            case INPUTLOG_SCROLL:
+                scroll_callback(game_window, e.x, e.y);
+                break;
+            case INPUTLOG_RESIZE:
+                window_resize_callback(e.x, e.y);
+                break;
+        }
+    }
+    return status == 0;
+}
+
 static void error_callback(int error, const char * message) {
     fprintf(stderr, "Error code %d: ", error);
     uerr(message);
 }
 
+static void platform_timing_report() {
+    unsigned long n = platform_timing.frames;
+    double wall = platform_timing.end - platform_timing.start;
+    double mean = n ? platform_timing.total / n : 0;
+    FrameTimeStats interval;
+    frametime_stats(FRAMETIME_FRAME, &interval);
+    printf("ldoom: %lu frames in %.3f s (%.1f fps), frame ms min %.3f mean %.3f max %.3f\n",
+            n, wall, wall > 0 ? n / wall : 0,
+            platform_timing.min * 1000, mean * 1000, platform_timing.max * 1000);
+    printf("ldoom: frame interval ms p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+            interval.p50, interval.p95, interval.p99, interval.max);
+    if (!platform_options.report)
+        return;
+    FILE * f = fopen(platform_options.report, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write report to %s\n", platform_options.report);
+        return;
+    }
+    ArenaStats scratch;
+    arena_stats(&scratch);
+    fprintf(f, "{\n");
+    fprintf(f, "  \"frames\": %lu,\n", n);
+    fprintf(f, "  \"seconds\": %.6f,\n", wall);
+    fprintf(f, "  \"fps\": %.3f,\n", wall > 0 ? n / wall : 0);
+    fprintf(f, "  \"frame_ms_min\": %.6f,\n", platform_timing.min * 1000);
+    fprintf(f, "  \"frame_ms_mean\": %.6f,\n", mean * 1000);
+    fprintf(f, "  \"frame_ms_max\": %.6f,\n", platform_timing.max * 1000);
+    fprintf(f, "  \"interval_ms_p50\": %.6f,\n", interval.p50);
+    fprintf(f, "  \"interval_ms_p95\": %.6f,\n", interval.p95);
+    fprintf(f, "  \"interval_ms_p99\": %.6f,\n", interval.p99);
+    fprintf(f, "  \"interval_ms_max\": %.6f,\n", interval.max);
+    fprintf(f, "  \"scratch_bytes_peak\": %lu,\n", (unsigned long) scratch.peak);
+    fprintf(f, "  \"scratch_bytes_reserved\": %lu,\n", (unsigned long) scratch.reserved);
+    fprintf(f, "  \"width\": %d,\n", _platform_width);
+    fprintf(f, "  \"height\": %d,\n", _platform_height);
+    fprintf(f, "  \"renderer\": ");
+    util_write_json_string(f, (const char *) glGetString(GL_RENDERER));
+    fprintf(f, "\n");
+    fprintf(f, "}\n");
+    fclose(f);
+}
+
+static void platform_timing_frame(double seconds) {
+    if (!platform_timing.frames || seconds < platform_timing.min)
+        platform_timing.min = seconds;
+    if (seconds > platform_timing.max)
+        platform_timing.max = seconds;
+    platform_timing.total += seconds;
+    platform_timing.frames++;
+}
+
 static int platform_mainloop_running = 1;
 void platform_mainloop() {
     double frametime = 0;
     double last_frametime = 0;
 
     int framecount = 0;
-    double fps_check_time = glfwGetTime();
+    // Replays tick on the clock of their deltas, so ticks land on the same
+    // frames as in the recording.
+    double tick_clock = platform_options.replay ? 0 : glfwGetTime();
+    double fps_check_time = tick_clock;
+
+    memset(&platform_timing, 0, sizeof(platform_timing));
+    platform_timing.start = glfwGetTime();
 
     platform_mainloop_running = 1;
     while (platform_mainloop_running) {
-        int width, height;
-        glfwGetFramebufferSize(game_window, &width, &height);
-        if (width != _platform_width && height != _platform_height) {
-            window_resize_callback(width, height);
-        }
+        TRACE_SCOPE("frame");
         framecount++;
         last_frametime = frametime;
         frametime = glfwGetTime();
+        TraceMark mark = TRACE_BEGIN("swap");
         glfwSwapBuffers(game_window);
+        TRACE_END(mark);
+        trace_frame();
+        glstats_frame();
+        memtrack_frame();
+        arena_frame();
+        double frame_start = glfwGetTime();
+        double phases[FRAMETIME_PHASES];
+        phases[FRAMETIME_FRAME] = frametime - last_frametime;
+        phases[FRAMETIME_SWAP] = frame_start - frametime;
+        mark = TRACE_BEGIN("events");
+        platform_input.count = 0;
         glfwPollEvents();
-        _platform_delta = frametime - last_frametime;
-        if (frametime > fps_check_time + 1) {
-            _platform_fps = framecount / (frametime - fps_check_time);
+        double replay_delta = 0;
+        if (platform_options.replay && !platform_replay_frame(&replay_delta)) {
+            TRACE_END(mark);
+            break;
+        }
+        // Live resizes are applied after the swap with the frame's other events,
+        // which is where a replay applies the recorded ones. A replay resizes
+        // only where the recording did.
+        if (!platform_options.replay) {
+            int width, height;
+            glfwGetFramebufferSize(game_window, &width, &height);
+            if (width != _platform_width || height != _platform_height) {
+                window_resize_callback(width, height);
+            }
+        }
+        if (platform_input.dropped) {
+            console_log("Dropped %u input events.", platform_input.dropped);
+            platform_input.dropped = 0;
+        }
+        luai_dispatch_input();
+        TRACE_END(mark);
+        double events_end = glfwGetTime();
+        phases[FRAMETIME_EVENTS] = events_end - frame_start;
+        if (platform_options.replay)
+            _platform_delta = replay_delta;
+        else if (platform_options.fixed_delta > 0)
+            _platform_delta = platform_options.fixed_delta;
+        else
+            _platform_delta = frametime - last_frametime;
+        if (platform_options.record)
+            inputlog_write_frame(_platform_delta);
+        tick_clock = platform_options.replay ? tick_clock + _platform_delta : frametime;
+        if (tick_clock > fps_check_time + 1) {
+            _platform_fps = framecount / (tick_clock - fps_check_time);
             framecount = 0;
-            fps_check_time = frametime;
-            luai_event(&les_tick);
+            fps_check_time = tick_clock;
+            luai_event0(&les_tick);
         }
-        luai_event(&les_update, _platform_delta);
+        mark = TRACE_BEGIN("update");
+        luai_event1n(&les_update, _platform_delta);
+        luai_scheduler_update(_platform_delta);
+        luai_ai_update(_platform_delta);
+        jobs_update();
+        audio_update(_platform_delta);
+        TRACE_END(mark);
+        double update_end = glfwGetTime();
+        phases[FRAMETIME_UPDATE] = update_end - events_end;
+        mark = TRACE_BEGIN("draw");
+        TRACE_GPU_BEGIN("draw");
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-        luai_event(&les_draw);
+        luai_event0(&les_draw);
+        TRACE_GPU_BEGIN("console");
         console_draw();
+        glstats_draw_overlay();
+        TRACE_GPU_END();
+        TRACE_GPU_END();
+        // Without vsync the driver can queue frames; finish them so the
+        // timings include the GPU.
+        if (platform_options.headless)
+            glFinish();
+        TRACE_END(mark);
+        double draw_end = glfwGetTime();
+        phases[FRAMETIME_DRAW] = draw_end - update_end;
+        mark = TRACE_BEGIN("gc");
+        luai_gc_step(_platform_frame_target - (draw_end - frame_start));
+        TRACE_END(mark);
+        phases[FRAMETIME_GC] = glfwGetTime() - draw_end;
+        // The first frame has no previous frame to measure from.
+        if (last_frametime > 0)
+            frametime_record(phases);
+        platform_timing_frame(glfwGetTime() - frame_start);
+        if (platform_options.frames && platform_timing.frames >= platform_options.frames)
+            platform_mainloop_running = 0;
     }
+    platform_timing.end = glfwGetTime();
     glfwSetWindowShouldClose(game_window, 1);
+    if (platform_options.headless || platform_options.frames)
+        platform_timing_report();
 }
 
 void platform_exit() {
@@ -344,13 +604,54 @@ void platform_exit() {
 
 // INITIALIZATION / DEINITIALIZATION
 
-void platform_init() {
-
-    glfwInit();
+static void platform_usage(const char * program) {
+    fprintf(stderr,
+            "usage: %s [--headless] [--frames N] [--fixed-dt SECONDS] [--size WxH]\n"
+            "       [--script RESOURCE] [--report PATH] [--frametimes CSV] [--trace JSON]\n"
+            "       [--record LOG] [--replay LOG]\n", program);
+    exit(1);
+}
 
-    glfwSetErrorCallback(&error_callback);
+void platform_parse_options(PlatformOptions * options, int argc, char ** argv) {
+    memset(options, 0, sizeof(PlatformOptions));
+    options->width = 1280;
+    options->height = 720;
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--headless")) {
+            options->headless = 1;
+            continue;
+        }
+        if (!value)
+            platform_usage(argv[0]);
+        if (!strcmp(arg, "--frames"))
+            options->frames = strtoul(value, NULL, 10);
+        else if (!strcmp(arg, "--fixed-dt"))
+            options->fixed_delta = strtod(value, NULL);
+        else if (!strcmp(arg, "--size")) {
+            if (sscanf(value, "%dx%d", &options->width, &options->height) != 2 ||
+                    options->width <= 0 || options->height <= 0)
+                platform_usage(argv[0]);
+        } else if (!strcmp(arg, "--script"))
+            options->script = value;
+        else if (!strcmp(arg, "--report"))
+            options->report = value;
+        else if (!strcmp(arg, "--frametimes"))
+            options->frametimes = value;
+        else if (!strcmp(arg, "--trace"))
+            options->trace = value;
+        else if (!strcmp(arg, "--record"))
+            options->record = value;
+        else if (!strcmp(arg, "--replay"))
+            options->replay = value;
+        else
+            platform_usage(argv[0]);
+        i++;
+    }
+}
 
-    // GLFW window and context creation
+static void platform_window_hints() {
     glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -358,6 +659,47 @@ void platform_init() {
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	/* glfwWindowHint(GLFW_DOUBLEBUFFER, GL_TRUE); */
 	/* glfwWindowHint(GLFW_SAMPLES, 16); */
+}
+
+static void quiet_error_callback(int error, const char * message) {
+    fprintf(stderr, "GLFW error code %d: %s\n", error, message);
+}
+
+// Prefers GLFW's null platform with an OSMesa context, which needs neither a
+// display nor a GPU. Falls back to a hidden window on the normal platform.
+static GLFWwindow * platform_headless_window(int width, int height) {
+    GLFWwindow * window;
+    glfwSetErrorCallback(&quiet_error_callback);
+#if defined(GLFW_PLATFORM_NULL) && defined(GLFW_OSMESA_CONTEXT_API)
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if (glfwInit()) {
+        platform_window_hints();
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        window = glfwCreateWindow(width, height, "Ldoom", NULL, NULL);
+        if (window)
+            return window;
+        glfwTerminate();
+    }
+    glfwInitHint(GLFW_PLATFORM, GLFW_ANY_PLATFORM);
+#endif
+    if (!glfwInit())
+        uerr("Could not initialize GLFW.");
+    platform_window_hints();
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    window = glfwCreateWindow(width, height, "Ldoom", NULL, NULL);
+    if (!window)
+        uerr("Could not create a headless window.");
+    return window;
+}
+
+static GLFWwindow * platform_fullscreen_window() {
+
+    glfwInit();
+
+    glfwSetErrorCallback(&error_callback);
+
+    // GLFW window and context creation
+    platform_window_hints();
 
     GLFWmonitor * monitor = glfwGetPrimaryMonitor();
     int mcount;
@@ -377,20 +719,58 @@ void platform_init() {
     glfwWindowHint(GLFW_GREEN_BITS, mode->greenBits);
     glfwWindowHint(GLFW_BLUE_BITS, mode->blueBits);
     glfwWindowHint(GLFW_REFRESH_RATE, mode->refreshRate);
+    if (mode->refreshRate > 0) {
+        _platform_frame_target = 1.0 / mode->refreshRate;
+    }
 
-	game_window = glfwCreateWindow(mode->width, mode->height, "Ldoom", monitor, NULL);
+	GLFWwindow * window = glfwCreateWindow(mode->width, mode->height, "Ldoom", monitor, NULL);
 
-	if (!game_window) {
+	if (!window) {
 	    glfwTerminate();
     }
+    return window;
+}
+
+void platform_init(const PlatformOptions * options) {
+
+    if (options)
+        platform_options = *options;
+    else
+        memset(&platform_options, 0, sizeof(platform_options));
+
+    if (platform_options.replay) {
+        InputLogHeader header;
+        if (!inputlog_replay(platform_options.replay, &header))
+            uerr("Could not read the replay log.");
+        platform_options.headless = 1;
+        platform_options.width = header.width;
+        platform_options.height = header.height;
+        platform_input.x = header.x;
+        platform_input.y = header.y;
+    }
+
+    if (platform_options.headless) {
+        game_window = platform_headless_window(platform_options.width, platform_options.height);
+        glfwSetErrorCallback(&error_callback);
+        // Benchmarks shouldn't need a sound card; OpenAL Soft honours this.
+#ifdef _WIN32
+        if (!getenv("ALSOFT_DRIVERS"))
+            _putenv_s("ALSOFT_DRIVERS", "null");
+#else
+        setenv("ALSOFT_DRIVERS", "null", 0);
+#endif
+    } else {
+        game_window = platform_fullscreen_window();
+    }
     glfwMakeContextCurrent(game_window);
-    glfwSwapInterval(1);
+    glfwSwapInterval(platform_options.headless ? 0 : 1);
 
     // Use GLAD to get stuff.
     if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
         glfwTerminate();
         return;
     }
+    glstats_init();
 
     // GL initializing
     int width, height;
@@ -407,18 +787,40 @@ void platform_init() {
     glDepthFunc(GL_LEQUAL);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    // Initialize input
-    glfwSetKeyCallback(game_window, &key_callback);
-    glfwSetMouseButtonCallback(game_window, &mouse_button_callback);
-    glfwSetInputMode(game_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // Initialize input. A replay's input comes only from its log.
+    if (!platform_options.replay) {
+        glfwSetKeyCallback(game_window, &key_callback);
+        glfwSetMouseButtonCallback(game_window, &mouse_button_callback);
+        glfwSetCursorPosCallback(game_window, &cursor_callback);
+        glfwSetScrollCallback(game_window, &scroll_callback);
+        glfwGetCursorPos(game_window, &platform_input.x, &platform_input.y);
+        glfwSetInputMode(game_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
+    if (platform_options.record) {
+        InputLogHeader header;
+        glfwGetFramebufferSize(game_window, &header.width, &header.height);
+        header.x = platform_input.x;
+        header.y = platform_input.y;
+        if (!inputlog_record(platform_options.record, &header))
+            uerr("Could not create the input log.");
+    }
 
     // Misc
     mat4_proj_ortho(screen_matrix, -1, width, height, 0, 0, 1);
 
+    trace_init();
+    if (platform_options.trace)
+        trace_start();
+
     luai_init();
     console_init();
     qd_init();
+    jobs_init(0);
+    pcmcache_init(NULL);
+    luai_chunkcache_init(NULL);
+    frametime_init(platform_options.frametimes);
     audio_init();
+    mixer_init(44100, 1);
 
     // Lua Interop
     luai_load_audio();
@@ -431,23 +833,52 @@ void platform_init() {
     luai_load_camera();
     luai_load_texture();
     luai_load_console();
+    luai_load_ffi();
+    luai_load_profiler();
+    luai_load_scheduler();
+    luai_load_ai();
+    luai_load_frametime();
+    luai_load_trace();
 
     luai_doresource("scripts/bootstrap.lua");
+    if (platform_options.script && luai_doresource(platform_options.script)) {
+        fprintf(stderr, "%s\n", lua_tostring(globalLuaState, -1));
+        uerr("Could not run the startup script.");
+    }
 
-    luai_event(&les_load);
+    luai_event0(&les_load);
 }
 
 void platform_deinit() {
 
-    luai_event(&les_unload);
+    luai_event0(&les_unload);
+
+    // Finishing the outstanding jobs runs their completions, which log to the
+    // console and may call into Lua, so both have to still be up.
+    jobs_deinit();
+    frametime_deinit();
+    mixer_deinit();
 
     console_deinit();
+    glstats_deinit();
     qd_deinit();
-    audio_deinit();
 
+    luai_ai_deinit();
+
+    // Lua finalizers release sounds, so close Lua while audio is still up.
     luai_deinit();
 
+    inputlog_close();
+    audio_deinit();
+
+    if (platform_options.trace && !trace_write(platform_options.trace))
+        fprintf(stderr, "Could not write trace to %s\n", platform_options.trace);
+    trace_deinit();
+
     glfwDestroyWindow(game_window);
     glfwTerminate();
 
+    arena_deinit();
+    memtrack_report();
+
 }
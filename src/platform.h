@@ -8,14 +8,37 @@
 //////////////////////////////////////// END DEFINES
 
 // Initialization
-void platform_init();
+
+// Startup options, usually from the command line.
+typedef struct {
+    int headless; // Hidden window, no vsync, null audio device
+    unsigned frames; // Quit after this many frames. 0 runs until ldoom.quit.
+    double fixed_delta; // Seconds handed to update each frame. 0 uses the clock.
+    int width, height; // Window size when headless
+    const char * script; // Resource run after bootstrap.lua, such as a benchmark scenario
+    const char * report; // If set, the timing report is also written here as JSON
+    const char * frametimes; // If set, every frame's timings are written here as CSV on exit
+    const char * trace; // If set, a trace is captured from startup and written here on exit
+    const char * record; // If set, input events and frame deltas are logged here
+    const char * replay; // Replays a recorded log headless, at its size and with its deltas
+} PlatformOptions;
+
+// Fills options from the command line. Prints usage and exits on bad arguments.
+void platform_parse_options(PlatformOptions * options, int argc, char ** argv);
+
+// NULL options opens the usual fullscreen window.
+void platform_init(const PlatformOptions * options);
 void platform_deinit();
 
+int platform_headless();
+
 // Files and Resource
 
 // An immutable resource
 int platform_res2file(const char * resource, char * pathbuf, unsigned bufsize);
 
+// Like platform_res2file, but the path is allocated in the scratch arena and
+// stays valid until the end of the frame or enclosing arena scope.
 char * platform_res2file_ez(const char * resource);
 
 // A persistent data file
@@ -41,6 +64,36 @@ const float * platform_screen_matrix(); // Returns the orthographic projection m
 
 // Generic Input
 
+#define PLATFORM_INPUT_KEY 0
+#define PLATFORM_INPUT_MOUSE 1
+#define PLATFORM_INPUT_CURSOR 2
+#define PLATFORM_INPUT_SCROLL 3
+
+#define PLATFORM_INPUT_QUEUE 256
+
+// Key and mouse events are queued while polling and handed out once per frame.
+// Consecutive cursor moves are merged into one event, with dx and dy summed.
+typedef struct {
+    int type;
+    int code; // GLFW key or mouse button
+    int action;
+    int scancode;
+    int mods;
+    double x, y; // Cursor position
+    double dx, dy; // Cursor movement, or scroll offset
+    double time;
+} PlatformInputEvent;
+
+// Returns the events queued during the last poll. Valid until the next frame.
+unsigned platform_input_events(const PlatformInputEvent ** events);
+
+int platform_key_down(int key);
+int platform_mouse_down(int button);
+void platform_cursor(double * x, double * y);
+
+const char * platform_get_key(int key);
+const char * platform_get_action(int action);
+
 // Flow Control
 void platform_mainloop();
 void platform_exit();
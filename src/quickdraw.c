@@ -1,7 +1,9 @@
 #include "quickdraw.h"
+#include "trace.h"
 #include "glfw.h"
 #include "shader.h"
 #include "platform.h"
+#include "memtrack.h"
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
@@ -34,11 +36,12 @@ static GLint umatrix_loc;
 
 static GLuint VAO;
 static GLuint VBO;
+static long long VBO_size = 0;
 
 static inline void ensure_capacity(unsigned cap) {
     if (pbuffer_capacity < cap) {
         pbuffer_capacity = cap;
-        pbuffer = realloc(pbuffer, sizeof(float) * cap);
+        pbuffer = trealloc(MEM_TAG_QUICKDRAW, pbuffer, sizeof(float) * cap);
     }
 }
 
@@ -58,7 +61,7 @@ void qd_init() {
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
     glBindVertexArray(0);
 
-    pbuffer = malloc(10 * sizeof(float));
+    pbuffer = tmalloc(MEM_TAG_QUICKDRAW, 10 * sizeof(float));
     pbuffer_capacity = 10;
 
     initialized = 1;
@@ -68,8 +71,10 @@ void qd_deinit() {
     program_deinit(&program);
     glDeleteBuffers(1, &VBO);
     glDeleteVertexArrays(1, &VAO);
+    memtrack_vram(MEM_TAG_QUICKDRAW, -VBO_size);
+    VBO_size = 0;
     if (pbuffer)
-        free(pbuffer);
+        tfree(pbuffer);
 }
 
 void qd_rgbav(float c[4]) {
@@ -196,10 +201,15 @@ void qd_end() {
 
 void qd_draw(unsigned type) {
     if (drawing || (type == QD_NONE)) return;
+    TRACE_SCOPE("qd_draw");
     glUseProgram(program.id);
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * pbuffer_len, pbuffer, GL_DYNAMIC_DRAW);
+    if (VBO_size != (long long) sizeof(GLfloat) * pbuffer_len) {
+        memtrack_vram(MEM_TAG_QUICKDRAW, sizeof(GLfloat) * pbuffer_len - VBO_size);
+        VBO_size = sizeof(GLfloat) * pbuffer_len;
+    }
     glUniform4fv(ucolor_loc, 1, color);
     glUniformMatrix4fv(umatrix_loc, 1, GL_FALSE, platform_screen_matrix());
     glDrawArrays(get_gl_draw_type(type), 0, pbuffer_len / 2);
@@ -1,4 +1,5 @@
 #include "scene.h"
+#include "trace.h"
 #include "ldmath.h"
 #include "shader.h"
 #include "platform.h"
@@ -76,6 +77,11 @@ void scene_remove_mob(Mob * mob) {
      }
 }
 
+Mob ** scene_get_mobs(unsigned * count) {
+    *count = scene_mob_count;
+    return scene_mobs;
+}
+
 void scene_resize(int width, int height) {
     camera_set_perspective(&scene_camera, scene_camera.data.perspective.fovY, width / (float) height, 0.05f, 100.0f);
 }
@@ -143,6 +149,8 @@ static int scene_resolve_mob_collision(Mob * a, Mob * b) {
 
 void scene_update() {
 
+    TRACE_SCOPE("scene_update");
+
     static const vec3 zero = {0, 0, 0};
 
     for (unsigned update_count = 0; update_count < updates_per_frame; update_count++) {
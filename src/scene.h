@@ -21,6 +21,9 @@ void scene_add_mob(Mob * mob);
 
 void scene_remove_mob(Mob * mob);
 
+// The scene's mob array. Adding mobs may move it, so don't hold on to it.
+Mob ** scene_get_mobs(unsigned * count);
+
 // Static Models
 void scene_add_model(Model * model);
 
@@ -1,5 +1,7 @@
 #include "texture.h"
 #include "util.h"
+#include "trace.h"
+#include "memtrack.h"
 #include <stdlib.h>
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_ONLY_PNG
@@ -21,8 +23,17 @@ static unsigned char * loadImage(const char * path, int pathlen, unsigned * w, u
 
 }
 
+/*
+ * Estimated bytes of GPU memory, for RGBA8 with a full mipmap chain.
+ */
+static long long texture_vram(const Texture * t) {
+    long long level = 4LL * t->w * t->h;
+    return (t->type == GL_TEXTURE_CUBE_MAP ? 6 : 1) * level * 4 / 3;
+}
+
 Texture * texture_init_file(Texture * t, const char * path, int pathlen) {
 
+    TRACE_SCOPE("texture_init_file");
     unsigned width, height;
     unsigned char * image = loadImage(path, pathlen, &width, &height);
 
@@ -44,6 +55,7 @@ Texture * texture_init_file(Texture * t, const char * path, int pathlen) {
     t->w = width;
     t->h= height;
     t->type = GL_TEXTURE_2D;
+    memtrack_vram(MEM_TAG_TEXTURE, texture_vram(t));
 
     return t;
 }
@@ -59,6 +71,7 @@ Texture * texture_init_resource(Texture * t, const char * resource) {
  * Loads a cubemap from 6 images.
  */
 Texture * texture_cube_init_file(Texture * t, const char * paths[6]) {
+    TRACE_SCOPE("texture_cube_init_file");
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 	t->id = textureID;
@@ -74,6 +87,7 @@ Texture * texture_cube_init_file(Texture * t, const char * paths[6]) {
             GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
             GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image
         );
+        free(image);
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -88,6 +102,7 @@ Texture * texture_cube_init_file(Texture * t, const char * paths[6]) {
 	t->w = width;
 	t->h = height;
 	t->type = GL_TEXTURE_CUBE_MAP;
+    memtrack_vram(MEM_TAG_TEXTURE, texture_vram(t));
 
 	return t;
 }
@@ -113,4 +128,5 @@ Texture * texture_cube_init_resource(Texture * t, const char * resources[6]) {
 
 void texture_deinit(Texture * t) {
     glDeleteTextures(1, &t->id);
+    memtrack_vram(MEM_TAG_TEXTURE, -texture_vram(t));
 }
@@ -0,0 +1,232 @@
+#include "trace.h"
+#include "glfw.h"
+#include "util.h"
+#include "memtrack.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char * name;
+    double start;
+    double end;
+} TraceEvent;
+
+typedef struct TraceThread {
+    unsigned tid;
+    unsigned generation;
+    unsigned count;
+    unsigned long dropped;
+    char name[32];
+    struct TraceThread * next;
+    // Allocated by the first event the thread records in a capture, so
+    // threads that never trace don't hold a buffer.
+    TraceEvent * events;
+} TraceThread;
+
+typedef struct {
+    const char * name;
+    GLuint queries[2];
+} TraceGpuQuery;
+
+int trace_capturing;
+
+static __thread TraceThread * trace_local;
+
+static struct {
+    pthread_mutex_t lock;
+    TraceThread * threads;
+    unsigned thread_count;
+    unsigned generation;
+    // GPU queries are used as a ring. Pending ones sit between tail and head.
+    TraceGpuQuery gpu[TRACE_GPU_QUERIES];
+    unsigned gpu_head;
+    unsigned gpu_tail;
+    unsigned gpu_stack[TRACE_GPU_DEPTH];
+    unsigned gpu_depth;
+    int gpu_ready;
+    // CPU time minus GPU time, in microseconds.
+    double gpu_offset;
+    TraceThread * gpu_thread;
+} trace;
+
+double trace_usec() {
+    return util_nsec() / 1e3;
+}
+
+static TraceThread * trace_thread_new(const char * name) {
+    TraceThread * t = tcalloc(MEM_TAG_TOOLS, 1, sizeof(TraceThread));
+    pthread_mutex_lock(&trace.lock);
+    t->tid = ++trace.thread_count;
+    t->generation = trace.generation;
+    if (name)
+        snprintf(t->name, sizeof(t->name), "%s", name);
+    else
+        snprintf(t->name, sizeof(t->name), "thread %u", t->tid);
+    t->next = trace.threads;
+    trace.threads = t;
+    pthread_mutex_unlock(&trace.lock);
+    return t;
+}
+
+void trace_thread_name(const char * name) {
+    if (!trace_local)
+        trace_local = trace_thread_new(name);
+    else
+        snprintf(trace_local->name, sizeof(trace_local->name), "%s", name);
+}
+
+static void trace_push(TraceThread * t, const char * name, double start, double end) {
+    // A new capture started since this thread last recorded.
+    unsigned generation = __atomic_load_n(&trace.generation, __ATOMIC_ACQUIRE);
+    if (t->generation != generation) {
+        t->generation = generation;
+        t->dropped = 0;
+        __atomic_store_n(&t->count, 0, __ATOMIC_RELEASE);
+    }
+    if (!t->events)
+        t->events = tmalloc(MEM_TAG_TOOLS, TRACE_EVENTS_PER_THREAD * sizeof(TraceEvent));
+    if (!t->events || t->count == TRACE_EVENTS_PER_THREAD) {
+        t->dropped++;
+        return;
+    }
+    TraceEvent * e = t->events + t->count;
+    e->name = name;
+    e->start = start;
+    e->end = end;
+    __atomic_store_n(&t->count, t->count + 1, __ATOMIC_RELEASE);
+}
+
+void trace_complete(const char * name, double start, double end) {
+    if (!trace_local)
+        trace_local = trace_thread_new(NULL);
+    trace_push(trace_local, name, start, end);
+}
+
+// GPU
+
+static void trace_gpu_setup() {
+    if (!trace.gpu_ready) {
+        for (unsigned i = 0; i < TRACE_GPU_QUERIES; i++)
+            glGenQueries(2, trace.gpu[i].queries);
+        trace.gpu_thread = trace_thread_new("GPU");
+        trace.gpu_ready = 1;
+    }
+    GLint64 gpu_nsec;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_nsec);
+    trace.gpu_offset = trace_usec() - gpu_nsec / 1e3;
+    trace.gpu_head = trace.gpu_tail = 0;
+    trace.gpu_depth = 0;
+}
+
+void trace_gpu_begin(const char * name) {
+    if (!trace.gpu_ready || trace.gpu_depth == TRACE_GPU_DEPTH ||
+            trace.gpu_head - trace.gpu_tail == TRACE_GPU_QUERIES)
+        return;
+    unsigned slot = trace.gpu_head++ % TRACE_GPU_QUERIES;
+    trace.gpu[slot].name = name;
+    glQueryCounter(trace.gpu[slot].queries[0], GL_TIMESTAMP);
+    trace.gpu_stack[trace.gpu_depth++] = slot;
+}
+
+void trace_gpu_end() {
+    if (!trace.gpu_depth)
+        return;
+    unsigned slot = trace.gpu_stack[--trace.gpu_depth];
+    glQueryCounter(trace.gpu[slot].queries[1], GL_TIMESTAMP);
+}
+
+void trace_frame() {
+    if (!trace.gpu_ready)
+        return;
+    // Queries finish in order, so stop at the first one still in flight. Scopes
+    // still open have no end query yet.
+    while (trace.gpu_tail != trace.gpu_head) {
+        TraceGpuQuery * q = trace.gpu + trace.gpu_tail % TRACE_GPU_QUERIES;
+        for (unsigned i = 0; i < trace.gpu_depth; i++)
+            if (trace.gpu_stack[i] == trace.gpu_tail % TRACE_GPU_QUERIES)
+                return;
+        GLint available = 0;
+        glGetQueryObjectiv(q->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 start, end;
+        glGetQueryObjectui64v(q->queries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(q->queries[1], GL_QUERY_RESULT, &end);
+        if (trace_capturing)
+            trace_push(trace.gpu_thread, q->name,
+                    start / 1e3 + trace.gpu_offset, end / 1e3 + trace.gpu_offset);
+        trace.gpu_tail++;
+    }
+}
+
+// CONTROL
+
+void trace_init() {
+    memset(&trace, 0, sizeof(trace));
+    pthread_mutex_init(&trace.lock, NULL);
+    trace_thread_name("main");
+}
+
+void trace_deinit() {
+    trace_capturing = 0;
+    if (trace.gpu_ready)
+        for (unsigned i = 0; i < TRACE_GPU_QUERIES; i++)
+            glDeleteQueries(2, trace.gpu[i].queries);
+    // Every other thread that traced must have stopped by now.
+    pthread_mutex_lock(&trace.lock);
+    TraceThread * t = trace.threads;
+    while (t) {
+        TraceThread * next = t->next;
+        tfree(t->events);
+        tfree(t);
+        t = next;
+    }
+    trace.threads = NULL;
+    pthread_mutex_unlock(&trace.lock);
+    trace_local = NULL;
+    pthread_mutex_destroy(&trace.lock);
+}
+
+void trace_start() {
+    __atomic_add_fetch(&trace.generation, 1, __ATOMIC_RELEASE);
+    trace_gpu_setup();
+    __atomic_store_n(&trace_capturing, 1, __ATOMIC_RELEASE);
+}
+
+void trace_stop() {
+    __atomic_store_n(&trace_capturing, 0, __ATOMIC_RELEASE);
+}
+
+int trace_write(const char * path) {
+    FILE * f = fopen(path, "w");
+    if (!f)
+        return 0;
+    unsigned generation = __atomic_load_n(&trace.generation, __ATOMIC_ACQUIRE);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int first = 1;
+    pthread_mutex_lock(&trace.lock);
+    for (TraceThread * t = trace.threads; t; t = t->next) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                first ? "" : ",\n", t->tid);
+        util_write_json_string(f, t->name);
+        fprintf(f, "}}");
+        first = 0;
+        if (t->generation != generation)
+            continue;
+        unsigned count = __atomic_load_n(&t->count, __ATOMIC_ACQUIRE);
+        for (unsigned i = 0; i < count; i++) {
+            const TraceEvent * e = t->events + i;
+            fprintf(f, ",\n{\"name\":");
+            util_write_json_string(f, e->name);
+            fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                    t == trace.gpu_thread ? "gpu" : "cpu", e->start, e->end - e->start, t->tid);
+        }
+        if (t->dropped)
+            fprintf(stderr, "Trace buffer of %s was full; dropped %lu events.\n", t->name, t->dropped);
+    }
+    pthread_mutex_unlock(&trace.lock);
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
@@ -0,0 +1,93 @@
+#ifndef TRACE_H_V7N3XKQE
+#define TRACE_H_V7N3XKQE
+
+#include <stddef.h>
+
+// Scoped CPU profiler with GL timestamp queries, saved as Chrome trace_event
+// JSON for chrome://tracing or ui.perfetto.dev. Scopes write into a buffer owned
+// by their thread. While no capture is running, a scope costs one flag check.
+// Building with LDOOMC_NO_TRACE compiles the macros out, as does a compiler
+// without GNU C's cleanup attribute, which TRACE_SCOPE needs.
+//
+//     TRACE_SCOPE("scene_update");            // Until the end of the block
+//     TraceMark m = TRACE_BEGIN("physics");   // Or an explicit pair
+//     TRACE_END(m);
+//     TRACE_GPU_BEGIN("draw");                // Main thread, GL context current
+//     TRACE_GPU_END();
+
+#define TRACE_EVENTS_PER_THREAD (1 << 16)
+#define TRACE_GPU_QUERIES 256
+#define TRACE_GPU_DEPTH 16
+
+typedef struct {
+    const char * name;
+    double start;
+} TraceMark;
+
+void trace_init();
+void trace_deinit();
+
+// Starts a new capture, discarding the previous one.
+void trace_start();
+void trace_stop();
+
+// Writes the current capture. Returns 0 if the file could not be written.
+int trace_write(const char * path);
+
+// Names the calling thread in traces.
+void trace_thread_name(const char * name);
+
+// Collects finished GPU queries. Call once per frame on the main thread.
+void trace_frame();
+
+// Used by the macros. Names must outlive the capture, e.g. string literals.
+extern int trace_capturing;
+double trace_usec();
+void trace_complete(const char * name, double start, double end);
+void trace_gpu_begin(const char * name);
+void trace_gpu_end();
+
+#if !defined(__GNUC__) && !defined(LDOOMC_NO_TRACE)
+#define LDOOMC_NO_TRACE
+#endif
+
+#ifndef LDOOMC_NO_TRACE
+
+static inline TraceMark trace_begin(const char * name) {
+    TraceMark m = {NULL, 0};
+    if (__atomic_load_n(&trace_capturing, __ATOMIC_RELAXED)) {
+        m.name = name;
+        m.start = trace_usec();
+    }
+    return m;
+}
+
+static inline void trace_end(TraceMark m) {
+    if (m.name)
+        trace_complete(m.name, m.start, trace_usec());
+}
+
+static inline void trace_scope_end(TraceMark * m) {
+    trace_end(*m);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END(mark) trace_end(mark)
+#define TRACE_SCOPE(name) \
+    TraceMark TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) = trace_begin(name)
+#define TRACE_GPU_BEGIN(name) do { if (trace_capturing) trace_gpu_begin(name); } while (0)
+#define TRACE_GPU_END() do { if (trace_capturing) trace_gpu_end(); } while (0)
+
+#else
+
+#define TRACE_BEGIN(name) ((TraceMark) {NULL, 0})
+#define TRACE_END(mark) ((void) (mark))
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_GPU_BEGIN(name) do {} while (0)
+#define TRACE_GPU_END() do {} while (0)
+
+#endif
+
+#endif /* end of include guard: TRACE_H_V7N3XKQE */
@@ -1,5 +1,18 @@
 #include "util.h"
 #include "ldmath.h"
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 const char * util_filename_ext(const char * path) {
     const char * dot = strrchr(path, '.');
@@ -30,44 +43,183 @@ char * util_slurp(const char * path, long * length) {
     return data;
 }
 
-static char * staticbuffer = NULL;
-static size_t staticbuffer_size = 0;
-static int buffer_in_use = 0;
+#ifdef _WIN32
+#define UTIL_SEPARATOR(c) ((c) == '/' || (c) == '\\')
+#define util_mkdir(path) _mkdir(path)
+#else
+#define UTIL_SEPARATOR(c) ((c) == '/')
+#define util_mkdir(path) mkdir((path), 0755)
+#endif
 
-// Allocates some temprary data. Only one chunk of data at a time can be allocated like this.
-void * uqmalloc(size_t size) {
-    if (buffer_in_use)
-        uerr("uqfree must be called before uqmalloc can be called again.");
-    if (staticbuffer_size == 0) {
-        staticbuffer = malloc(size);
-        staticbuffer_size = size;
-    } else if (size > staticbuffer_size)
-        staticbuffer = realloc(staticbuffer, size);
-        staticbuffer_size = size;
-    buffer_in_use = 1;
-    return staticbuffer;
+// Succeeds if the directory is made or is already there. A drive like C: can
+// fail to be made but still exists.
+static int util_mkdir_one(const char * path) {
+    struct stat st;
+    return !util_mkdir(path) || (!stat(path, &st) && S_ISDIR(st.st_mode));
 }
 
-// realloc the memory from uqmalloc.
-void * uqrealloc(size_t size) {
-    if (size > staticbuffer_size)
-        staticbuffer = realloc(staticbuffer, size);
-    return staticbuffer;
+int util_mkdirs(char * path) {
+    for (char * c = path + 1; *c; c++) {
+        if (!UTIL_SEPARATOR(*c))
+            continue;
+        char sep = *c;
+        *c = 0;
+        int err = !util_mkdir_one(path);
+        *c = sep;
+        if (err)
+            return 0;
+    }
+    return util_mkdir_one(path);
+}
+
+int util_cache_dir(const char * sub, char * out, size_t len) {
+    const char * xdg = getenv("XDG_CACHE_HOME");
+    const char * home = getenv("HOME");
+    int n;
+#ifdef __APPLE__
+    xdg = NULL;
+#endif
+#ifdef _WIN32
+    // Windows has no XDG or HOME by default, so use the local app data.
+    const char * local = getenv("LOCALAPPDATA");
+    if (local && *local) {
+        xdg = local;
+        home = NULL;
+    }
+#endif
+    if (xdg && *xdg)
+        n = snprintf(out, len, "%s/ldoom/%s", xdg, sub);
+    else if (home && *home)
+#ifdef __APPLE__
+        n = snprintf(out, len, "%s/Library/Caches/ldoom/%s", home, sub);
+#else
+        n = snprintf(out, len, "%s/.cache/ldoom/%s", home, sub);
+#endif
+    else
+        return 0;
+    return n > 0 && (size_t) n < len && util_mkdirs(out);
+}
+
+void util_write_json_string(FILE * f, const char * s) {
+    fputc('"', f);
+    for (; s && *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+#ifdef _WIN32
+
+int util_map(const char * path, const void ** data, size_t * length) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || (unsigned long long) size.QuadPart > (size_t) -1) {
+        CloseHandle(file);
+        return 0;
+    }
+    *data = NULL;
+    *length = (size_t) size.QuadPart;
+    if (!*length) {
+        CloseHandle(file);
+        return 1;
+    }
+    // The view keeps the file open after both handles are closed.
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return 0;
+    *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    return *data != NULL;
+}
+
+void util_unmap(const void * data, size_t length) {
+    if (data)
+        UnmapViewOfFile(data);
+}
+
+int util_rename(const char * from, const char * to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+unsigned util_cpu_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 1 ? info.dwNumberOfProcessors : 1;
 }
 
-void uqfree_if_needed() {
-    buffer_in_use = 0;
+void util_sleep_usec(unsigned long usec) {
+    Sleep((usec + 999) / 1000);
 }
 
-// Frees data allocated with uqmalloc.
-void uqfree(void * ptr) {
-    if (ptr != staticbuffer)
-        uerr("Trying to free memory not allocated with uqmalloc.");
-    if (!buffer_in_use)
-        uerr("Trying to free memory not in use.");
-    buffer_in_use = 0;
+double util_nsec() {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double) now.QuadPart * 1e9 / freq.QuadPart;
 }
 
+#else
+
+int util_map(const char * path, const void ** data, size_t * length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return 0;
+    }
+    *data = NULL;
+    *length = st.st_size;
+    if (*length) {
+        void * map = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+            *data = map;
+    }
+    close(fd);
+    return !*length || *data;
+}
+
+void util_unmap(const void * data, size_t length) {
+    if (data)
+        munmap((void *) data, length);
+}
+
+int util_rename(const char * from, const char * to) {
+    return !rename(from, to);
+}
+
+unsigned util_cpu_count() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? cores : 1;
+}
+
+void util_sleep_usec(unsigned long usec) {
+    struct timespec ts = {usec / 1000000, (usec % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+double util_nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#endif
+
 // Debug printing
 
 void mat4_print(mat4 m) {
@@ -18,21 +18,39 @@
 
 const char * util_filename_ext(const char * path);
 
-// Allocates some temprary data. Only one chunk of data at a time can be allocated like this.
-void * uqmalloc(size_t size);
+// Slurped data musted be freed via free.
+char * util_slurp(const char * path, long * length);
 
-// realloc the memory from uqmalloc.
-void * uqrealloc(size_t size);
+void util_spit(const char * path, const char * data, long length);
 
-// Frees data allocated with uqmalloc.
-void uqfree(void * ptr);
+// Creates every missing directory along a path. The path is restored afterwards.
+int util_mkdirs(char * path);
 
-void uqfree_if_needed();
+// Writes the user's cache directory for ldoom with sub appended, and creates
+// it. Returns 0 if there is no usable cache directory.
+int util_cache_dir(const char * sub, char * out, size_t len);
 
-// Slurped data musted be freed via free.
-char * util_slurp(const char * path, long * length);
+// Writes s as a quoted JSON string. NULL is written as an empty string.
+void util_write_json_string(FILE * f, const char * s);
 
-void util_spit(const char * path, const char * data, long length);
+// Maps a whole file read only. An empty file succeeds with a NULL pointer.
+// Returns 0 if the file can't be opened or mapped.
+int util_map(const char * path, const void ** data, size_t * length);
+
+void util_unmap(const void * data, size_t length);
+
+// Renames from to to, replacing to if it exists.
+int util_rename(const char * from, const char * to);
+
+// Nanoseconds on a monotonic clock. Safe to call from any thread.
+double util_nsec();
+
+// Number of online processors, at least 1.
+unsigned util_cpu_count();
+
+// Suspends the calling thread for at least usec microseconds. Windows rounds
+// up to whole milliseconds.
+void util_sleep_usec(unsigned long usec);
 
 // Debug printing
 void mat4_print(mat4 m);